@@ -0,0 +1,118 @@
+/**
+*************************************************************
+* @file sample_alloc.cc
+* @brief Checks memory taken by the render arena
+*
+* operator new is replaced to count allocations. Once the template
+* is compiled and the render buffer estimate is known, a render only
+* asks for the output string and what user functions need (arguments,
+* input and result); parser and evaluator temporaries come from the
+* arena.
+*
+* Templates compiled out of render() (getTemplate(), freeze(),
+* SiliconReload...) must not make the thread's arena grow: it's only
+* reset when a render finishes.
+*
+* Exits with 1 if a check fails.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <cctype>
+#include <new>
+#include "silicon.h"
+
+using namespace std;
+
+namespace
+{
+  unsigned long allocations = 0;
+}
+
+void* operator new(std::size_t size)
+{
+  ++allocations;
+  void* ptr = malloc((size)?size:1);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+  free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  free(ptr);
+}
+
+string upper(Silicon* s, Silicon::StringMap args, std::string input)
+{
+  for (auto& c : input)
+    c = toupper(c);
+
+  return input;
+}
+
+int main()
+{
+  int errors = 0;
+  Silicon t = Silicon::createFromStr("<h1>{{title}}</h1>\n"
+				     "{%if show}}Shown: {{title|html}}{/if}}\n"
+				     "{!upper}}{{title}}{/upper}}\n"
+				     "{%collection var=people}}"
+				     "<li>{{people.name}} {{people._lineNumber}}{%if people._last}} (last){/if}}</li>\n"
+				     "{/collection}}");
+  t.setKeyword("title", "Allocations");
+  t.setKeyword("show", "1");
+  t.setFunction("upper", upper);
+  for (int i=0; i<20; ++i)
+    t.addToCollection("people", { { "name", "Person "+to_string(i) } });
+
+  /* Compile and learn output size */
+  std::string output;
+  for (int i=0; i<10; ++i)
+    output = t.render();
+
+  const int renders = 10000;
+  unsigned long before = allocations;
+  for (int i=0; i<renders; ++i)
+    output = t.render();
+  double perRender = (double) (allocations-before) / renders;
+  cout << "Render: "<<perRender<<" allocations per render ("<<output.size()<<" bytes), arena: "<<Silicon::getArenaStats().systemAllocations<<" blocks, "<<Silicon::getArenaStats().resets<<" resets"<<endl;
+  /* Output string, and upper()'s arguments, input and result */
+  if (perRender > 4)
+    {
+      cout << "  ERROR: more allocations than expected"<<endl;
+      ++errors;
+    }
+
+  /* Compiled out of render(), many times */
+  std::size_t reserved = Silicon::getArenaStats().reserved;
+  for (int i=0; i<20000; ++i)
+    {
+      t.setData("Hello {{customer.billing.address_line}} "+to_string(i)+"\n"
+		"{!format value=\"a rather long argument value\" other=\"and another long argument\"/}\n"
+		"{%if customer.billing.country==\"somewhere far away\"}}x{/if}}");
+      t.getTemplate();
+    }
+  cout << "Compiling: "<<Silicon::getArenaStats().reserved-reserved<<" bytes reserved by the arena"<<endl;
+  if (Silicon::getArenaStats().reserved-reserved > 16384)
+    {
+      cout << "  ERROR: arena grows when compiling out of render()"<<endl;
+      ++errors;
+    }
+
+  return (errors)?1:0;
+}
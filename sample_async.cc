@@ -0,0 +1,83 @@
+/**
+*************************************************************
+* @file sample_async.cc
+* @brief Checks that async blocks render like blocks rendered in place
+*
+* The page renders views/sample_async_block.html with async=1 and
+* async=0, the output must be the same: blocks where they were
+* started, stylesheets they include in renderCss after them, blocks
+* in function bodies rendered in place. Keyword values must be left
+* as they are, even if they look like something used internally.
+*
+* Exits with 1 if a check fails.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <algorithm>
+#include <cctype>
+#include "silicon.h"
+#include "siliconweb.h"
+
+using namespace std;
+
+namespace
+{
+  int errors = 0;
+
+  void check(const std::string& name, const std::string& output, const std::string& expected)
+  {
+    if (output == expected)
+      cout << name << ": ok"<<endl;
+    else
+      {
+	cout << name << ": ERROR"<<endl;
+	cout << "  got:      "<<output<<endl;
+	cout << "  expected: "<<expected<<endl;
+	++errors;
+      }
+  }
+
+  std::string upper(Silicon* s, Silicon::StringMap args, std::string body)
+  {
+    std::transform(body.begin(), body.end(), body.begin(), ::toupper);
+    return body;
+  }
+
+  std::string page(const std::string& async)
+  {
+    std::string tpl = "{{data}}\n"
+      "{!block template=sample_async_block.html n=1 async="+async+"/}"
+      "{!upper}}{!block template=sample_async_block.html n=2 async="+async+"/}{/upper}}"
+      "{!renderCss/}"
+      "{!block template=sample_async_block.html n=3 async="+async+"/}";
+    Silicon s = Silicon::createFromStr(tpl);
+    s.setBasePath("views");
+    SiliconWeb::load(&s);
+    s.setFunction("upper", upper);
+    /* Stylesheets go to renderCss */
+    s.setKeyword("_renderResources", "0");
+    s.setKeyword("data", "\x01{async:0}\x01");
+
+    return s.render(false);
+  }
+}
+
+int main()
+{
+  std::string expected = "\x01{async:0}\x01<p>Block 1</p>\n"
+    "<P>BLOCK 2</P>\n"
+    "<link href=\"sample_async.css\" rel=\"stylesheet\" type=\"text/css\" />\n"
+    "<p>Block 3</p>\n";
+  check("Blocks", page("0"), expected);
+  check("Async blocks", page("1"), expected);
+
+  return (errors)?1:0;
+}
@@ -0,0 +1,93 @@
+/**
+*************************************************************
+* @file sample_autoescape.cc
+* @brief Checks the escape context found for keywords with auto
+*        escape enabled.
+*
+* Each template renders a value with every special character, and
+* the output must be the value escaped for the context the keyword
+* is in: '>' inside quoted values, comments, <script> and <style>
+* contents or template tags must not change it.
+* Built with C++17, templates are checked as literals too
+* (SILICON_TEMPLATE()).
+*
+* Exits with 1 if a check fails.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include "silicon.h"
+#if __cplusplus >= 201703L
+  #include "siliconliteral.h"
+#endif
+
+using namespace std;
+
+namespace
+{
+  const char value[] = "a b&\"'<";
+  const std::string html = "a b&amp;&quot;&#39;&lt;";
+  const std::string url = "a%20b%26%22%27%3C";
+  const std::string script = "a b\\x26\\x22\\x27\\x3C";
+  const std::string style = "a\\20 b\\26 \\22 \\27 \\3C ";
+
+  int errors = 0;
+
+  void check(const std::string& name, const std::string& output, const std::string& expected)
+  {
+    if (output == expected)
+      cout << name << ": ok"<<endl;
+    else
+      {
+	cout << name << ": ERROR"<<endl;
+	cout << "  got:      "<<output<<endl;
+	cout << "  expected: "<<expected<<endl;
+	++errors;
+      }
+  }
+}
+
+#if __cplusplus >= 201703L
+  #define CHECK(name, tpl, expected)					\
+  check(name, s.parse(tpl), expected);					\
+  check(name " (literal)", SILICON_TEMPLATE(tpl).render(s), expected)
+#else
+  #define CHECK(name, tpl, expected)					\
+  check(name, s.parse(tpl), expected)
+#endif
+
+int main()
+{
+  Silicon s = Silicon::createFromStr("");
+  s.setAutoEscape(true);
+  s.setKeyword("u", value);
+  s.setKeyword("a", "1");
+
+  CHECK("Text", "<p>{{u}}</p>", "<p>"+html+"</p>");
+  CHECK("Attribute", "<a title='{{u}}'>", "<a title='"+html+"'>");
+  CHECK("URL", "<a href=\"/x?q={{u}}\">", "<a href=\"/x?q="+url+"\">");
+  CHECK("URL after quoted '>'", "<a title=\"a>b\" href=\"/x?q={{u}}\">",
+	"<a title=\"a>b\" href=\"/x?q="+url+"\">");
+  CHECK("Unquoted URL", "<a href=/x?q={{u}}>", "<a href=/x?q="+url+">");
+  CHECK("Text after tag", "<a title=\"a>b\">{{u}}</a>", "<a title=\"a>b\">"+html+"</a>");
+  CHECK("Script", "<script>var v='{{u}}';</script>", "<script>var v='"+script+"';</script>");
+  CHECK("Script with tags", "<script type=\"text/javascript\">if (a<b && c>d) f(\"{{u}}\");</script>",
+	"<script type=\"text/javascript\">if (a<b && c>d) f(\""+script+"\");</script>");
+  CHECK("After script", "<script>x</script ><p>{{u}}</p>", "<script>x</script ><p>"+html+"</p>");
+  CHECK("Event attribute", "<b onclick=\"f('{{u}}')\">", "<b onclick=\"f('"+script+"')\">");
+  CHECK("Style", "<style>p { font-family: \"{{u}}\" }</style>", "<style>p { font-family: \""+style+"\" }</style>");
+  CHECK("Style attribute", "<p style=\"color: {{u}}\">", "<p style=\"color: "+style+"\">");
+  CHECK("Comment", "<!-- <a href=\"/x?q= -->{{u}}", "<!-- <a href=\"/x?q= -->"+html);
+  CHECK("Template tags", "<p>{%if a<2}}<b>{/if}}{{u}}</p>", "<p><b>"+html+"</p>");
+  CHECK("Filter", "<script>var v='{{u|html}}';</script>", "<script>var v='"+html+"';</script>");
+  CHECK("Filters", "{{u|js}} {{u|css}} {{u|raw}}", script+" "+style+" "+value);
+
+  return (errors)?1:0;
+}
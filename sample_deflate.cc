@@ -0,0 +1,155 @@
+/**
+*************************************************************
+* @file sample_deflate.cc
+* @brief Compares render() followed by gzip with rendering into
+*        SiliconDeflate (compressed while it's rendered).
+*
+* operator new is replaced to know the heap in use (glibc's
+* malloc_usable_size()), so we can tell the peak memory each method
+* needs. Compressed output is counted and dropped, as a server
+* writing to a socket would do.
+*
+* Build: g++ -std=c++11 -O2 sample_deflate.cc silicon*.cpp -lpthread -lz
+* Usage: sample_deflate [rows] [layout]
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <malloc.h>
+#include "silicon.h"
+#include "silicondeflate.h"
+
+using namespace std;
+
+namespace
+{
+  std::size_t heapInUse = 0;
+  std::size_t heapPeak = 0;
+}
+
+void* operator new(std::size_t size)
+{
+  void* ptr = malloc((size)?size:1);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+
+  heapInUse+=malloc_usable_size(ptr);
+  if (heapInUse > heapPeak)
+    heapPeak = heapInUse;
+
+  return ptr;
+}
+
+/* Inlined, gcc thinks new/delete and malloc/free are mixed */
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+  if (ptr == NULL)
+    return;
+
+  heapInUse-=malloc_usable_size(ptr);
+  free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+  operator delete(ptr);
+}
+
+const char* pageTemplate = "<h1>{{title}}</h1>\n"
+  "<table>\n"
+  "{%collection var=rows}}"
+  "<tr><td>{{rows._lineNumber}}</td><td>{{rows.name}}</td><td>{{rows.email}}</td></tr>\n"
+  "{/collection}}"
+  "</table>\n";
+
+/* Rows are generated while rendering, so the data doesn't take memory */
+void fillData(Silicon& t, long rows)
+{
+  t.setKeyword("title", "Users");
+  long row = 0;
+  t.setCollectionSource("rows", [=](std::vector<Silicon::StringMap>& batch) mutable
+			{
+			  for (long i=0; (i<1000) && (row<rows); ++i, ++row)
+			    batch.push_back({ { "name", "user"+to_string(row) }, { "email", "user"+to_string(row*7919%100003)+"@example.com" } });
+			}, rows);
+}
+
+/* Everything rendered, then everything compressed */
+std::size_t renderThenCompress(Silicon& t, bool useLayout, std::function<void()> firstByte)
+{
+  std::string output = t.render(useLayout);
+  std::size_t sent = 0;
+  SiliconDeflate gz([&](const char*, std::size_t len)
+		    {
+		      if (sent == 0)
+			firstByte();
+		      sent+=len;
+		    });
+  gz.write(output.data(), output.size());
+  gz.finish();
+
+  return sent;
+}
+
+/* Compressed while it's rendered */
+std::size_t streamCompressed(Silicon& t, bool useLayout, std::function<void()> firstByte)
+{
+  std::size_t sent = 0;
+  SiliconDeflate gz([&](const char*, std::size_t len)
+		    {
+		      if (sent == 0)
+			firstByte();
+		      sent+=len;
+		    });
+  t.renderTo(gz.input(), useLayout);
+  gz.finish();
+
+  return sent;
+}
+
+int main(int argc, char* argv[])
+{
+  long rows = (argc>1)?atol(argv[1]):1000000;
+  bool useLayout = (argc>2) && (atoi(argv[2]));
+
+  Silicon layout = Silicon::createFromStr("");
+  if (useLayout)
+    layout.setLayout(Silicon::DATA, "<html><body>\n{{contents}}<footer>{{title}}</footer>\n</body></html>\n");
+
+  cout << rows<<" rows"<<((useLayout)?", with layout":"")<<endl;
+  for (int method=0; method<2; ++method)
+    {
+      Silicon t = Silicon::createFromStr(pageTemplate);
+      fillData(t, rows);
+      t.getTemplate();
+
+      std::size_t heapBefore = heapInUse;
+      heapPeak = heapInUse;
+      auto start = std::chrono::steady_clock::now();
+      auto first = start;
+      auto firstByte = [&]()
+	{
+	  first = std::chrono::steady_clock::now();
+	};
+      std::size_t sent = (method == 0)?renderThenCompress(t, useLayout, firstByte):streamCompressed(t, useLayout, firstByte);
+      auto end = std::chrono::steady_clock::now();
+
+      cout << ((method == 0)?"render()+gzip: ":"renderTo():    ")
+	   << sent<<" bytes, "
+	   << std::chrono::duration<double, std::milli>(end-start).count()<<"ms, first byte at "
+	   << std::chrono::duration<double, std::milli>(first-start).count()<<"ms, peak heap "
+	   << (heapPeak-heapBefore)/1024<<"KB"<<endl;
+    }
+
+  return 0;
+}
@@ -0,0 +1,71 @@
+/**
+*************************************************************
+* @file sample_escape.cc
+* @brief Compares escaping kernels (SiliconEscape::append()) with
+*        the character by character baseline (appendScalar()).
+*
+* Usage: sample_escape [megabytes]
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "siliconescape.h"
+
+using namespace std;
+
+typedef void (*EscapeFunction)(SiliconEscape::Context, std::string&, const char*, std::size_t);
+
+/* Milliseconds escaping input several times */
+double escapeTime(EscapeFunction f, SiliconEscape::Context ctx, const std::string& input, std::string& output)
+{
+  const int times = 20;
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<times; ++i)
+    {
+      output.clear();
+      f(ctx, output, input.data(), input.size());
+    }
+  auto end = std::chrono::steady_clock::now();
+
+  return std::chrono::duration<double, std::milli>(end-start).count()/times;
+}
+
+int main(int argc, char* argv[])
+{
+  std::size_t size = ((argc>1)?atoi(argv[1]):2) * 1024 * 1024;
+  const char* contextNames[] = { "none", "html", "attribute", "url", "script", "style" };
+
+  /* Text with a few characters to escape, and a dense one */
+  std::string text, dense;
+  while (text.size() < size)
+    text+= (text.size()%37 == 0)?"<&\"'":"abcdefghij klmnop ";
+  while (dense.size() < size)
+    dense+= "a<b&c\"d'e f/g?";
+
+  int errors = 0;
+  for (auto input : { &text, &dense })
+    {
+      cout << ((input == &text)?"Text":"Dense")<<" input, "<<input->size()<<" bytes"<<endl;
+      for (int c=SiliconEscape::HTML; c<=SiliconEscape::STYLE; ++c)
+	{
+	  SiliconEscape::Context ctx = (SiliconEscape::Context) c;
+	  std::string kernel, scalar;
+	  double tk = escapeTime(SiliconEscape::append, ctx, *input, kernel);
+	  double ts = escapeTime(SiliconEscape::appendScalar, ctx, *input, scalar);
+	  cout << "  "<<contextNames[c]<<": append "<<tk<<"ms, appendScalar "<<ts<<"ms ("<<ts/tk<<"x)"<<((kernel==scalar)?"":" DIFFERENT OUTPUT")<<endl;
+	  if (kernel != scalar)
+	    ++errors;
+	}
+    }
+
+  return (errors)?1:0;
+}
@@ -0,0 +1,97 @@
+/**
+*************************************************************
+* @file sample_generated.cc
+* @brief Renders a template with siliconc generated code and with
+*        the interpreter, and compares times.
+*
+* Build:
+*   siliconc -b views -o sample_bench.cpp sample_bench.html
+*   g++ -std=c++11 -O2 sample_generated.cc sample_bench.cpp silicon*.cpp -lpthread -lz
+*
+* Without sample_bench.cpp both instances are interpreted.
+*
+* Usage: sample_generated [renders]
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "silicon.h"
+
+using namespace std;
+
+void fillData(Silicon& t)
+{
+  for (int i=0; i<10; ++i)
+    {
+      t.setKeyword("title"+to_string(i), "Title <"+to_string(i)+">");
+      t.setKeyword("show"+to_string(i), to_string(i%2));
+      t.setKeyword("text"+to_string(i), "text & more");
+    }
+  t.setKeyword("footer", "(c) Silicon");
+  for (int i=0; i<30; ++i)
+    t.addToCollection("items", { { "name", "Item "+to_string(i) }, { "price", to_string(i*3) } });
+}
+
+/* Microseconds per render */
+double renderTime(Silicon& t, int renders)
+{
+  std::size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<renders; ++i)
+    total+=t.render().size();
+  auto end = std::chrono::steady_clock::now();
+  if (total == 0)
+    cout << "Nothing rendered"<<endl;
+
+  return std::chrono::duration<double, std::micro>(end-start).count()/renders;
+}
+
+int main(int argc, char* argv[])
+{
+  int renders = (argc>1)?atoi(argv[1]):40000;
+
+  std::ifstream fd("views/sample_bench.html");
+  std::stringstream buffer;
+  buffer << fd.rdbuf();
+  std::string source = buffer.str();
+
+  Silicon generated = Silicon::createFromFile("sample_bench.html", "views/");
+  Silicon interpreted = Silicon::createFromStr(source);
+  fillData(generated);
+  fillData(interpreted);
+
+  if (!generated.isGenerated())
+    cout << "sample_bench.html is not generated, link sample_bench.cpp made by siliconc"<<endl;
+
+  try
+    {
+      std::string a = generated.render();
+      std::string b = interpreted.render();
+      cout << "Output: "<<a.size()<<" bytes, "<<((a==b)?"same":"DIFFERENT")<<endl;
+
+      /* Both compiled and with a buffer estimate */
+      double tg = renderTime(generated, renders);
+      double ti = renderTime(interpreted, renders);
+      cout << "Interpreted: "<<ti<<"us per render"<<endl;
+      cout << "Generated:   "<<tg<<"us per render"<<endl;
+
+      return (a==b)?0:1;
+    }
+  catch (SiliconException &e)
+    {
+      cout << "Exception!!! "<<e.what() << std::endl;
+    }
+
+  return 1;
+}
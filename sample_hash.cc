@@ -0,0 +1,118 @@
+/**
+*************************************************************
+* @file sample_hash.cc
+* @brief Times keyword and function lookups with 10, 1000 and
+*        100000 entries.
+*
+* getKeyword() and getFunction() are timed on a Silicon instance,
+* and find() on SiliconHashMap and on std::map (what keywords and
+* functions were kept in before) with the same names. Names are like
+* the ones in templates: "section.item42.title".
+*
+* Usage: sample_hash [lookups]
+*
+* Exits with 1 if a name is not found.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdlib>
+#include "silicon.h"
+#include "siliconhash.h"
+
+using namespace std;
+
+/* getFunction() is protected */
+class FunctionLookup : public Silicon
+{
+public:
+  FunctionLookup(): Silicon("", 0)
+  {
+  }
+
+  using Silicon::getFunction;
+};
+
+int errors = 0;
+
+std::string echo(Silicon* s, Silicon::StringMap args, std::string input)
+{
+  return input;
+}
+
+/* Nanoseconds per lookup, names taken in turn */
+template <typename F>
+double lookupTime(const std::vector<std::string>& names, int lookups, F lookup)
+{
+  std::size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i=0; i<lookups; ++i)
+    found+=lookup(names[i%names.size()]);
+  auto end = std::chrono::steady_clock::now();
+  if (found != (std::size_t) lookups)
+    {
+      cout << "  ERROR: "<<lookups-found<<" names not found"<<endl;
+      ++errors;
+    }
+
+  return std::chrono::duration<double, std::nano>(end-start).count()/lookups;
+}
+
+int main(int argc, char* argv[])
+{
+  int lookups = (argc>1)?atoi(argv[1]):2000000;
+
+  for (std::size_t entries : { 10, 1000, 100000 })
+    {
+      std::vector<std::string> names;
+      for (std::size_t i=0; i<entries; ++i)
+	names.push_back("section.item"+to_string(i)+".title");
+
+      Silicon keywords = Silicon::createFromStr("");
+      FunctionLookup functions;
+      SiliconHashMap<std::string> hashMap;
+      std::map<std::string, std::string> treeMap;
+      for (auto& n : names)
+	{
+	  keywords.setKeyword(n, "value");
+	  functions.setFunction(n, echo);
+	  hashMap[n] = "value";
+	  treeMap[n] = "value";
+	}
+
+      std::string text;
+      double tk = lookupTime(names, lookups, [&](const std::string& n)
+			     {
+			       return keywords.getKeyword(n, text);
+			     });
+      double tf = lookupTime(names, lookups, [&](const std::string& n)
+			     {
+			       return (bool) functions.getFunction(n);
+			     });
+      double th = lookupTime(names, lookups, [&](const std::string& n)
+			     {
+			       return hashMap.find(n) != hashMap.end();
+			     });
+      double tt = lookupTime(names, lookups, [&](const std::string& n)
+			     {
+			       return treeMap.find(n) != treeMap.end();
+			     });
+
+      cout << entries<<" entries"<<endl;
+      cout << "  getKeyword():  "<<tk<<"ns"<<endl;
+      cout << "  getFunction(): "<<tf<<"ns"<<endl;
+      cout << "  SiliconHashMap::find(): "<<th<<"ns, std::map::find(): "<<tt<<"ns ("<<tt/th<<"x)"<<endl;
+    }
+
+  return (errors)?1:0;
+}
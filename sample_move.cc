@@ -0,0 +1,170 @@
+/**
+*************************************************************
+* @file sample_move.cc
+* @brief Checks that data moved into an instance is not copied
+*
+* operator new is replaced to count allocations and bytes. Big
+* keywords and collections are moved in with the rvalue setters,
+* setKeywords(), emplaceRow(), and the instance is moved with the
+* move constructor and assignment. Each step may allocate map nodes,
+* but a few hundred bytes for each item, never its data: that would
+* be a copy.
+*
+* Exits with 1 if a check fails.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include "silicon.h"
+
+using namespace std;
+
+namespace
+{
+  unsigned long allocations = 0;
+  unsigned long long allocated = 0;
+
+  /* Data moved in: 1MB keyword, 1000 rows, 100 keywords of 10KB */
+  const std::size_t bigSize = 1<<20;
+  const int rows = 1000;
+  const int keywords = 100;
+  const std::size_t keywordSize = 10240;
+  /* Bytes allowed for each item moved: map nodes and vector growth, not data */
+  const unsigned long long allowed = 512;
+
+  int errors = 0;
+
+  struct Counter
+  {
+    unsigned long allocations;
+    unsigned long long allocated;
+
+    Counter(): allocations(::allocations), allocated(::allocated)
+    {
+    }
+
+    void check(const std::string& step, std::size_t moved, std::size_t items=1)
+    {
+      unsigned long long bytes = ::allocated-allocated;
+      cout << step << ": "<<moved<<" bytes moved, "<<::allocations-allocations<<" allocations, "<<bytes<<" bytes"<<endl;
+      if (bytes > allowed*items)
+	{
+	  cout << "  ERROR: data was copied"<<endl;
+	  ++errors;
+	}
+    }
+  };
+}
+
+void* operator new(std::size_t size)
+{
+  ++allocations;
+  allocated+=size;
+  void* ptr = malloc((size)?size:1);
+  if (ptr == NULL)
+    throw std::bad_alloc();
+
+  return ptr;
+}
+
+/* Inlined, gcc thinks new/delete and malloc/free are mixed */
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+  free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, std::size_t) noexcept
+{
+  free(ptr);
+}
+
+int main()
+{
+  Silicon t = Silicon::createFromStr("{{big|raw}}{{k7|raw}}\n"
+				     "{%collection var=rows}}{{rows.name}}\n{/collection}}"
+				     "{%collection var=built}}{{built.name}}\n{/collection}}");
+  /* Compile now, don't count it */
+  t.getTemplate();
+
+  {
+    std::string big(bigSize, 'b');
+    Counter c;
+    t.setKeyword("big", std::move(big));
+    c.check("setKeyword()", bigSize);
+  }
+
+  {
+    std::vector<Silicon::StringMap> coll(rows);
+    for (auto& r : coll)
+      r["name"] = std::string(1000, 'r');
+    Counter c;
+    t.addCollection("rows", std::move(coll));
+    c.check("addCollection()", rows*1000);
+  }
+
+  {
+    Silicon::StringMap row;
+    row["name"] = std::string(bigSize, 'a');
+    Counter c;
+    t.addToCollection("added", std::move(row));
+    c.check("addToCollection()", bigSize);
+  }
+
+  {
+    Silicon::StringMap kws;
+    for (int i=0; i<keywords; ++i)
+      kws["k"+to_string(i)] = std::string(keywordSize, 'k');
+    Counter c;
+    t.setKeywords(std::move(kws));
+    c.check("setKeywords(map)", keywords*keywordSize, keywords);
+  }
+
+  {
+    std::vector<std::pair<std::string, std::string> > kws;
+    for (int i=0; i<keywords; ++i)
+      kws.push_back({ "r"+to_string(i), std::string(keywordSize, 'r') });
+    Counter c;
+    t.setKeywords(std::make_move_iterator(kws.begin()), std::make_move_iterator(kws.end()));
+    c.check("setKeywords(range)", keywords*keywordSize, keywords);
+  }
+
+  {
+    std::vector<std::string> names(rows, std::string(1000, 'e'));
+    Counter c;
+    for (auto& n : names)
+      t.emplaceRow("built")["name"] = std::move(n);
+    c.check("emplaceRow()", rows*1000, rows);
+  }
+
+  std::string output = t.render(false);
+  std::size_t total = bigSize+rows*1000*2+keywords*keywordSize*2+bigSize;
+
+  {
+    Counter c;
+    Silicon moved(std::move(t));
+    c.check("Move constructor", total);
+
+    Counter a;
+    t = std::move(moved);
+    a.check("Move assignment", total);
+  }
+
+  if (t.render(false) != output)
+    {
+      cout << "ERROR: moved instance renders something else"<<endl;
+      ++errors;
+    }
+
+  return (errors)?1:0;
+}
@@ -12,6 +12,42 @@
 * @date 30 aug 2015
 *
 * Changelog:
+*   20261018 : Conditions split by siliconc are tested without parsing them. <= was <
+*   20261018 : Async blocks spliced at the positions they were started, not found
+*              in the output. joinAsync()
+*   20261018 : Minify: literal HTML text minified when templates are compiled
+*   20261018 : renderTo(): output given to a sink in pieces while rendering
+*   20261018 : Values (SiliconValue): objects and arrays reached with paths,
+*              collections loop over their arrays
+*   20261018 : setCollectionSource(): collection rows generated while rendering
+*   20261018 : Keywords, functions, collections and operators in hash tables
+*              (SiliconHashMap). Compiled names keep their hash
+*   20261018 : fork(): instances sharing a prototype's keywords, functions,
+*              operators, collections and values, frozen in stacked layers
+*              (freeze())
+*   20261018 : Move constructor and assignment take keywords, collections, functions
+*              and settings. Data setters move their arguments. setKeywords(), emplaceRow()
+*   20261018 : Async blocks ({!block async=1}}), rendered by a thread pool and
+*              spliced in order when render() finishes
+*   20261018 : CollectionLoop, collection rows one at a time, for async rendering
+*   20261018 : renderBatch(): one template, many contexts, several threads
+*   20261018 : Templates, layouts and blocks are taken from a SiliconBundle when loaded
+*   20261018 : generatedRender() and keywords without slot, for templates compiled from literals
+*   20261018 : Templates generated by siliconc (addGenerated())
+*   20261018 : Templates, layouts and blocks are taken from SiliconReload when running
+*   20261018 : getReferences(): keywords, collections, functions and blocks used
+*   20261018 : Incremental rendering: unchanged regions reuse their last output
+*   20261018 : renderSpans(): output as a list of pieces for writev()
+*   20261018 : Templates compiled once into a list of nodes, renders just walk
+*              them. parse() and blocks keep compiled snippets in a cache.
+*              User functions don't eat the character after their closing tag.
+*   20261018 : Settings version (changes of _keywords), getCollection() by reference,
+*              render number and extension data for helpers
+*   20261018 : Auto escape for keywords. {{keyword|raw}}, |html, |attr, |url filters, |js, |css
+*   20261018 : Error line/position calculated when throwing, for template,
+*              layout and blocks, also in release builds
+*   20261018 : Output buffers reserved with a running size estimation
+*   20261018 : Parser temporaries come from a per-thread render arena
 *   20160918 : Fixes for GCC >= 5.2
 *   20160607 : Fixed > operator
 *              Second condition values can be variables
@@ -39,10 +75,8 @@
 *        + function count
 *        + conditions count
 *   - Limit nesting levels
-*   - Template caching
 *   - complete if function. Logic operations with conditions
 *   - builtins: for, while
-*   - line/position isn't correct when using template/layout/blocks
 *   - getKeyword could look inside collections too using {{collection[X].element}}
 *   - getArgValue should parse easy expressions, and should know when to replace
 *     the value with a variable.
@@ -51,6 +85,8 @@
 *************************************************************/
 
 #include "silicon.h"
+#include "siliconreload.h"
+#include "siliconbundle.h"
 #include <cstring>
 #include <iostream>
 #include <string>
@@ -62,6 +98,10 @@
 #include <unistd.h>
 #include <iomanip>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 
 #define SILICONVERSION "0.2"
 #define DIRECTORY_SEPARATOR '/'
@@ -80,33 +120,86 @@ namespace
     /* If keyword didn't match, just write it */
     bool leaveUnmatchedKwds=true;
 
+    /* Escape keyword values */
+    bool autoEscape=false;
+
+    /* Minify literal text when compiling */
+    bool minify=false;
+
     /* Base view path */
     std::string basePath="./";
   } globalConfig;
 
   /**
-   * Operate abstract class.
-   * What Operate must have. Used to group operations with 
-   * strings/longs/doubles and so.
+   * Temporary strings to std::string, for error messages and
+   * user callbacks.
    */
-  struct AbsOperate
+  inline std::string toString(const Silicon::TempString& str)
   {
-    /**
-     * Apply operation. Once we have a and b terms, apply operation op
-     *
-     * @param op Operation to perform (==, !=, >=, <=...)
-     *
-     * @return logic operation applied
-     */
-    virtual bool apply(std::string op) =0;
-  };
+    return std::string(str.data(), str.size());
+  }
+
+  /**
+   * Builds user function arguments from parser arguments
+   *
+   * @param args Arguments as parsed
+   *
+   * @return Arguments as StringMap
+   */
+  Silicon::StringMap toStringMap(const Silicon::TempStringMap& args)
+  {
+    Silicon::StringMap res;
+    for (auto& a : args)
+      res.insert(res.end(), { toString(a.first), toString(a.second) });
+
+    return res;
+  }
+
+  /**
+   * Is the whole string a long long number?
+   *
+   * @param str String (must be NULL terminated)
+   * @param len String length
+   * @param val Returns the value
+   *
+   * @return -1 if nothing could be read, 0 if only part of the
+   *         string is a number, 1 if everything is a number
+   */
+  short toLongLong(const char* str, std::size_t len, long long &val)
+  {
+    char* end;
+    val = strtoll(str, &end, 10);
+    if (end == str)
+      return -1;
+
+    return (end == str+len)?1:0;
+  }
+
+  /**
+   * Is the whole string a long double number?
+   * (@see toLongLong)
+   */
+  short toLongDouble(const char* str, std::size_t len, long double &val)
+  {
+    char* end;
+    val = strtold(str, &end);
+    if (end == str)
+      return -1;
+
+    return (end == str+len)?1:0;
+  }
 
   /**
    * Operates with type T, whatever it is
    */
   template <typename T>
-  struct Operate : AbsOperate
+  struct Operate
   {
+    /**
+     * Operation callback. Non-standard operations will ask this function
+     */
+    using Callback = std::function<bool(const Silicon::TempString&, const T&, const T&)>;
+
     /**
      * Constructor with operads and function
      *
@@ -114,14 +207,18 @@ namespace
      * @param b Operand b
      * @param opcb Non-standard operations will ask this function
      */
-    Operate(T a, T b, std::function<bool(std::string, T, T)>opcb): a(a), b(b), opcallback(opcb)
+    Operate(const T& a, const T& b, Callback opcb): a(a), b(b), opcallback(opcb)
     {
     }
 
     /**
-     * Apply operation
+     * Apply operation. Once we have a and b terms, apply operation op
+     *
+     * @param op Operation to perform (==, !=, >=, <=...)
+     *
+     * @return logic operation applied
      */
-    bool apply(std::string op)
+    bool apply(const Silicon::TempString& op)
     {
       if (op == "==")
 	return (a == b);
@@ -134,65 +231,17 @@ namespace
       else if (op == "<")
 	return (a<b);
       else if (op == "<=")
-	return (a<b);
+	return (a<=b);
       else if (op[0]=='!')
 	return this->opcallback(op.substr(1,op.length()-2), a, b);
       else
-	throw SiliconException(18, "Unknown operator "+op, 0, 0);
-    }
-
-  private:
-    T a;
-    T b;
-    std::function<bool(std::string, T, T)> opcallback;
-  };
-
-  /**
-   * Makes use of Operate transparent
-   */
-  struct OpController
-  {
-    /**
-     * @param a Operand a
-     * @param b Operand b
-     * @param opcb More operations callback
-    */
-    OpController(std::string a, std::string b, std::function<bool(std::string, std::string, std::string)> opcb)
-    {
-      operate = new Operate<std::string>(a, b, opcb);
-    }
-
-    /**
-     * @param a Operand a
-     * @param b Operand b
-     * @param opcb More operations callback
-    */
-    OpController(long double a, long double b, std::function<bool(std::string, long double, long double)> opcb)
-    {
-      operate = new Operate<long double>(a, b, opcb);
-    }
-
-    /**
-     * @param a Operand a
-     * @param b Operand b
-     * @param opcb More operations callback
-    */
-    OpController(long long a, long long b, std::function<bool(std::string, long long, long long)> opcb)
-    {
-      operate = new Operate<long long>(a, b, opcb);
+	throw SiliconException(18, "Unknown operator "+toString(op), 0, 0);
     }
 
-    virtual ~OpController() { }
-
-    /**
-     * Apply operation
-     */
-    bool apply(std::string op)
-    {
-      return operate->apply(op);
-    }
   private:
-    AbsOperate* operate;
+    const T& a;
+    const T& b;
+    Callback opcallback;
   };
 
   /**
@@ -274,13 +323,27 @@ namespace
   }
 #endif
 
-Silicon::StringMap Silicon::globalKeywords;
+Silicon::KeywordMap Silicon::globalKeywords;
+std::atomic<unsigned long> Silicon::globalSettingsVersion(0);
+std::map<std::string, unsigned long> Silicon::globalKeywordVersions;
 Silicon::FunctionMap Silicon::globalFunctions;
-std::map<std::string, Silicon::StringOperator> Silicon::globalConditionStringOperators;
-std::map<std::string, Silicon::LongOperator> Silicon::globalConditionLongOperators;
-std::map<std::string, Silicon::DoubleOperator> Silicon::globalConditionDoubleOperators;
+SiliconHashMap<Silicon::StringOperator> Silicon::globalConditionStringOperators;
+SiliconHashMap<Silicon::LongOperator> Silicon::globalConditionLongOperators;
+SiliconHashMap<Silicon::DoubleOperator> Silicon::globalConditionDoubleOperators;
 std::string Silicon::contentsKeyword="contents";
 char* Silicon::layoutData=NULL;
+std::string Silicon::layoutName;
+std::shared_ptr<Silicon::OutputEstimate> Silicon::layoutEstimate = std::make_shared<Silicon::OutputEstimate>();
+std::shared_ptr<const SiliconTemplate> Silicon::layoutCompiled[2];
+bool Silicon::layoutBundled = false;
+std::string Silicon::layoutPath;
+std::string Silicon::layoutBasePath;
+unsigned long Silicon::layoutGeneration[2] = { 0, 0 };
+bool Silicon::layoutReloaded = false;
+const Silicon::Generated* Silicon::layoutGenerated = NULL;
+std::atomic<unsigned long> Silicon::globalKeywordsLayout(0);
+std::size_t Silicon::generatedSlots = 0;
+SiliconTemplateCache Silicon::parseCache(256);
 #if USEMUTEX
 std::mutex Silicon::layoutMutex;
 #endif
@@ -300,11 +363,39 @@ void Silicon::setLeaveUnmatchedKwdsGlobal(bool newval)
   globalConfig.leaveUnmatchedKwds = newval;
 }
 
+void Silicon::setAutoEscapeGlobal(bool newval)
+{
+  globalConfig.autoEscape = newval;
+}
+
+void Silicon::setMinifyGlobal(bool newval)
+{
+  globalConfig.minify = newval;
+}
+
+void Silicon::setMinify(bool newval)
+{
+  if (this->localConfig.minify == newval)
+    return;
+
+  this->localConfig.minify = newval;
+  /* Compiled again, from the source. Copies and forks only have it in the compiled template */
+  if ( (!this->_data) && (this->compiledData) )
+    this->copyBuffer(&this->_data, this->compiledData->source().c_str());
+  if (this->_data)
+    this->compiledData.reset();
+}
+
 void Silicon::setMaxBufferLenGlobal(long newval)
 {
   globalConfig.maxBufferLen = newval;
 }
 
+const SiliconArena::Stats& Silicon::getArenaStats()
+{
+  return SiliconArena::local().stats();
+}
+
 Silicon::Silicon(const char * data, long maxBufferLen)
 {
   this->localConfig.maxBufferLen = maxBufferLen;
@@ -319,19 +410,273 @@ Silicon::Silicon(const char* file, const char* defaultPath, long maxBufferLen)
   this->localConfig.basePath = (defaultPath)?defaultPath:"";
   this->configure();
 
-  this->extractFile(&this->_data, file);
+  this->_dataName = file;
+  this->_dataPath = filePath(file, this->localConfig.basePath);
+  /* Precompiled in a bundle: don't read nor compile it */
+  this->compiledData = bundled(this->_dataPath);
+  if (this->compiledData)
+    this->copyBuffer(&this->_data, this->compiledData->source().c_str());
+  else
+    this->extractFile(&this->_data, file);
+  this->outputEstimate = fileOutputEstimate(this->_dataPath);
+  this->generated = findGenerated(file, this->_data);
+}
+
+namespace
+{
+  /* Templates generated by siliconc, by name. They are added before main() */
+  std::map<std::string, Silicon::Generated>& generatedTemplates()
+  {
+    static std::map<std::string, Silicon::Generated> generated;
+    return generated;
+  }
+}
+
+bool Silicon::addGenerated(const Silicon::Generated& generated)
+{
+  Generated& g = generatedTemplates()[generated.name];
+  g = generated;
+  g.slotBase = generatedSlots;
+  generatedSlots+=g.slots;
+
+  return true;
+}
+
+const Silicon::Generated* Silicon::findGenerated(const std::string& name, const char* data)
+{
+  auto g = generatedTemplates().find(name);
+  if (g == generatedTemplates().end())
+    return NULL;
+
+  /* Template changed after generating code */
+  if ( (strlen(data) != g->second.len) || (memcmp(data, g->second.source, g->second.len) != 0) )
+    return NULL;
+
+  return &g->second;
+}
+
+void Silicon::renderGenerated(std::string& destination, const Silicon::Generated& gen)
+{
+  if (slots.size() < generatedSlots)
+    slots.resize(generatedSlots, { false, NULL });
+
+  std::size_t previousBase = slotBase;
+  slotBase = gen.slotBase;
+  inSource(gen.name, gen.source, [&]()
+	   {
+	     gen.render(*this, destination);
+	   });
+  slotBase = previousBase;
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getTemplate()
+{
+  return getCompiled();
+}
+
+void Silicon::generatedKeyword(std::string& destination, std::size_t slot, const std::string& name, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen)
+{
+  addKeywordToStats();		/* Stats*/
+  putKeyword(destination, name, slotKeyword(slot, name), escape, filtered, tag, tagLen);
+}
+
+const std::string* Silicon::slotKeyword(std::size_t slot, const std::string& name)
+{
+  unsigned long layout = keywordsLayout + globalKeywordsLayout.load(std::memory_order_relaxed);
+  if (layout != slotsLayout)
+    {
+      for (auto& s : slots)
+	s.resolved = false;
+      slotsLayout = layout;
+    }
+
+  KeywordSlot& s = slots[slotBase+slot];
+  if (!s.resolved)
+    {
+      s.value = findKeyword(name);
+      /* Inside loops over values, they change with the element */
+      s.resolved = valueScopes.empty();
+    }
+
+  return s.value;
+}
+
+bool Silicon::generatedCondition(const std::string& condition)
+{
+  return evaluateCondition(TempString(condition.data(), condition.size()));
+}
+
+const std::string& Silicon::generatedOperand(std::size_t slot, const std::string& name)
+{
+  static const std::string emptyString;
+  const std::string* value = slotKeyword(slot, name);
+
+  return (value)?*value:emptyString;
+}
+
+const std::string& Silicon::generatedOperand(std::size_t slot, const std::string& name, const std::string& otherwise)
+{
+  const std::string* value = slotKeyword(slot, name);
+
+  return (value)?*value:otherwise;
+}
+
+bool Silicon::generatedTrue(const std::string& value)
+{
+  if (value.empty())
+    return false;
+  else if (std::all_of(value.begin(), value.end(), ::isdigit))
+    return (strtol(value.c_str(), NULL, 10) != 0);
+
+  return true;
+}
+
+int Silicon::generatedCompare(const std::string& a, const std::string& b, bool numeric)
+{
+  /* As evaluateCondition(): long long, long double, or string */
+  long long lla, llb;
+  long double lda, ldb;
+  if ( (numeric) && (toLongLong(a.c_str(), a.length(), lla) == 1) && (toLongLong(b.c_str(), b.length(), llb) == 1) )
+    return (lla < llb)?-1:(llb < lla)?1:0;
+  else if ( (numeric) && (toLongDouble(a.c_str(), a.length(), lda) == 1) && (toLongDouble(b.c_str(), b.length(), ldb) == 1) )
+    return (lda < ldb)?-1:(ldb < lda)?1:0;
+
+  return a.compare(b);
+}
+
+bool Silicon::generatedIffun(const std::vector<std::string>& functions)
+{
+  return evaluateIffun(functions);
+}
+
+void Silicon::generatedFunction(std::string& destination, const std::string& name, const Silicon::StringMap& arguments, std::string&& body)
+{
+  callFunction(destination, getFunction(name), arguments, std::move(body));
+}
+
+void Silicon::generatedCollection(const std::string& name, const Silicon::StringMap& arguments, const std::function<void()>& body)
+{
+  loopCollection(name, arguments, body);
+}
+
+void Silicon::generatedKeyword(std::string& destination, const std::string& name, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen)
+{
+  addKeywordToStats();		/* Stats*/
+  putKeyword(destination, name, findKeyword(name), escape, filtered, tag, tagLen);
+}
+
+void Silicon::generatedRender(const char* source, const std::function<void()>& render)
+{
+  static const std::string noName;
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  inSource(noName, source, render);
+}
+
+void Silicon::generatedLocate(SiliconException& e, const std::string& name, const char* source)
+{
+  long line, pos;
+  locate(source, tagPosition, line, pos);
+  e.setLocation(name, line, pos);
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getLayoutTemplate()
+{
+  if (Silicon::layoutData==NULL)
+    return std::shared_ptr<const SiliconTemplate>();
+
+  return getCompiledLayout();
+}
+
+std::string Silicon::getLayoutName()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(layoutMutex);
+#endif
+  return Silicon::layoutName;
+}
+
+std::string Silicon::filePath(const std::string& file, const std::string& basePath)
+{
+  return fixPath(file, basePath, true);
 }
 
 void Silicon::setData(const char* data)
 {
   free(this->_data);
+  this->compiledData.reset();
   this->copyBuffer(&this->_data, data);
+  this->_dataName.clear();
+  this->_dataPath.clear();
+  this->generated = NULL;
+  this->outputEstimate = std::make_shared<OutputEstimate>();
 }
 
 void Silicon::setData(const std::string& data)
 {
   free(this->_data);
+  this->compiledData.reset();
   this->copyBuffer(&this->_data, data.c_str());
+  this->_dataName.clear();
+  this->_dataPath.clear();
+  this->generated = NULL;
+  this->outputEstimate = std::make_shared<OutputEstimate>();
+}
+
+std::shared_ptr<Silicon::OutputEstimate> Silicon::fileOutputEstimate(const std::string& file)
+{
+  static std::map<std::string, std::shared_ptr<OutputEstimate> > estimates;
+#if USEMUTEX
+  static std::mutex estimatesMutex;
+
+  std::lock_guard<std::mutex> lock(estimatesMutex);
+#endif
+  auto& estimate = estimates[file];
+  if (!estimate)
+    estimate = std::make_shared<OutputEstimate>();
+
+  return estimate;
+}
+
+std::size_t Silicon::OutputEstimate::reserve() const
+{
+  std::size_t est = estimate.load(std::memory_order_relaxed);
+  /* A little more, so outputs close to the estimation fit */
+  return est + est/16;
+}
+
+void Silicon::OutputEstimate::update(std::size_t size)
+{
+  std::size_t est = estimate.load(std::memory_order_relaxed);
+
+  last.store(size, std::memory_order_relaxed);
+  renders.fetch_add(1, std::memory_order_relaxed);
+  if (size > reserve())
+    misses.fetch_add(1, std::memory_order_relaxed);
+
+  /* Fast up: half the distance. Slow down: 1/32 of the distance */
+  if (size > est)
+    est = (est == 0)?size:est + (size-est+1)/2;
+  else
+    est-= (est-size)/32;
+
+  estimate.store(est, std::memory_order_relaxed);
+}
+
+Silicon::RenderStats Silicon::getRenderStats()
+{
+  RenderStats stats;
+  std::shared_ptr<OutputEstimate> layout = std::atomic_load(&Silicon::layoutEstimate);
+
+  stats.templateEstimate = outputEstimate->reserve();
+  stats.templateSize = outputEstimate->last;
+  stats.templateRenders = outputEstimate->renders;
+  stats.templateMisses = outputEstimate->misses;
+  stats.layoutEstimate = layout->reserve();
+  stats.layoutSize = layout->last;
+  stats.layoutRenders = layout->renders;
+  stats.layoutMisses = layout->misses;
+
+  return stats;
 }
 
 void Silicon::extractFile(char **ptr, std::string filename, bool usePath)
@@ -372,6 +717,8 @@ void Silicon::configure()
     this->localConfig.maxBufferLen = globalConfig.maxBufferLen;
 
   this->localConfig.leaveUnmatchedKwds = globalConfig.leaveUnmatchedKwds;
+  this->localConfig.autoEscape = globalConfig.autoEscape;
+  this->localConfig.minify = globalConfig.minify;
 
   /* Fill global keywords, functions and conditions */
   if (!configuredGlobals.keywords)
@@ -450,9 +797,32 @@ std::string Silicon::globalFuncBlock(Silicon* s, Silicon::StringMap options, std
   if (tplt == options.end())
     throw SiliconException(20, "Block template not found.", s->getCurrentLine(), s->getCurrentPos());
 
+  auto async = options.find("async");
+  if (async != options.end())
+    {
+      /* Blocks only wait in the render output. In a function body they
+	 would be text given to the function */
+      bool useAsync = ( (s->asyncBlocks) && (!s->incremental) && (async->second != "0") &&
+			(s->asyncDestination) && (s->functionDestination == s->asyncDestination) );
+      options.erase(async);
+      if (useAsync)
+	{
+	  StringMap keywords;
+	  for (auto& op : options)
+	    {
+	      if (op.first != "template")
+		keywords["block."+op.first] = op.second;
+	    }
+	  if (!additionalData.empty())
+	    keywords["block._contents"] = additionalData;
+
+	  s->asyncBlock(tplt->second, keywords);
+	  return std::string();
+	}
+    }
+
   std::vector<std::string> kwds;
 
-  char *blockData=NULL;
   std::string res;
   for (auto op : options)
     {
@@ -470,9 +840,8 @@ std::string Silicon::globalFuncBlock(Silicon* s, Silicon::StringMap options, std
       kwds.push_back("block._contents");
     }
 
-  s->extractFile(&blockData, tplt->second);
-  s->_parse(res, blockData);
-  free(blockData);
+  std::shared_ptr<const SiliconTemplate> block = s->getBlock(tplt->second);
+  s->renderSource(res, tplt->second, *block);
 
   for (auto k : kwds)
     s->delKeyword(k);
@@ -485,7 +854,7 @@ std::string Silicon::globalFuncSet(Silicon* s, Silicon::StringMap options)
   for (auto o : options)
     {
       bool exists = false;
-      auto index = s->localKeywords.find(o.second);
+      auto index = s->localKeyword(o.second);
 
       if (index == s->localKeywords.end())
 	{
@@ -497,7 +866,12 @@ std::string Silicon::globalFuncSet(Silicon* s, Silicon::StringMap options)
 	exists = true;
 
       if (exists)
-	index->second = o.second;
+	{
+	  if (index->first[0] == '_')
+	    ++s->settingsVersion;
+	  s->keywordChanged(index->first);
+	  index->second = o.second;
+	}
       else
 	s->setKeyword(o.first, o.second);
     }
@@ -511,7 +885,7 @@ std::string Silicon::globalFuncInc(Silicon* s, Silicon::StringMap options)
     {
       std::string content;
       bool exists = false;
-      auto index = s->localKeywords.find(o.second);
+      auto index = s->localKeyword(o.second);
       /* Search keyword in local, then global */
       if (index == s->localKeywords.end())
 	{
@@ -538,40 +912,68 @@ std::string Silicon::globalFuncInc(Silicon* s, Silicon::StringMap options)
 
 void Silicon::addCollection(std::string kw, std::vector<Silicon::StringMap> coll)
 {
-  localCollections[kw] = coll;
+  collectionChanged(kw);
+  collectionSources.erase(kw);
+  localCollections[std::move(kw)] = std::move(coll);
+}
+
+void Silicon::setCollectionSource(std::string kw, Silicon::CollectionSource source, long totalLines)
+{
+  collectionChanged(kw);
+  if (!source)
+    collectionSources.erase(kw);
+  else
+    collectionSources[std::move(kw)] = { std::move(source), totalLines };
+}
+
+void Silicon::setValue(std::string name, SiliconValue value)
+{
+  /* Pointers to the old value are gone */
+  collectionChanged(name);
+  ++keywordsLayout;
+  localValues[std::move(name)] = std::move(value);
+}
+
+const SiliconValue* Silicon::getValue(const std::string& name)
+{
+  auto v = localValues.find(name);
+  return (v == localValues.end())?layerFind(&Layer::values, name):&v->second;
 }
 
-std::vector<Silicon::StringMap> Silicon::getCollection(std::string kw)
+const std::vector<Silicon::StringMap>& Silicon::getCollection(const std::string& kw)
 {
-  auto res = localCollections.find(kw);
-  return (res==localCollections.end())?std::vector<StringMap>():res->second;
+  static const std::vector<StringMap> emptyCollection;
+  const std::vector<StringMap>* res = findCollection(kw);
+  return (res)?*res:emptyCollection;
 }
 
 void Silicon::addToCollection(std::string kw, StringMap content)
 {
-  auto el = localCollections.find(kw);
-  if (el == localCollections.end())
-    localCollections[kw] = std::vector<StringMap>({content});
-  else
-    localCollections[kw].push_back(content);
+  collectionChanged(kw);
+  localCollection(kw).push_back(std::move(content));
+}
+
+Silicon::StringMap& Silicon::emplaceRow(const std::string& kw)
+{
+  collectionChanged(kw);
+  std::vector<StringMap>& coll = localCollection(kw);
+  coll.emplace_back();
+  return coll.back();
 }
 
 long Silicon::addToCollection(std::string kw, long pos, std::string key, std::string val)
 {
-  auto el = localCollections.find(kw);
-  if (el == localCollections.end())
-    {
-      localCollections[kw] = std::vector<StringMap>({ { {key, val} } });
-      return 0;			/* position 0*/
-    }
-  else if ( (pos == -1) || (pos>=(long)el->second.size()) )
+  collectionChanged(kw);
+  std::vector<StringMap>& coll = localCollection(kw);
+  if ( (pos < 0) || (pos>=(long)coll.size()) )
     {
-      localCollections[kw].push_back( { {key, val} });
-      return localCollections[kw].size()-1;
+      coll.emplace_back();
+      coll.back().emplace(std::move(key), std::move(val));
+      return coll.size()-1;
     }
   else
     {
-      localCollections[kw][(size_t)pos].insert({key, val});
+      coll[(size_t)pos].emplace(std::move(key), std::move(val));
       return pos;
     }
 }
@@ -588,157 +990,1438 @@ Silicon Silicon::createFromFile(const char * file, const char* defaultPath, long
   return Silicon(file, defaultPath, maxBufferLen);
 }
 
-Silicon Silicon::createFromStr(std::string & data, long maxBufferLen)
+Silicon Silicon::createFromStr(std::string & data, long maxBufferLen)
+{
+  return Silicon(data.c_str(), maxBufferLen);
+}
+
+Silicon Silicon::createFromStr(const char * data, long maxBufferLen)
+{
+  return Silicon(data, maxBufferLen);
+}
+
+std::string Silicon::render(bool useLayout)
+{
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  struct DepthGuard
+  {
+    int& depth;
+    ~DepthGuard()
+    {
+      --depth;
+    }
+  } depthGuard = { ++this->renderDepth };
+  /* Async blocks are spliced before this render returns */
+  struct AsyncGuard
+  {
+    Silicon* s;
+    ~AsyncGuard()
+    {
+      if (s)
+	s->endAsync();
+    }
+  } asyncGuard = { ( (this->asyncBlocks) || (this->incremental) )?NULL:this };
+  this->asyncBlocks = (!this->incremental);
+  std::string tplt;
+
+  ++this->renderNumber;
+  resetStats();
+  this->incrementalStats = { 0, 0 };
+  /* Generated code doesn't know about regions, or reloaded files */
+  bool useGenerated = ( (!this->incremental) && (!SiliconReload::running()) );
+  tplt.reserve(outputEstimate->reserve());
+  if (asyncGuard.s)
+    this->asyncDestination = &tplt;
+  if ( (this->generated) && (useGenerated) )
+    renderGenerated(tplt, *this->generated);
+  else if (this->incremental)
+    renderIncremental(tplt, this->_dataName, getCompiled(), this->incrementalTemplate);
+  else
+    {
+      /* Keep it alive, even if setData() is called while rendering */
+      std::shared_ptr<const SiliconTemplate> compiled = getCompiled();
+      renderSource(tplt, this->_dataName, *compiled);
+    }
+  if (asyncGuard.s)
+    spliceAsync();
+  outputEstimate->update(tplt.size());
+  if ((Silicon::layoutData==NULL) || (!useLayout) )
+    return tplt;
+
+  /* Template output won't be used anymore, give it to the keyword */
+  std::string& contents = keywordEntry(Silicon::contentsKeyword);
+  if ( (!this->incremental) || (contents != tplt) )
+    {
+      keywordChanged(Silicon::contentsKeyword);
+      contents = std::move(tplt);
+    }
+
+  std::shared_ptr<OutputEstimate> layout = std::atomic_load(&Silicon::layoutEstimate);
+  const Generated* layoutGen = Silicon::layoutGenerated;
+  std::string out;
+  out.reserve(layout->reserve());
+  if (asyncGuard.s)
+    this->asyncDestination = &out;
+  if ( (layoutGen) && (useGenerated) )
+    renderGenerated(out, *layoutGen);
+  else if (this->incremental)
+    renderIncremental(out, Silicon::layoutName, getCompiledLayout(), this->incrementalLayout);
+  else
+    {
+      std::shared_ptr<const SiliconTemplate> layoutTpl = getCompiledLayout();
+      renderSource(out, Silicon::layoutName, *layoutTpl);
+    }
+  if (asyncGuard.s)
+    spliceAsync();
+  layout->update(out.size());
+  return out;
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getCompiled()
+{
+  if ( (!this->_dataPath.empty()) && (SiliconReload::running()) )
+    {
+      unsigned long generation = SiliconReload::generation();
+      if ( (!this->compiledData) || (generation != this->reloadGeneration) )
+	{
+	  this->compiledData = SiliconReload::get(this->_dataPath, this->localConfig.basePath, this->localConfig.minify);
+	  this->reloadGeneration = generation;
+	  this->reloaded = true;
+	}
+
+      return this->compiledData;
+    }
+
+  /* Reload stopped, we compile our own source again */
+  if ( (this->reloaded) && (this->_data) )
+    {
+      this->compiledData.reset();
+      this->reloaded = false;
+    }
+
+  if (!this->compiledData)
+    this->compiledData = compileSource(this->_dataName, this->_data, strlen(this->_data));
+
+  return this->compiledData;
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getCompiledLayout()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(layoutMutex);
+#endif
+  /* One for each minify setting, instances using both don't compile it again and again */
+  bool minify = this->localConfig.minify;
+  std::shared_ptr<const SiliconTemplate>& compiled = Silicon::layoutCompiled[minify];
+  if ( (!Silicon::layoutPath.empty()) && (SiliconReload::running()) )
+    {
+      unsigned long generation = SiliconReload::generation();
+      if ( (!compiled) || (generation != Silicon::layoutGeneration[minify]) )
+	{
+	  compiled = SiliconReload::get(Silicon::layoutPath, Silicon::layoutBasePath, minify);
+	  Silicon::layoutGeneration[minify] = generation;
+	  Silicon::layoutReloaded = true;
+	}
+
+      return compiled;
+    }
+
+  /* Reload stopped, back to the layout we had */
+  if (Silicon::layoutReloaded)
+    {
+      for (auto& l : Silicon::layoutCompiled)
+	l = (Silicon::layoutBundled)?bundled(Silicon::layoutPath):std::shared_ptr<const SiliconTemplate>();
+      Silicon::layoutReloaded = false;
+    }
+
+  if (!compiled)
+    compiled = compileSource(Silicon::layoutName, Silicon::layoutData, strlen(Silicon::layoutData));
+
+  return compiled;
+}
+
+namespace
+{
+  /* Shorter literal texts are copied, a span costs more than that */
+  const std::size_t minLiteralSpan = 32;
+}
+
+void Silicon::SpanRecorder::flush()
+{
+  if (buffer->size() > flushed)
+    pieces.push_back({ NULL, flushed, buffer->size()-flushed, buffer });
+  flushed = buffer->size();
+}
+
+void Silicon::SpanRecorder::literal(const char* base, std::size_t len)
+{
+  flush();
+  pieces.push_back({ base, 0, len, NULL });
+}
+
+Silicon::Spans Silicon::renderSpans(bool useLayout)
+{
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  struct Guard
+  {
+    Silicon* s;
+    SpanRecorder* previous;
+    ~Guard()
+    {
+      --s->renderDepth;
+      s->spanRecorder = previous;
+    }
+  } guard = { this, this->spanRecorder };
+  ++this->renderDepth;
+  ++this->renderNumber;
+  resetStats();
+
+  Spans res;
+  std::shared_ptr<const SiliconTemplate> compiled = getCompiled();
+  res.templates.push_back(compiled);
+  res.buffers.push_back(std::unique_ptr<std::string>(new std::string()));
+
+  SpanRecorder tplt = { res.buffers.back().get(), {}, 0, NULL };
+  this->spanRecorder = &tplt;
+  renderSource(*tplt.buffer, this->_dataName, *compiled);
+  tplt.flush();
+
+  SpanRecorder* result = &tplt;
+  SpanRecorder layout;
+  if ((Silicon::layoutData!=NULL) && (useLayout) )
+    {
+      /* The layout may use the contents keyword anywhere, it must have it */
+      std::string& contents = keywordEntry(Silicon::contentsKeyword);
+      contents.clear();
+      for (auto& p : tplt.pieces)
+	contents.append((p.base)?p.base:p.buffer->data()+p.offset, p.len);
+
+      std::shared_ptr<const SiliconTemplate> layoutTpl = getCompiledLayout();
+      res.templates.push_back(layoutTpl);
+      res.buffers.push_back(std::unique_ptr<std::string>(new std::string()));
+      layout = { res.buffers.back().get(), {}, 0, &tplt.pieces };
+      this->spanRecorder = &layout;
+      renderSource(*layout.buffer, Silicon::layoutName, *layoutTpl);
+      layout.flush();
+      result = &layout;
+    }
+  this->spanRecorder = NULL;
+
+  /* Buffers won't change anymore, get pointers */
+  res._spans.reserve(result->pieces.size());
+  for (auto& p : result->pieces)
+    {
+      res._spans.push_back({ (p.base)?p.base:p.buffer->data()+p.offset, p.len });
+      res._size+=p.len;
+    }
+
+  return res;
+}
+
+void Silicon::OutputStream::drain()
+{
+  (*sink)(buffer->data(), buffer->size());
+  buffer->clear();
+}
+
+void Silicon::renderTo(const Silicon::OutputSink& sink, bool useLayout, std::size_t chunk)
+{
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  struct Guard
+  {
+    Silicon* s;
+    OutputStream* previous;
+    ~Guard()
+    {
+      --s->renderDepth;
+      s->outputStream = previous;
+    }
+  } guard = { this, this->outputStream };
+  ++this->renderDepth;
+  ++this->renderNumber;
+  resetStats();
+
+  std::string buffer;
+  /* A keyword may go past chunk before the buffer is drained */
+  buffer.reserve(chunk*2);
+  OutputStream stream = { &buffer, &sink, chunk };
+  std::shared_ptr<const SiliconTemplate> compiled = getCompiled();
+  if ((Silicon::layoutData==NULL) || (!useLayout) )
+    {
+      this->outputStream = &stream;
+      renderSource(buffer, this->_dataName, *compiled);
+    }
+  else
+    {
+      /* The layout may use the contents keyword anywhere, it must have it */
+      std::string tplt;
+      tplt.reserve(outputEstimate->reserve());
+      renderSource(tplt, this->_dataName, *compiled);
+      outputEstimate->update(tplt.size());
+      keywordChanged(Silicon::contentsKeyword);
+      keywordEntry(Silicon::contentsKeyword) = std::move(tplt);
+
+      std::shared_ptr<const SiliconTemplate> layoutTpl = getCompiledLayout();
+      this->outputStream = &stream;
+      renderSource(buffer, Silicon::layoutName, *layoutTpl);
+    }
+  this->outputStream = NULL;
+
+  if (!buffer.empty())
+    stream.drain();
+}
+
+std::string Silicon::Spans::str() const
+{
+  std::string res;
+  res.reserve(_size);
+  for (auto& s : _spans)
+    res.append(s.base, s.len);
+
+  return res;
+}
+
+Silicon::Silicon(Silicon && sil)
+{
+  moveFrom(sil);
+}
+
+Silicon& Silicon::operator=(Silicon&& sil)
+{
+  if (this == &sil)
+    return *this;
+
+  if (this->_data)
+    free(this->_data);
+  /* Nothing of the old contents is kept */
+  this->slots.clear();
+  this->keywordVersions.clear();
+  this->collectionVersions.clear();
+  this->incrementalStats = { 0, 0 };
+  moveFrom(sil);
+
+  return *this;
+}
+
+void Silicon::moveFrom(Silicon& sil)
+{
+  this->localConfig = std::move(sil.localConfig);
+  this->_data = sil._data;
+  sil._data=NULL;
+  this->_dataName = std::move(sil._dataName);
+  this->_dataPath = std::move(sil._dataPath);
+  this->generated = sil.generated;
+  this->reloadGeneration = sil.reloadGeneration;
+  this->reloaded = sil.reloaded;
+  this->compiledData = std::move(sil.compiledData);
+  this->outputEstimate = std::move(sil.outputEstimate);
+  this->renderNumber = sil.renderNumber;
+  this->extensionData = std::move(sil.extensionData);
+  /* Map nodes move with the maps, generated code slots are found again */
+  this->localKeywords = std::move(sil.localKeywords);
+  this->localFunctions = std::move(sil.localFunctions);
+  this->localCollections = std::move(sil.localCollections);
+  this->collectionSources = std::move(sil.collectionSources);
+  this->localValues = std::move(sil.localValues);
+  this->localConditionStringOperators = std::move(sil.localConditionStringOperators);
+  this->localConditionLongOperators = std::move(sil.localConditionLongOperators);
+  this->localConditionDoubleOperators = std::move(sil.localConditionDoubleOperators);
+  this->layer = std::move(sil.layer);
+  this->keywordsLayout = sil.keywordsLayout+1;
+  this->incremental = sil.incremental;
+  this->incrementalTemplate = std::move(sil.incrementalTemplate);
+  this->incrementalLayout = std::move(sil.incrementalLayout);
+  this->keywordVersions = std::move(sil.keywordVersions);
+  this->collectionVersions = std::move(sil.collectionVersions);
+  this->referencesValid = false;
+  /* Values cached by extensions must be computed again */
+  this->settingsVersion = sil.settingsVersion+1;
+  ++sil.keywordsLayout;
+}
+
+Silicon::Silicon(const Silicon& sil)
+{
+  this->localConfig = sil.localConfig;
+  /* Source is only needed to compile it */
+  if ( (sil._data) && (!sil.compiledData) )
+    {
+      std::size_t len = strlen(sil._data);
+      this->_data = (char*) malloc(len+1);
+      memcpy(this->_data, sil._data, len+1);
+    }
+  this->_dataName = sil._dataName;
+  this->_dataPath = sil._dataPath;
+  this->generated = sil.generated;
+  this->reloadGeneration = sil.reloadGeneration;
+  this->reloaded = sil.reloaded;
+  this->compiledData = sil.compiledData;
+  this->outputEstimate = sil.outputEstimate;
+  this->localKeywords = sil.localKeywords;
+  this->localFunctions = sil.localFunctions;
+  this->localCollections = sil.localCollections;
+  this->localValues = sil.localValues;
+  this->localConditionStringOperators = sil.localConditionStringOperators;
+  this->localConditionLongOperators = sil.localConditionLongOperators;
+  this->localConditionDoubleOperators = sil.localConditionDoubleOperators;
+  this->layer = sil.layer;
+  this->settingsVersion = sil.settingsVersion+1;
+}
+
+Silicon Silicon::fork() const
+{
+  return Silicon(*this);
+}
+
+void Silicon::freeze()
+{
+  /* Forks share compiled template, and don't need the source */
+  getCompiled();
+  if ( (localKeywords.empty()) && (localFunctions.empty()) && (localCollections.empty()) && (localValues.empty()) &&
+       (localConditionStringOperators.empty()) && (localConditionLongOperators.empty()) && (localConditionDoubleOperators.empty()) )
+    return;
+
+  /* Layers below are shared as they are */
+  std::shared_ptr<Layer> top = std::make_shared<Layer>();
+  top->keywords = std::move(localKeywords);
+  top->functions = std::move(localFunctions);
+  top->collections = std::move(localCollections);
+  top->stringOperators = std::move(localConditionStringOperators);
+  top->longOperators = std::move(localConditionLongOperators);
+  top->doubleOperators = std::move(localConditionDoubleOperators);
+  top->values = std::move(localValues);
+  top->hasValues = ( (!top->values.empty()) || ( (this->layer) && (this->layer->hasValues) ) );
+  top->parent = std::move(this->layer);
+
+  localKeywords.clear();
+  localFunctions.clear();
+  localCollections.clear();
+  localConditionStringOperators.clear();
+  localConditionLongOperators.clear();
+  localConditionDoubleOperators.clear();
+  localValues.clear();
+  this->layer = top;
+  /* Keyword values moved */
+  ++keywordsLayout;
+}
+
+void Silicon::detach()
+{
+  if (!this->layer)
+    return;
+
+  /* insert() leaves local values alone, and newer layers come first */
+  for (const Layer* l = this->layer.get(); l; l = l->parent.get())
+    {
+      localKeywords.insert(l->keywords.begin(), l->keywords.end());
+      localFunctions.insert(l->functions.begin(), l->functions.end());
+      localCollections.insert(l->collections.begin(), l->collections.end());
+      localConditionStringOperators.insert(l->stringOperators.begin(), l->stringOperators.end());
+      localConditionLongOperators.insert(l->longOperators.begin(), l->longOperators.end());
+      localConditionDoubleOperators.insert(l->doubleOperators.begin(), l->doubleOperators.end());
+      localValues.insert(l->values.begin(), l->values.end());
+    }
+  this->layer.reset();
+  ++keywordsLayout;
+}
+
+Silicon::KeywordMap::iterator Silicon::localKeyword(const std::string& kw)
+{
+  auto index = localKeywords.find(kw);
+  if (index != localKeywords.end())
+    return index;
+
+  const std::string* base = layerFind(&Layer::keywords, kw);
+  if (!base)
+    return localKeywords.end();
+
+  ++keywordsLayout;
+  return localKeywords.insert({ kw, *base }).first;
+}
+
+std::vector<Silicon::StringMap>& Silicon::localCollection(const std::string& kw)
+{
+  auto coll = localCollections.find(kw);
+  if (coll != localCollections.end())
+    return coll->second;
+
+  std::vector<StringMap>& res = localCollections[kw];
+  const std::vector<StringMap>* base = layerFind(&Layer::collections, kw);
+  if (base)
+    res = *base;
+
+  return res;
+}
+
+const std::vector<Silicon::StringMap>* Silicon::findCollection(const std::string& kw)
+{
+  auto coll = localCollections.find(kw);
+  if (coll != localCollections.end())
+    return &coll->second;
+
+  return layerFind(&Layer::collections, kw);
+}
+
+Silicon::BatchStats Silicon::renderBatch(const Silicon::RenderContext* contexts, std::size_t count, std::vector<std::string>& outputs, std::vector<std::string>& errors, unsigned threads, bool useLayout)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  if (threads > count)
+    threads = std::max<std::size_t>(count, 1);
+
+  outputs.resize(count);
+  errors.assign(count, std::string());
+  /* Compile now, workers will share it */
+  getCompiled();
+
+  std::atomic<std::size_t> next(0);
+  std::atomic<std::size_t> failed(0);
+  auto work = [&]()
+    {
+      /* One instance per thread, restored after every render */
+      std::unique_ptr<Silicon> worker(new Silicon(*this));
+      unsigned long settings = worker->settingsVersion;
+      std::vector<std::pair<std::string, const std::vector<StringMap>*> > replaced;
+      std::vector<std::string> changed;
+      worker->changedKeywords = &changed;
+      std::size_t i;
+      while ( (i = next.fetch_add(1, std::memory_order_relaxed)) < count)
+	{
+	  const RenderContext& ctx = contexts[i];
+	  bool rendered = false;
+	  try
+	    {
+	      for (auto& k : ctx.keywords)
+		worker->setKeyword(k.first, k.second);
+	      for (auto& c : ctx.collections)
+		{
+		  auto base = this->localCollections.find(c.first);
+		  replaced.push_back({ c.first, (base == this->localCollections.end())?NULL:&base->second });
+		  worker->addCollection(c.first, c.second);
+		}
+	      outputs[i] = worker->render(useLayout);
+	      rendered = true;
+	    }
+	  catch (std::exception& e)
+	    {
+	      errors[i] = e.what();
+	    }
+	  catch (...)
+	    {
+	      errors[i] = "Unknown error";
+	    }
+	  if (!rendered)
+	    {
+	      outputs[i].clear();
+	      ++failed;
+	      worker.reset(new Silicon(*this));
+	      worker->changedKeywords = &changed;
+	      settings = worker->settingsVersion;
+	      replaced.clear();
+	      changed.clear();
+	      continue;
+	    }
+
+	  /* Only keywords of the context and the ones set by the template ({!set}) */
+	  bool layoutChanged = false;
+	  for (auto& kw : changed)
+	    {
+	      auto base = this->localKeywords.find(kw);
+	      auto current = worker->localKeywords.find(kw);
+	      if (base != this->localKeywords.end())
+		{
+		  if (current != worker->localKeywords.end())
+		    current->second = base->second;
+		  else
+		    {
+		      worker->localKeywords.insert(*base);
+		      layoutChanged = true;
+		    }
+		}
+	      else if (current != worker->localKeywords.end())
+		{
+		  worker->localKeywords.erase(current);
+		  layoutChanged = true;
+		}
+	    }
+	  changed.clear();
+	  if (layoutChanged)
+	    ++worker->keywordsLayout;
+	  if (worker->settingsVersion != settings)
+	    settings = ++worker->settingsVersion;
+	  for (auto& r : replaced)
+	    {
+	      if (r.second)
+		worker->localCollections[r.first] = *r.second;
+	      else
+		worker->localCollections.erase(r.first);
+	    }
+	  replaced.clear();
+	}
+    };
+
+  std::vector<std::thread> pool;
+  for (unsigned t=1; t<threads; ++t)
+    pool.push_back(std::thread(work));
+  work();
+  for (auto& t : pool)
+    t.join();
+
+  BatchStats res;
+  res.failed = failed;
+  res.rendered = count-res.failed;
+  res.threads = threads;
+
+  return res;
+}
+
+struct Silicon::AsyncSections
+{
+  /* Block rendered by another thread */
+  struct Section
+  {
+    std::unique_ptr<Silicon> worker;
+    std::string file;
+    /* Taken by a pool thread, or by the render thread waiting for it */
+    std::atomic<bool> claimed { false };
+    bool done = false;
+    std::string output;
+    std::exception_ptr error;
+    /* Async blocks of the worker, in output */
+    std::vector<std::pair<std::size_t, std::size_t> > placeholders;
+    /* Extension data of the worker, given back in finish() */
+    ExtensionMap extensionData;
+    /* Waited for, its data was given back */
+    bool joined = false;
+  };
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  std::vector<std::shared_ptr<Section> > sections;
+  /* Render finished, new blocks are not rendered */
+  bool ended = false;
+
+  /* Renders section, unless somebody took it */
+  void run(Section& section);
+
+  /* Waits for block id and its blocks. Their RenderData goes to
+     extensionData, where each block was */
+  Section& finish(std::size_t id, ExtensionMap& extensionData);
+
+  /* Appends text to destination, with blocks at their positions */
+  void splice(std::string& destination, const std::string& text, const std::vector<std::pair<std::size_t, std::size_t> >& placeholders, ExtensionMap& extensionData);
+};
+
+namespace
+{
+  /* Threads rendering async blocks, started with the first block */
+  class AsyncPool
+  {
+  public:
+    static AsyncPool& get()
+    {
+      static AsyncPool pool;
+      return pool;
+    }
+
+    void setThreads(unsigned threads)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      wanted = threads;
+    }
+
+    void post(std::function<void()> task)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (workers.empty())
+	  {
+	    unsigned threads = (wanted)?wanted:std::max(1u, std::thread::hardware_concurrency());
+	    for (unsigned t=0; t<threads; ++t)
+	      workers.push_back(std::thread(&AsyncPool::work, this));
+	  }
+	tasks.push_back(std::move(task));
+      }
+      wake.notify_one();
+    }
+
+    ~AsyncPool()
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	stop = true;
+      }
+      wake.notify_all();
+      for (auto& t : workers)
+	t.join();
+    }
+
+  private:
+    void work()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+	{
+	  wake.wait(lock, [this]() { return ( (stop) || (!tasks.empty()) ); });
+	  if (stop)
+	    return;
+
+	  std::function<void()> task = std::move(tasks.front());
+	  tasks.pop_front();
+	  lock.unlock();
+	  task();
+	  lock.lock();
+	}
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::function<void()> > tasks;
+    std::vector<std::thread> workers;
+    unsigned wanted = 0;
+    bool stop = false;
+  };
+}
+
+void Silicon::AsyncSections::run(Silicon::AsyncSections::Section& section)
+{
+  if (section.claimed.exchange(true))
+    return;
+
+  std::string output;
+  std::exception_ptr error;
+  try
+    {
+      SiliconArena::Scope arenaScope(SiliconArena::local());
+      ++section.worker->renderDepth;
+      section.worker->asyncDestination = &output;
+      std::shared_ptr<const SiliconTemplate> block = section.worker->getBlock(section.file);
+      section.worker->renderSource(output, section.file, *block);
+    }
+  catch (...)
+    {
+      error = std::current_exception();
+    }
+  ExtensionMap extensionData = std::move(section.worker->extensionData);
+  std::vector<std::pair<std::size_t, std::size_t> > placeholders = std::move(section.worker->asyncPlaceholders);
+  /* The worker points to us */
+  section.worker.reset();
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    section.output = std::move(output);
+    section.error = error;
+    section.placeholders = std::move(placeholders);
+    section.extensionData = std::move(extensionData);
+    section.done = true;
+  }
+  finished.notify_all();
+}
+
+Silicon::AsyncSections::Section& Silicon::AsyncSections::finish(std::size_t id, Silicon::ExtensionMap& extensionData)
+{
+  std::shared_ptr<Section> section;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    section = sections.at(id);
+  }
+  if (section->joined)
+    return *section;
+
+  /* If no thread took it yet, render it here. If a thread is
+     rendering it, render the blocks nobody took while waiting */
+  run(*section);
+  std::unique_lock<std::mutex> lock(mutex);
+  for (std::size_t i=id+1; ( (!section->done) && (i<sections.size()) ); ++i)
+    {
+      std::shared_ptr<Section> other = sections[i];
+      if (other->claimed.load())
+	continue;
+
+      lock.unlock();
+      run(*other);
+      lock.lock();
+    }
+  finished.wait(lock, [&]() { return section->done; });
+  lock.unlock();
+  if (section->error)
+    std::rethrow_exception(section->error);
+
+  /* Blocks may have async blocks, their data goes to the block first */
+  for (auto& p : section->placeholders)
+    finish(p.second, section->extensionData);
+  for (auto& e : section->extensionData)
+    {
+      if (!e.second.render)
+	continue;
+
+      auto target = extensionData.find(e.first);
+      if (target == extensionData.end())
+	extensionData.insert(std::move(e));
+      else if (target->second.render)
+	target->second.render->blockRendered(id, *e.second.render);
+    }
+  section->extensionData.clear();
+  section->joined = true;
+
+  return *section;
+}
+
+void Silicon::AsyncSections::splice(std::string& destination, const std::string& text, const std::vector<std::pair<std::size_t, std::size_t> >& placeholders, Silicon::ExtensionMap& extensionData)
+{
+  std::size_t pos = 0;
+  for (auto& p : placeholders)
+    {
+      destination.append(text, pos, p.first-pos);
+      pos = p.first;
+
+      Section& section = finish(p.second, extensionData);
+      splice(destination, section.output, section.placeholders, section.extensionData);
+    }
+  destination.append(text, pos, std::string::npos);
+}
+
+void Silicon::asyncBlock(const std::string& file, const Silicon::StringMap& keywords)
+{
+  if (!this->asyncSections)
+    this->asyncSections = std::make_shared<AsyncSections>();
+
+  std::shared_ptr<AsyncSections::Section> section = std::make_shared<AsyncSections::Section>();
+  section->file = file;
+  section->worker.reset(new Silicon(*this));
+  section->worker->asyncSections = this->asyncSections;
+  section->worker->asyncBlocks = true;
+  /* Its RenderData belongs to this render */
+  section->worker->renderNumber = this->renderNumber;
+  for (auto& k : keywords)
+    section->worker->setKeyword(k.first, k.second);
+
+  std::size_t id;
+  {
+    std::lock_guard<std::mutex> lock(this->asyncSections->mutex);
+    /* Render failed, nobody will wait for it */
+    if (this->asyncSections->ended)
+      return;
+
+    id = this->asyncSections->sections.size();
+    this->asyncSections->sections.push_back(section);
+  }
+  this->asyncPlaceholders.push_back({ this->asyncDestination->size(), id });
+  for (auto& e : this->extensionData)
+    {
+      if (e.second.render)
+	e.second.render->blockStarted(this, id);
+    }
+
+  std::shared_ptr<AsyncSections> sections = this->asyncSections;
+  AsyncPool::get().post([sections, section]()
+			{
+			  sections->run(*section);
+			});
+}
+
+void Silicon::spliceAsync()
+{
+  std::vector<std::pair<std::size_t, std::size_t> > placeholders = std::move(this->asyncPlaceholders);
+  this->asyncPlaceholders.clear();
+  if ( (!this->asyncSections) || (placeholders.empty()) )
+    return;
+
+  std::string& destination = *this->asyncDestination;
+  std::string out;
+  out.reserve(destination.size());
+  this->asyncSections->splice(out, destination, placeholders, this->extensionData);
+  destination = std::move(out);
+}
+
+void Silicon::joinAsync()
+{
+  if (!this->asyncSections)
+    return;
+
+  for (auto& p : this->asyncPlaceholders)
+    this->asyncSections->finish(p.second, this->extensionData);
+}
+
+void Silicon::endAsync()
+{
+  this->asyncBlocks = false;
+  this->asyncDestination = NULL;
+  this->asyncPlaceholders.clear();
+  if (!this->asyncSections)
+    return;
+
+  std::shared_ptr<AsyncSections> sections = std::move(this->asyncSections);
+  std::lock_guard<std::mutex> lock(sections->mutex);
+  sections->ended = true;
+  for (auto& sec : sections->sections)
+    {
+      /* Not started: its worker points to sections */
+      if (!sec->claimed.exchange(true))
+	{
+	  sec->worker.reset();
+	  sec->done = true;
+	}
+    }
+  sections->sections.clear();
+}
+
+void Silicon::setAsyncThreads(unsigned threads)
+{
+  AsyncPool::get().setThreads(threads);
+}
+
+std::string Silicon::parse(const std::string& templ)
+{
+  static const std::string noName;
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  std::string out;
+  parseSource(out, noName, templ.data(), templ.size());
+  return out;
+}
+
+SiliconTemplateCache::Stats Silicon::getParseCacheStats()
+{
+  return parseCache.stats();
+}
+
+void Silicon::setParseCacheSize(std::size_t entries)
+{
+  parseCache.capacity(entries);
+}
+
+template <typename F>
+void Silicon::inSource(const std::string& name, const char* data, F f)
+{
+  const char* previousTag = tagPosition;
+
+  sources.push_back({ &name, data });
+  tagPosition = NULL;
+  try
+    {
+      f();
+      sources.pop_back();
+      tagPosition = previousTag;
+    }
+  catch (SiliconException& e)
+    {
+      long line, pos;
+      locate(data, tagPosition, line, pos);
+      e.setLocation(name, line, pos);
+      sources.pop_back();
+      tagPosition = previousTag;
+      throw;
+    }
+  catch (...)
+    {
+      sources.pop_back();
+      tagPosition = previousTag;
+      throw;
+    }
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::compileSource(const std::string& name, const char* data, std::size_t len)
+{
+  /* Also compiled out of render() (reload, fork, bundles...) */
+  SiliconArena::Scope arenaScope(SiliconArena::local());
+  std::shared_ptr<SiliconTemplate> tpl = std::make_shared<SiliconTemplate>(data, len);
+  const char* source = tpl->source().c_str();
+
+  inSource(name, source, [&]()
+	   {
+	     this->compile(*tpl, source);
+	   });
+  if (this->localConfig.minify)
+    tpl->minify();
+  tpl->hashNames();
+
+  return tpl;
+}
+
+void Silicon::renderSource(std::string& destination, const std::string& name, const SiliconTemplate& tpl)
+{
+  inSource(name, tpl.source().c_str(), [&]()
+	   {
+	     this->evaluate(destination, tpl, 0, tpl.nodes().size());
+	   });
+}
+
+void Silicon::setIncremental(bool val)
+{
+  this->incremental = val;
+  /* Versions are only kept while enabled, so old outputs are useless */
+  this->incrementalTemplate = IncrementalState();
+  this->incrementalLayout = IncrementalState();
+  this->keywordVersions.clear();
+  this->collectionVersions.clear();
+}
+
+unsigned long Silicon::keywordVersion(const std::string& kw)
+{
+  unsigned long version = 0;
+  auto v = keywordVersions.find(kw);
+  if (v != keywordVersions.end())
+    version = v->second;
+
+  /* Local and global versions only grow, so their sum changes if any changes */
+  v = globalKeywordVersions.find(kw);
+  if (v != globalKeywordVersions.end())
+    version+= v->second;
+
+  return version;
+}
+
+unsigned long Silicon::collectionVersion(const std::string& name)
+{
+  auto v = collectionVersions.find(name);
+  return (v == collectionVersions.end())?0:v->second;
+}
+
+void Silicon::recordKeyword(const std::string& kw)
+{
+  /* Loop keywords come from the collection, which is a dependency */
+  for (auto p : loopPrefixes)
+    {
+      if (kw.compare(0, p->size(), *p) == 0)
+	return;
+    }
+
+  dependencies->push_back({ false, kw, keywordVersion(kw) });
+}
+
+bool Silicon::regionUnchanged(const Silicon::Region& region)
+{
+  if (!region.valid)
+    return false;
+
+  for (auto& d : region.dependencies)
+    {
+      unsigned long version = (d.collection)?collectionVersion(d.name):keywordVersion(d.name);
+      if (version != d.version)
+	return false;
+    }
+
+  return true;
+}
+
+void Silicon::renderIncremental(std::string& destination, const std::string& name, const std::shared_ptr<const SiliconTemplate>& tpl, Silicon::IncrementalState& state)
+{
+  /* Another template or settings: old outputs are useless */
+  if ( (state.tpl != tpl) || (state.autoEscape != this->localConfig.autoEscape) ||
+       (state.leaveUnmatchedKwds != this->localConfig.leaveUnmatchedKwds) || (state.contentsKeyword != Silicon::contentsKeyword) )
+    {
+      state.tpl = tpl;
+      state.regions.clear();
+      state.regions.resize(tpl->nodes().size());
+      state.autoEscape = this->localConfig.autoEscape;
+      state.leaveUnmatchedKwds = this->localConfig.leaveUnmatchedKwds;
+      state.contentsKeyword = Silicon::contentsKeyword;
+    }
+
+  inSource(name, tpl->source().c_str(), [&]()
+	   {
+	     this->evaluateIncremental(destination, *tpl, state, 0, tpl->nodes().size());
+	   });
+}
+
+bool Silicon::evaluateIncremental(std::string& destination, const SiliconTemplate& tpl, Silicon::IncrementalState& state, std::size_t first, std::size_t last)
+{
+  const char* data = tpl.source().c_str();
+  const std::vector<SiliconTemplate::Node>& nodes = tpl.nodes();
+  bool reusable = true;
+
+  /* Restores the parent region dependencies, even with exceptions */
+  struct Recording
+  {
+    Silicon* s;
+    std::vector<RegionDependency>* parent;
+    ~Recording()
+    {
+      s->dependencies = parent;
+    }
+  };
+
+  for (std::size_t i=first; i<last; i=nodes[i].end)
+    {
+      const SiliconTemplate::Node& node = nodes[i];
+      if (node.type == SiliconTemplate::Node::TEXT)
+	{
+	  destination.append(data+node.pos, node.len);
+	  continue;
+	}
+
+      Region& region = state.regions[i];
+      std::vector<RegionDependency>* parent = this->dependencies;
+      if (regionUnchanged(region))
+	{
+	  ++this->incrementalStats.reused;
+	  destination.append(region.output);
+	  if (parent)
+	    parent->insert(parent->end(), region.dependencies.begin(), region.dependencies.end());
+	  continue;
+	}
+
+      ++this->incrementalStats.rendered;
+      region.valid = false;
+      std::vector<RegionDependency> deps;
+      std::size_t start = destination.size();
+      bool regionReusable = true;
+      {
+	Recording recording = { this, parent };
+	this->dependencies = &deps;
+	tagPosition = data+node.pos;
+	switch (node.type)
+	  {
+	  case SiliconTemplate::Node::IF:
+	    {
+	      bool logicResult=false;
+	      for (auto& x : node.values)
+		logicResult = evaluateCondition(TempString(x.data(), x.size()));
+	      if (logicResult)
+		regionReusable = evaluateIncremental(destination, tpl, state, i+1, node.end);
+	    }
+	    break;
+	  case SiliconTemplate::Node::FUNCTION:
+	  case SiliconTemplate::Node::IFFUN:
+	    /* We don't know what functions do */
+	    this->dependencies = NULL;
+	    regionReusable = false;
+	    evaluate(destination, tpl, i, node.end);
+	    break;
+	  default:
+	    evaluate(destination, tpl, i, node.end);
+	  }
+      }
+
+      if (!regionReusable)
+	{
+	  reusable = false;
+	  continue;
+	}
+
+      std::sort(deps.begin(), deps.end());
+      deps.erase(std::unique(deps.begin(), deps.end()), deps.end());
+      region.output.assign(destination, start, std::string::npos);
+      region.dependencies = std::move(deps);
+      region.valid = true;
+      if (parent)
+	parent->insert(parent->end(), region.dependencies.begin(), region.dependencies.end());
+    }
+
+  return reusable;
+}
+
+void Silicon::parseSource(std::string& destination, const std::string& name, const char* data, std::size_t len)
+{
+  std::shared_ptr<const SiliconTemplate> tpl = getCachedSource(name, data, len);
+  renderSource(destination, name, *tpl);
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getBlock(const std::string& file)
+{
+  if (SiliconReload::running())
+    return SiliconReload::get(filePath(file, this->localConfig.basePath), this->localConfig.basePath, this->localConfig.minify);
+
+  std::shared_ptr<const SiliconTemplate> bundledBlock = bundled(filePath(file, this->localConfig.basePath));
+  if (bundledBlock)
+    return bundledBlock;
+
+  char *blockData=NULL;
+  this->extractFile(&blockData, file);
+  std::shared_ptr<const SiliconTemplate> block;
+  try
+    {
+      block = getCachedSource(file, blockData, strlen(blockData));
+    }
+  catch (...)
+    {
+      free(blockData);
+      throw;
+    }
+  free(blockData);
+
+  return block;
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::bundled(const std::string& path)
+{
+  if (!SiliconBundle::loaded())
+    return std::shared_ptr<const SiliconTemplate>();
+
+  std::shared_ptr<const SiliconTemplate> tpl = SiliconBundle::get(path);
+  /* Bigger than this instance reads from files */
+  if ( (tpl) && (tpl->length() > (std::size_t) this->localConfig.maxBufferLen) )
+    return std::shared_ptr<const SiliconTemplate>();
+
+  return tpl;
+}
+
+std::shared_ptr<const SiliconTemplate> Silicon::getCachedSource(const std::string& name, const char* data, std::size_t len)
 {
-  return Silicon(data.c_str(), maxBufferLen);
+  std::shared_ptr<const SiliconTemplate> tpl = parseCache.find(data, len, this->localConfig.minify);
+  if (!tpl)
+    {
+      tpl = compileSource(name, data, len);
+      parseCache.insert(tpl);
+    }
+
+  return tpl;
 }
 
-Silicon Silicon::createFromStr(const char * data, long maxBufferLen)
+namespace
 {
-  return Silicon(data, maxBufferLen);
+  /* Keywords compared in a condition: a, !a, a==b, a!="text"... */
+  void conditionKeywords(const std::string& condition, std::vector<std::string>& kwds)
+  {
+    std::size_t start = (!condition.empty() && condition[0] == '!')?1:0;
+    std::size_t op = condition.find_first_of("!<>=", start);
+    std::string a = condition.substr(start, (op==std::string::npos)?std::string::npos:op-start);
+    std::string b;
+    if (op != std::string::npos)
+      {
+	std::size_t bstart = condition.find_first_not_of("!<>=", op);
+	if (bstart != std::string::npos)
+	  b = condition.substr(bstart);
+      }
+
+    for (auto& x : { a, b })
+      {
+	if ( (x.empty()) || (x.front() == '"') || (std::all_of(x.begin(), x.end(), ::isdigit)) )
+	  continue;
+	kwds.push_back(x);
+      }
+  }
 }
 
-std::string Silicon::render(bool useLayout)
+const Silicon::References& Silicon::getReferences(bool useLayout)
 {
-  std::string tplt;
-  resetStats();
-  _parse(tplt, this->_data);
-  if ((Silicon::layoutData==NULL) || (!useLayout) )
-    return tplt;
+  std::shared_ptr<const SiliconTemplate> tpl = getCompiled();
+  std::shared_ptr<const SiliconTemplate> layoutTpl;
+  if ( (useLayout) && (Silicon::layoutData != NULL) )
+    layoutTpl = getCompiledLayout();
+
+  if ( (this->referencesValid) && (this->referencesTemplate == tpl) && (this->referencesLayout == layoutTpl) )
+    return this->references;
+
+  References refs;
+  std::set<std::string> visited;
+  collectReferences(refs, *tpl, visited);
+  if (layoutTpl)
+    {
+      refs.layout = Silicon::layoutName;
+      collectReferences(refs, *layoutTpl, visited);
+      /* Layout contents come from the template */
+      refs.keywords.erase(Silicon::contentsKeyword);
+    }
+
+  this->references = std::move(refs);
+  this->referencesTemplate = tpl;
+  this->referencesLayout = layoutTpl;
+  this->referencesValid = true;
 
-  setKeyword(Silicon::contentsKeyword, tplt);
-  tplt.clear();
-  _parse(tplt, Silicon::layoutData);
-  return tplt;
+  return this->references;
 }
 
-Silicon::Silicon(Silicon && sil)
+void Silicon::collectReferences(Silicon::References& refs, const SiliconTemplate& tpl, std::set<std::string>& visited)
 {
-  this->_data = sil._data;
-  sil._data=NULL;
+  const std::vector<SiliconTemplate::Node>& nodes = tpl.nodes();
+  /* Collections whose body we are in: [var, end of body) */
+  std::vector<std::pair<std::string, std::size_t> > loops;
+
+  auto addKeyword = [&](const std::string& kw)
+    {
+      /* Set by the block function */
+      if (kw.compare(0, 6, "block.") == 0)
+	return;
+
+      for (auto& l : loops)
+	{
+	  if ( (kw.size() > l.first.size()) && (kw[l.first.size()] == '.') && (kw.compare(0, l.first.size(), l.first) == 0) )
+	    {
+	      std::string field = kw.substr(l.first.size()+1);
+	      /* _lineNumber, _even... are set while looping */
+	      if (field[0] != '_')
+		refs.collections[l.first].insert(field);
+	      return;
+	    }
+	}
+
+      refs.keywords.insert(kw);
+    };
+
+  for (std::size_t i=0; i<nodes.size(); ++i)
+    {
+      while ( (!loops.empty()) && (i >= loops.back().second) )
+	loops.pop_back();
+
+      const SiliconTemplate::Node& node = nodes[i];
+      switch (node.type)
+	{
+	case SiliconTemplate::Node::KEYWORD:
+	  addKeyword(node.name);
+	  break;
+	case SiliconTemplate::Node::FUNCTION:
+	  {
+	    refs.functions.insert(node.name);
+	    if (node.name != "block")
+	      break;
+
+	    auto tplt = node.arguments.find("template");
+	    if ( (tplt == node.arguments.end()) || (!visited.insert(tplt->second).second) )
+	      break;
+
+	    refs.blocks.insert(tplt->second);
+	    std::shared_ptr<const SiliconTemplate> block = getBlock(tplt->second);
+	    collectReferences(refs, *block, visited);
+	  }
+	  break;
+	case SiliconTemplate::Node::IF:
+	  {
+	    refs.builtins.insert("if");
+	    std::vector<std::string> kwds;
+	    for (auto& x : node.values)
+	      conditionKeywords(x, kwds);
+	    for (auto& k : kwds)
+	      addKeyword(k);
+	  }
+	  break;
+	case SiliconTemplate::Node::IFFUN:
+	  refs.builtins.insert("iffun");
+	  break;
+	case SiliconTemplate::Node::COLLECTION:
+	  refs.builtins.insert("collection");
+	  refs.collections[node.name];
+	  loops.push_back({ node.name, node.end });
+	  break;
+	default:
+	  break;
+	}
+    }
 }
 
-std::string Silicon::parse(std::string templ)
+void Silicon::locate(const char* data, const char* ptr, long &line, long &pos)
 {
-  std::string out;
-  _parse(out, (char*)templ.c_str(), true, "", 0);
-  return out;
+  line = 0;
+  pos = 0;
+  if ( (data == NULL) || (ptr == NULL) || (ptr < data) )
+    return;
+
+  const char* lineStart = data;
+  const char* nl;
+  line = 1;
+  while ( (nl = (const char*) memchr(lineStart, '\n', ptr-lineStart)) != NULL )
+    {
+      ++line;
+      lineStart = nl+1;
+    }
+  pos = ptr-lineStart+1;
 }
 
-long Silicon::_parse(std :: string & destination, char * strptr, bool write, std::string nested, int level)
+const char* Silicon::compile(SiliconTemplate& tpl, const char* strptr, const char* nested, int level)
 {
-  bool end = false;
-  std::string temp;
-  std::string tempData;
-  StringMap tempArgs; /* Arguments*/
-  char *current = strptr;
+  const char* data = tpl.source().c_str();
+  TempString temp;
+  TempStringMap tempArgs; /* Arguments*/
+  const char* current = strptr;
+  std::size_t scope = tpl.nodes().size(); /* First node of this body */
   long moved;
   bool autoClosed;
   int type;
   bool special = false;		/* We have just performed a special action (keyword/function/...} */
 
-  if (!nested.empty())		/* Eat extra returns in the beginning of the nested body */
+  if (nested)			/* Eat extra returns in the beginning of the nested body */
     while (*strptr=='\n')
-      ahead(&strptr); 
+      ahead(&strptr);
 
-  while ( (*strptr!='\0') && (!end) )
+  while (*strptr!='\0')
     {
       if (*strptr == '\\')	/* Escape! */
 	{
-	  std::string concat;
-	  if (strptr[1] == '\\')
-	    concat='\\';	/* Two \ found in text results 1 */
-	  else if (strptr[1] == '{')
-	    concat='{';
-	  else if (write)
-	    destination+='\\';	/* adds character to destination */
-	  if (!concat.empty())
-	    {
-	      if (write)
-		destination+=concat;
-	      ahead(&strptr);	/* read one more char*/
-	    }
+	  /* Two \ found in text results 1. \{ results { */
+	  if ( (strptr[1] == '\\') || (strptr[1] == '{') )
+	    ahead(&strptr);	/* read one more char*/
+
+	  tpl.addText(strptr-data, 1, scope);
 	}
       else if (*strptr == '{')	// } : put this symbol to make member functions work
 	{
+	  const char* tagStart = strptr;
+	  tagPosition = tagStart;
 	  if ( (moved=parseKeyword(strptr, temp)) >0 )
 	    {
-	      if (write)
-		destination+=putKeyword(temp);
+	      std::size_t index = tpl.add(SiliconTemplate::Node::KEYWORD, tagStart-data, moved+1);
+	      SiliconTemplate::Node& node = tpl.node(index);
+	      /* keyword|filter */
+	      std::size_t len = temp.size();
+	      auto bar = temp.rfind('|');
+	      if ( (bar != TempString::npos) && (SiliconEscape::fromName(temp.data()+bar+1, len-bar-1, node.escape)) )
+		{
+		  node.filtered = true;
+		  len = bar;
+		}
+	      else
+		node.escape = tpl.context();
+	      node.name.assign(temp.data(), len);
 	      strptr+=moved;
 	      special = true;
 	    }
 	  else if ( (moved=parseFunction(strptr, type, temp, tempArgs, autoClosed)) >0 )
 	    {
-	      tempData.clear();
-	      /* std::cout << temp << " is a function with arguments."<<std::endl; */
-	      /* for (auto x : tempArgs) */
-	      /* 	{ */
-	      /* 	  std::cout << "   - "<<x.first<<" = *"<<x.second<<"*"<<std::endl; */
-	      /* 	} */
 	      strptr+=moved;
 	      if (type == 0)	/* User function*/
 		{
+		  std::size_t index = tpl.add(SiliconTemplate::Node::FUNCTION, tagStart-data, strptr-tagStart+1);
+		  SiliconTemplate::Node& node = tpl.node(index);
+		  node.name = toString(temp);
+		  node.arguments = toStringMap(tempArgs);
+		  node.body = !autoClosed;
 		  if (!autoClosed)
 		    {
 		      ahead(&strptr);
-		      moved = _parse(tempData, strptr, write, temp, level+1);
-		      strptr+=moved;
-		    }
-		  if (write)
-		    {
-		      auto f = getFunction(temp);
-		      destination+=f(this, tempArgs, tempData);
+		      strptr = compile(tpl, strptr, temp.c_str(), level+1);
 		    }
+		  tpl.close(index);
 		}
 	      else if (type == 1) /* Builtin methods*/
-		{
-		  if ( (moved=computeBuiltin(strptr, destination, temp, tempArgs, autoClosed, write, level)) >0 )
-		    {
-		      strptr+=moved;
-		    }
-		}
+		strptr = compileBuiltin(tpl, tagStart, strptr, temp, tempArgs, autoClosed, level);
 	      else
-		throw SiliconException(9, "Not implemented function type "+std::to_string(type)+" for function "+temp+".", getCurrentLine(), getCurrentPos());
+		throw SiliconException(9, "Not implemented function type "+std::to_string(type)+" for function "+toString(temp)+".", getCurrentLine(), getCurrentPos());
 	      special = true;
 	    }
-	  else if ( (!nested.empty()) && ( (moved=parseCloseNested(strptr, nested)) >0) )
+	  else if ( (nested) && ( (moved=parseCloseNested(strptr, nested)) >0) )
 	    {
-	      strptr+=moved;
-	      return strptr-current+1;
-	      special = true;
+	      return strptr+moved;
 	    }
 	  else
-	    {
-	      if (write)
-		destination+='{';	/* Put this in the resulting string*/
-	    }
+	    tpl.addText(strptr-data, 1, scope); /* Put this in the resulting string*/
 	  /* Maybe a keyword or sth. */
 	}
       else if ( (*strptr == '\n') && (special) )
 	{
 	  /* Eat the \n !! */
 	}
-      else if (write)
+      else
 	{
-	  destination+=*strptr;
+	  tpl.addText(strptr-data, 1, scope);
 	  special = false;
 	}
       ahead(&strptr);
     }
 
   if (level)
-    throw SiliconException(7, "Didn't close nested action "+nested+". "+std::to_string(level)+" levels left.", getCurrentLine(), getCurrentPos());
+    {
+      tagPosition = current;	/* Where the nested body starts */
+      throw SiliconException(7, "Didn't close nested action "+std::string((nested)?nested:"")+". "+std::to_string(level)+" levels left.", getCurrentLine(), getCurrentPos());
+    }
 
-  return strptr-current+1;
+  return strptr;
 }
 
-long Silicon::parseKeyword(char * strptr, std :: string & keyword)
+long Silicon::parseKeyword(const char * strptr, TempString & keyword)
 {
   if ( (strptr[1] != '{') || (strptr[2] == '\0') )
     return 0;			/* Not a keyword */
 
-  char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
+  const char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
 
   #if SILICON_DEBUG
   /* std::cout <<"KW: "<<strptr<<std::endl; */
@@ -746,13 +2429,15 @@ long Silicon::parseKeyword(char * strptr, std :: string & keyword)
   keyword.clear();
 
   ahead(&cursor, 2);
+  const char* start = cursor;
 
   while (*cursor!='\0')
     {
       if ( (*cursor=='}') && (cursor[1]=='}') )
-      	return cursor-strptr+1;
-      else
-	keyword+=*cursor;
+	{
+	  keyword.assign(start, cursor-start);
+	  return cursor-strptr+1;
+	}
       ahead(&cursor);
     }
 
@@ -760,7 +2445,7 @@ long Silicon::parseKeyword(char * strptr, std :: string & keyword)
   throw SiliconException(1, "Unterminated keyword string", getCurrentLine(), getCurrentPos());
 }
 
-long Silicon::parseFunction(char* strptr, int &type, std::string& fname, Silicon::StringMap &arguments, bool &autoClosed)
+long Silicon::parseFunction(const char* strptr, int &type, TempString& fname, Silicon::TempStringMap &arguments, bool &autoClosed)
 {
   type = -1;
   if (strptr[1] == '!')
@@ -771,10 +2456,10 @@ long Silicon::parseFunction(char* strptr, int &type, std::string& fname, Silicon
   if ( (type ==-1) || (strptr[2] == '\0') )
     return 0;			/* Not a Function */
   
-  char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
+  const char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
 
-  std::string temp;				/* Temporary string*/
-  std::string key;				/* Current key */
+  TempString temp;				/* Temporary string*/
+  TempString key;				/* Current key */
   int autoKey = 0;				/* Autokey to use when there's no key */
   int status = 0;				/* 0 - filling function name, 1 - filling param. key, 2 - filling param. value */
   bool enclosed = false;
@@ -837,31 +2522,30 @@ long Silicon::parseFunction(char* strptr, int &type, std::string& fname, Silicon
   return cursor-strptr+1;
 }
 
-long Silicon::parseCloseNested(char* strptr, std::string closeName)
+long Silicon::parseCloseNested(const char* strptr, const char* closeName)
 {
   if ( (strptr[1] != '/') || (strptr[2] == '\0') )
     return 0;			/* Not a close nested */
 
-  char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
-  std::string temp;
+  const char* cursor = strptr;			/* Ahead two chars, just the { and read next*/
 
   #if SILICON_DEBUG
   /* std::cout <<"CLOSE: "<<strptr<<std::endl; */
   #endif
 
   ahead(&cursor, 2);
+  const char* start = cursor;
 
   while (*cursor!='\0')
     {
       if ( (*cursor=='}') && (cursor[1]=='}') )
 	{
-	  if (temp != closeName)
+	  std::size_t len = cursor-start;
+	  if ( (len != strlen(closeName)) || (strncmp(start, closeName, len)!=0) )
 	    throw SiliconException(6, "Unmatching close string", getCurrentLine(), getCurrentPos());
 
 	  return cursor-strptr+1;
 	}
-      else
-	temp+=*cursor;
 
       ahead(&cursor);
     }
@@ -870,44 +2554,95 @@ long Silicon::parseCloseNested(char* strptr, std::string closeName)
   throw SiliconException(5, "Unterminated keyword close string", getCurrentLine(), getCurrentPos());
 }
 
-Silicon::TemplateFunction Silicon::getFunction(std::string fun)
+const Silicon::TemplateFunction& Silicon::getFunction(const std::string& fun, uint32_t hash)
 {
-  auto f = localFunctions.find(fun);
+  auto f = localFunctions.find(fun.data(), fun.size(), hash);
   if (f != localFunctions.end())
     return f->second;
 
-  f = globalFunctions.find(fun);
+  const TemplateFunction* base = layerFind(&Layer::functions, fun.data(), fun.size(), hash);
+  if (base)
+    return *base;
+
+  f = globalFunctions.find(fun.data(), fun.size(), hash);
   if (f != globalFunctions.end())
     return f->second;
 
   throw SiliconException(8, "Undefined funtion "+fun+".", getCurrentLine(), getCurrentPos());
 }
 
-long Silicon::computeBuiltin(char* strptr, std::string &destination, std::string bif, Silicon::StringMap &arguments, bool &autoClosed, bool write, int level)
+void Silicon::callFunction(std::string& destination, const Silicon::TemplateFunction& f, const Silicon::StringMap& arguments, std::string&& body)
+{
+  /* Functions may render templates, calling other functions */
+  struct Guard
+  {
+    Silicon* s;
+    const std::string* previous;
+    ~Guard()
+    {
+      s->functionDestination = previous;
+    }
+  } guard = { this, this->functionDestination };
+  this->functionDestination = &destination;
+  destination+=f(this, arguments, std::move(body));
+}
+
+const char* Silicon::compileBuiltin(SiliconTemplate& tpl, const char* tagStart, const char* strptr, const TempString& bif, Silicon::TempStringMap &arguments, bool autoClosed, int level)
 {
   if ( (autoClosed) && ( (bif == "if") || (bif == "while") || (bif == "for" ) || (bif == "collection") ) )
-    throw SiliconException(10, "Builtin "+bif+" can't be autoclosed", getCurrentLine(), getCurrentPos());
+    throw SiliconException(10, "Builtin "+toString(bif)+" can't be autoclosed", getCurrentLine(), getCurrentPos());
 
+  const char* data = tpl.source().c_str();
+  std::size_t index;
+  const char* closeName;
   if (bif == "if")
-    return computeBuiltinIf(strptr, destination, arguments, write, level);
+    {
+      index = tpl.add(SiliconTemplate::Node::IF, tagStart-data, strptr-tagStart+1);
+      for (auto& x : arguments)
+	tpl.node(index).values.push_back(toString(x.second));
+      closeName = "if";
+    }
   else if (bif == "collection")
-    return computeBuiltinCollection(strptr, destination, arguments, write, level);
+    {
+      arguments = this->separateArguments(arguments);
+      auto _var = arguments.find("var");
+
+      if (_var == arguments.end())
+	throw SiliconException(21, "Collection not specified", getCurrentLine(), getCurrentPos());
+
+      index = tpl.add(SiliconTemplate::Node::COLLECTION, tagStart-data, strptr-tagStart+1);
+      SiliconTemplate::Node& node = tpl.node(index);
+      node.name = getArgValue(_var->second);
+      auto _loops = arguments.find("loops");
+      if (_loops != arguments.end())
+	node.arguments.insert({ "loops", toString(_loops->second) });
+      closeName = "collection";
+    }
   else if (bif == "iffun")
-    return computeBuiltinIffun(strptr, destination, arguments, write, level);
+    {
+      index = tpl.add(SiliconTemplate::Node::IFFUN, tagStart-data, strptr-tagStart+1);
+      for (auto& x : arguments)
+	tpl.node(index).values.push_back(toString(x.second));
+      closeName = "iffun";
+    }
   else
-    throw SiliconException(11, "Builtin function "+bif+" not implemented", getCurrentLine(), getCurrentPos());
+    throw SiliconException(11, "Builtin function "+toString(bif)+" not implemented", getCurrentLine(), getCurrentPos());
 
-  return 0;
+  ahead(&strptr);
+  strptr = compile(tpl, strptr, closeName, level+1);
+  tpl.close(index);
+
+  return strptr;
 }
 
-Silicon::StringMap Silicon::separateArguments(Silicon::StringMap &arguments)
+Silicon::TempStringMap Silicon::separateArguments(Silicon::TempStringMap &arguments)
 {
-  StringMap tmp;
+  TempStringMap tmp;
 
-  for (auto j : arguments)
+  for (auto& j : arguments)
     {
-      auto op = j.second.find("=");
-      if (op != std::string::npos)
+      auto op = j.second.find('=');
+      if (op != TempString::npos)
       	{
 	  tmp.insert({j.second.substr(0, op), j.second.substr(op+1)});
       	}
@@ -919,173 +2654,287 @@ Silicon::StringMap Silicon::separateArguments(Silicon::StringMap &arguments)
   return tmp;
 }
 
-long Silicon::getNumericArgument(Silicon::StringMap &args, std::string argument, long defaultVal, bool required)
+long Silicon::getNumericArgument(const Silicon::StringMap &args, const char* argument, long defaultVal, bool required)
 {
   auto _arg = args.find(argument);
   if (_arg==args.end())
     {
       if (required)
-	throw SiliconException(23, "Required argument "+argument+" not found", getCurrentLine(), getCurrentPos());
+	throw SiliconException(23, "Required argument "+std::string(argument)+" not found", getCurrentLine(), getCurrentPos());
       else
 	return defaultVal;
     }
 
-  try
+  long long res;
+  short numeric = toLongLong(_arg->second.c_str(), _arg->second.length(), res);
+  if (numeric == -1)
+    throw SiliconException(25, "Argument "+std::string(argument)+" MUST be numeric", getCurrentLine(), getCurrentPos());
+  else if (numeric == 0)	/* Everything is not a number*/
+    throw SiliconException(24, "Argument "+std::string(argument)+" MUST be numeric", getCurrentLine(), getCurrentPos());
+
+  return res;
+}
+
+void Silicon::evaluate(std::string& destination, const SiliconTemplate& tpl, std::size_t first, std::size_t last)
+{
+  const char* data = tpl.source().c_str();
+  const std::vector<SiliconTemplate::Node>& nodes = tpl.nodes();
+
+  for (std::size_t i=first; i<last; i=nodes[i].end)
     {
-      std::string::size_type sz = 0;
-      long res = std::stoll(_arg->second, &sz);
-      if (sz != _arg->second.length())	/* Everything is not a number*/
-	throw SiliconException(24, "Argument "+argument+" MUST be numeric", getCurrentLine(), getCurrentPos());
+      /* renderTo(): the sink gets what we have */
+      if ( (outputStream) && (&destination == outputStream->buffer) && (destination.size() >= outputStream->chunk) )
+	outputStream->drain();
+
+      const SiliconTemplate::Node& node = nodes[i];
+      if (node.type == SiliconTemplate::Node::TEXT)
+	{
+	  if ( (spanRecorder) && (&destination == spanRecorder->buffer) && (node.len >= minLiteralSpan) )
+	    spanRecorder->literal(data+node.pos, node.len);
+	  else
+	    destination.append(data+node.pos, node.len);
+	  continue;
+	}
 
-      return res;
+      tagPosition = data+node.pos;
+      switch (node.type)
+	{
+	case SiliconTemplate::Node::KEYWORD:
+	  putKeyword(destination, tpl, node);
+	  break;
+	case SiliconTemplate::Node::FUNCTION:
+	  {
+	    std::string tempData;
+	    if (node.body)
+	      evaluate(tempData, tpl, i+1, node.end);
+	    tagPosition = data+node.pos;
+	    callFunction(destination, getFunction(node.name, node.hash), node.arguments, std::move(tempData));
+	  }
+	  break;
+	case SiliconTemplate::Node::IF:
+	  {
+	    bool logicResult=false;
+	    /* Test OR, AND... later. Now, the last condition wins */
+	    for (auto& x : node.values)
+	      logicResult = evaluateCondition(TempString(x.data(), x.size()));
+	    if (logicResult)
+	      evaluate(destination, tpl, i+1, node.end);
+	  }
+	  break;
+	case SiliconTemplate::Node::IFFUN:
+	  if (evaluateIffun(node.values))
+	    evaluate(destination, tpl, i+1, node.end);
+	  break;
+	case SiliconTemplate::Node::COLLECTION:
+	  evaluateCollection(destination, tpl, i);
+	  break;
+	default:
+	  break;
+	}
     }
-  catch (const std::invalid_argument &inv)
+}
+
+bool Silicon::evaluateIffun(const std::vector<std::string>& functions)
+{
+  /* Analize more arguments, do more things... later */
+  for (auto& x : functions)
     {
-      throw SiliconException(25, "Argument "+argument+" MUST be numeric", getCurrentLine(), getCurrentPos());
+      if ( (localFunctions.find(x) != localFunctions.end()) || (globalFunctions.find(x) != globalFunctions.end()) )
+	return true;
+      if (layerFind(&Layer::functions, x))
+	return true;
     }
+
+  return false;
 }
 
-long Silicon::computeBuiltinCollection(char* strptr, std::string &destination, Silicon::StringMap &arguments, bool write, int level)
+void Silicon::evaluateCollection(std::string& destination, const SiliconTemplate& tpl, std::size_t index)
 {
-  arguments =this->separateArguments(arguments);
-  auto _var = arguments.find("var");
-
-  if (_var == arguments.end())
-    throw SiliconException(21, "Collection not specified", getCurrentLine(), getCurrentPos());
+  const SiliconTemplate::Node& node = tpl.nodes()[index];
+  loopCollection(node.name, node.arguments, [&]()
+		 {
+		   evaluate(destination, tpl, index+1, node.end);
+		 }, &node.path);
+}
 
-  std::string collectionVar = getArgValue(_var->second);
+template <typename F>
+void Silicon::loopCollection(const std::string& collectionVar, const Silicon::StringMap& arguments, F body, const SiliconValue::Path* path)
+{
+  CollectionLoop loop(*this, collectionVar, arguments, path);
+  SiliconArena& arena = SiliconArena::local();
+  while (loop.next())
+    {
+      /* Nothing allocated while rendering one iteration survives it */
+      SiliconArena::Mark mark = arena.mark();
+      body();
+      arena.rewind(mark);
+    }
+}
 
-  auto coll = localCollections.find(collectionVar);
-  if (coll == localCollections.end())
-    throw SiliconException(22, "Collection "+collectionVar+" not found", getCurrentLine(), getCurrentPos());
+Silicon::CollectionLoop::CollectionLoop(Silicon& s, const std::string& collectionVar, const Silicon::StringMap& arguments, const SiliconValue::Path* path):
+  s(s), rows(NULL), source(NULL), haveNext(false), array(NULL), scope(0), row(0), line(0)
+{
+  if (s.dependencies)
+    s.dependencies->push_back({ true, collectionVar, s.collectionVersion(collectionVar) });
 
-  long n = 0;
-  long line = 0;
-  long totalLines = coll->second.size();
+  long totalLines;
+  auto src = s.collectionSources.find(collectionVar);
+  if (src != s.collectionSources.end())
+    {
+      source = &src->second.source;
+      totalLines = src->second.totalLines;
+      rows = &batch;
+    }
+  else if ( (rows = s.findCollection(collectionVar)) != NULL)
+    totalLines = rows->size();
+  else
+    {
+      /* Array of values */
+      if (!path)
+	{
+	  ownPath = SiliconValue::parsePath(collectionVar);
+	  path = &ownPath;
+	}
+      array = s.findValue(*path);
+      /* Value without type is an empty array */
+      if ( (!array) || ( (array->type() != SiliconValue::ARRAY) && (array->type() != SiliconValue::NONE) ) )
+	throw SiliconException(22, "Collection "+collectionVar+" not found", s.getCurrentLine(), s.getCurrentPos());
+      totalLines = array->size();
+    }
 
-  long iterations = getNumericArgument(arguments, "loops", totalLines);
-  if (iterations>totalLines)
+  iterations = s.getNumericArgument(arguments, "loops", totalLines);
+  if ( (totalLines>=0) && (iterations>totalLines) )
     iterations = totalLines;
 
-  /* if (_iterations == arguments.end()) */
-  /*   iterations = totalLines; */
-  ahead(&strptr);
-  this->setKeyword(collectionVar+"._totalLines", std::to_string(totalLines));
-  this->setKeyword(collectionVar+"._totalIterations", std::to_string(iterations));
+  /* Keywords updated in every iteration */
+  prefix = collectionVar+".";
+  kwLast = prefix+"_last";
+  kwEven = prefix+"_even";
+  kwLineNumber = prefix+"_lineNumber";
 
-  if (coll->second.size()==0)
+  if (totalLines>=0)
     {
-      std::string dummy;
-    /* Parse but without output */
-      n=_parse(dummy, strptr, write, "collection", level+1);
+      s.setKeyword(prefix+"_totalLines", std::to_string(totalLines));
+      s.setKeyword(prefix+"_totalIterations", std::to_string(iterations));
     }
   else
-    for (auto i : coll->second)
-      {
-	if (line == iterations)
-	  break;
-	else
-	  this->setKeyword(collectionVar+"._last", (line == iterations-1)?"1":"0");
-
-	this->setKeyword(collectionVar+"._even", (line%2==0)?"1":"0");
-
-	this->setKeyword(collectionVar+"._lineNumber", std::to_string(line));
-	for (auto z : i)
-	  {
-	    /* Meter mas variables como el numero de linea,
-	       El total de lineas, si la linea es la última o no.
-	       Si la línea es par o impar
-	       Verificar que %if "0" funciona... */
-	    this->setKeyword(collectionVar+"."+z.first, z.second);
-	  }
-	if (line>0)
-	  stopStatsUpdate();
+    {
+      /* Not known: don't leave the ones of a previous loop */
+      s.delKeyword(prefix+"_totalLines");
+      s.delKeyword(prefix+"_totalIterations");
+    }
+  s.loopPrefixes.push_back(&prefix);
+  if (array)
+    {
+      /* Found from here, elements are set by next() */
+      scope = s.valueScopes.size();
+      s.valueScopes.push_back({ path, NULL });
+    }
+}
 
-	n = _parse(destination, strptr, write, "collection", level+1);
+Silicon::CollectionLoop::~CollectionLoop()
+{
+  s.loopPrefixes.pop_back();
+  if (array)
+    s.valueScopes.pop_back();
+}
 
-	++line;
-      }
+bool Silicon::CollectionLoop::fetch(std::vector<Silicon::StringMap>& into)
+{
+  into.clear();
+  (*source)(into);
 
-  return n;
+  return !into.empty();
 }
 
-long Silicon::computeBuiltinIf(char* strptr, std::string &destination, Silicon::StringMap &arguments, bool write, int level)
+bool Silicon::CollectionLoop::next()
 {
-  bool logicResult=false;
-  int n = 0;
+  if (line == iterations)
+    return false;
 
-  if (write)
-    {				/* Evaluate expression if write is enabled */
-      for (auto x : arguments)
+  if (source)
+    {
+      if (row >= batch.size())
 	{
-	  if (n)
-	    {
-	      /* Test OR, AND... */
-	    }
-
-	  bool currentCond = evaluateCondition(x.second);
-	  if (!n)
-	    logicResult = currentCond;
+	  if (haveNext)
+	    batch.swap(nextBatch);
+	  else if (!fetch(batch))
+	    return false;
+
+	  haveNext = false;
+	  row = 0;
+	  if (batch.empty())
+	    return false;
 	}
     }
-  ahead(&strptr);
-  return _parse(destination, strptr, logicResult, "if", level+1);
-}
+  else if (array)
+    {
+      if (line >= (long) array->size())
+	return false;
+      row = line;
+    }
+  /* Rows may be added while rendering, don't keep iterators */
+  else if (line >= (long) rows->size())
+    return false;
+  else
+    row = line;
 
-long Silicon::computeBuiltinIffun(char* strptr, std::string &destination, Silicon::StringMap &arguments, bool write, int level)
-{
-  bool logicResult=false;
-  if (write)
+  bool last = (line == iterations-1);
+  /* Without size, the next batch tells if this row is the last one */
+  if ( (!last) && (source) && (row == batch.size()-1) )
+    {
+      haveNext = true;
+      last = !fetch(nextBatch);
+    }
+
+  s.updateKeyword(kwLast, (last)?"1":"0");
+  s.updateKeyword(kwEven, (line%2==0)?"1":"0");
+  s.updateKeyword(kwLineNumber, std::to_string(line));
+  if (array)
+    s.valueScopes[scope].element = array->at(row);
+  else
     {
-      /* Analize more arguments, do more things... later */
-      for (auto x : arguments)
+      for (auto& z : (*rows)[row])
 	{
-	  auto isfun = localFunctions.find(x.second);
-	  if (isfun != localFunctions.end())
-	    {
-	      logicResult=true;
-	      continue;
-	    }
-	  else
-	    {
-	      isfun = globalFunctions.find(x.second);
-	      if (isfun != globalFunctions.end())
-		{
-		  logicResult=true;
-		  continue;
-		}
-	    }
+	  kwField.assign(prefix).append(z.first);
+	  s.updateKeyword(kwField, z.second);
 	}
     }
-  ahead(&strptr);
-  return _parse(destination, strptr, logicResult, "iffun", level+1);
+  ++line;
+  ++row;
+
+  return true;
 }
 
-bool Silicon::evaluateCondition(std::string condition)
+bool Silicon::evaluateCondition(const TempString& condition)
 {
+  static const std::string emptyString;
+  std::size_t start = 0;	/* Condition starts here (after the negation) */
   auto op = condition.find_first_of("!<>=");
   bool invert = false;
   if ( (op==0) && (condition[op]=='!') )
     {
       invert = true;		/* Negate */
-      condition = condition.substr(1);
-      op = condition.find_first_of("!<>=");
+      start = 1;
+      op = condition.find_first_of("!<>=", start);
     }
 
-  if (op == std::string::npos)
+  if (op == TempString::npos)
     {				/* No operator*/
       /* Numeric statement */
-      if (condition.empty())
+      const char* cond = condition.c_str()+start;
+      std::size_t len = condition.length()-start;
+      if (len==0)
 	throw SiliconException(26, "Empty condion", getCurrentLine(), getCurrentPos());
-      else if (std::all_of(condition.begin(), condition.end(), ::isdigit))
-	return (std::stoi(condition));
+      else if (std::all_of(cond, cond+len, ::isdigit))
+	return (strtol(cond, NULL, 10));
       else
 	{
-	  std::string kw = getKeyword(condition);
-	  if (kw.empty())
+	  const std::string* kw = findKeyword(cond, len);
+	  if ( (kw==NULL) || (kw->empty()) )
 	      return invert;	/* false if inversion is off, otherwise, true */
-	  else if (std::all_of(kw.begin(), kw.end(), ::isdigit))
-	    return  ( (std::stoi(kw))!=0)^invert; /* if (stoi(kw))==true : !invert (true if not inverted)
+	  else if (std::all_of(kw->begin(), kw->end(), ::isdigit))
+	    return  ( (strtol(kw->c_str(), NULL, 10))!=0)^invert; /* if (stoi(kw))==true : !invert (true if not inverted)
 					       if (stoi(kw))==false: invert (false if not inverted) */
 
 	  return (!invert); 
@@ -1096,9 +2945,10 @@ bool Silicon::evaluateCondition(std::string condition)
     }
   else
     {
-      std::string a = getKeyword(condition.substr(0, op));
-      std::string b;
-      std::string _op = getOperator(condition, op, b);
+      const std::string* _a = findKeyword(condition.data()+start, op-start);
+      const std::string& a = (_a)?*_a:emptyString;
+      TempString b;
+      TempString _op = getOperator(condition, op, b);
 
       if (b.empty())
 	throw SiliconException(13, "Right value can't be empty", getCurrentLine(), getCurrentPos());
@@ -1114,73 +2964,60 @@ bool Silicon::evaluateCondition(std::string condition)
 	}
       else
 	{
-	  std::string b_;
-	  if (getKeyword(b, b_))
-	    b=b_;
+	  const std::string* b_ = findKeyword(b.data(), b.size());
+	  if (b_)
+	    b.assign(b_->data(), b_->size());
 	  /* Gets long long or long double... */
 	  numeric = conditionNumericAB(a, b, lla, llb);
 	  if (!numeric)
 	    numeric = conditionDoubleAB(a, b, lda, ldb);
 	}
 
-      OpController* opc;
+      bool res;
       if (numeric == 0)
-	opc = new OpController(a, b, std::bind(&Silicon::conditionStringOperator, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+	{
+	  TempString ta(a.data(), a.size());
+	  res = Operate<TempString>(ta, b, [this] (const TempString& op, const TempString& a, const TempString& b) {
+	      return this->conditionStringOperator(toString(op), toString(a), toString(b));
+	    }).apply(_op);
+	}
       else if (numeric == 1)
-      	opc = new OpController(lla, llb, std::bind(&Silicon::conditionLongOperator, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+	res = Operate<long long>(lla, llb, [this] (const TempString& op, const long long& a, const long long& b) {
+	    return this->conditionLongOperator(toString(op), a, b);
+	  }).apply(_op);
       else if (numeric == 2)
-      	opc = new OpController(lda, ldb, std::bind(&Silicon::conditionDoubleOperator, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+	res = Operate<long double>(lda, ldb, [this] (const TempString& op, const long double& a, const long double& b) {
+	    return this->conditionDoubleOperator(toString(op), a, b);
+	  }).apply(_op);
       else
 	throw SiliconException(14, "Numeric type "+std::to_string(numeric)+" not implemented.", getCurrentLine(), getCurrentPos());
 
-      bool res = opc->apply(_op);
-      delete opc;
       return res^invert;
     }
 
   return 0;
 }
 
-short Silicon::conditionNumericAB(std::string a, std::string b, long long &lla, long long &llb)
+short Silicon::conditionNumericAB(const std::string& a, const TempString& b, long long &lla, long long &llb)
 {
-  try
-    {
-      std::string::size_type sz = 0;
-      lla = std::stoll(a, &sz);
-      if (sz != a.length())	/* Everything is not a number*/
-	return 0;
+  if (toLongLong(a.c_str(), a.length(), lla) != 1)
+    return 0;			/* Everything is not a number*/
 
-      llb = std::stoll(b, &sz);
-      if (sz != b.length())
-	return 0;
+  if (toLongLong(b.c_str(), b.length(), llb) != 1)
+    return 0;
 
-      return 1;
-    }
-  catch (const std::invalid_argument &inv)
-    {
-      return 0;
-    }
+  return 1;
 }
 
-short Silicon::conditionDoubleAB(std::string a, std::string b, long double &lda, long double &ldb)
+short Silicon::conditionDoubleAB(const std::string& a, const TempString& b, long double &lda, long double &ldb)
 {
-  try
-    {
-      std::string::size_type sz =0;
+  if (toLongDouble(a.c_str(), a.length(), lda) != 1)
+    return 0;			/* Everything is not a number*/
 
-      lda = std::stold(a, &sz);
-      if (sz != a.length())	/* Everything is not a number*/
-	return 0;
+  if (toLongDouble(b.c_str(), b.length(), ldb) != 1)
+    return 0;
 
-      ldb = std::stold(b, &sz);
-      if (sz != b.length())	/* Everything is not a number*/
-	return 0;
-      return 2;
-    }
-  catch (const std::invalid_argument &inv)
-    {
-      return 0;
-    }
+  return 2;
 }
 
 /* Operators:
@@ -1194,10 +3031,10 @@ short Silicon::conditionDoubleAB(std::string a, std::string b, long double &lda,
     <=
     !i=! (case insensitive equals)
  */
-std::string Silicon::getOperator(std::string condition, size_t pos, std::string &b)
+Silicon::TempString Silicon::getOperator(const TempString& condition, size_t pos, TempString &b)
 {
   long oplen=-1;
-  std::string op;
+  TempString op;
 
   if (condition[pos]=='!')
     {
@@ -1235,7 +3072,7 @@ std::string Silicon::getOperator(std::string condition, size_t pos, std::string
       op = (condition[pos+1]=='=')?">=":">";
     }
   if (op.empty())
-    throw SiliconException(12, "Unknown operator used in "+condition, getCurrentLine(), getCurrentPos());
+    throw SiliconException(12, "Unknown operator used in "+toString(condition), getCurrentLine(), getCurrentPos());
 
   if (oplen==-1)
     {
@@ -1252,6 +3089,10 @@ bool Silicon::conditionStringOperator(std::string op, std::string a, std::string
   if (f != this->localConditionStringOperators.end())
     return f->second(this, a, b);
 
+  const StringOperator* base = layerFind(&Layer::stringOperators, op);
+  if (base)
+    return (*base)(this, a, b);
+
   throw SiliconException(17, "Invalid condition operator "+op+" for string", getCurrentLine(), getCurrentPos());
 }
 
@@ -1261,6 +3102,10 @@ bool Silicon::conditionDoubleOperator(std::string op, long double a, long double
   if (f != this->localConditionDoubleOperators.end())
     return f->second(this, a, b);
 
+  const DoubleOperator* base = layerFind(&Layer::doubleOperators, op);
+  if (base)
+    return (*base)(this, a, b);
+
   throw SiliconException(15, "Invalid condition operator "+op+" for double", getCurrentLine(), getCurrentPos());
 }
 
@@ -1270,15 +3115,19 @@ bool Silicon::conditionLongOperator(std::string op, long long a, long long b)
   if (f != this->localConditionLongOperators.end())
     return f->second(this, a, b);
 
+  const LongOperator* base = layerFind(&Layer::longOperators, op);
+  if (base)
+    return (*base)(this, a, b);
+
   throw SiliconException(16, "Invalid condition operator "+op+" for long", getCurrentLine(), getCurrentPos());
 }
 
-std::string Silicon::getArgValue(std::string original)
+std::string Silicon::getArgValue(const TempString& original)
 {
-  if ( (original.front()=='"') && (original.back()=='"') && (original.size()>1) )
-    return original.substr(1, original.size()-2);
+  if ( (original.size()>1) && (original.front()=='"') && (original.back()=='"') )
+    return std::string(original.data()+1, original.size()-2);
 
-  return original;
+  return toString(original);
 }
 
 void Silicon::setOperator(std::string name, Silicon::StringOperator func)
@@ -1313,20 +3162,55 @@ void Silicon::setGlobalOperator(std::string name, Silicon::DoubleOperator func)
 
 void Silicon::setKeyword(std::string kw, std::string text)
 {
-  localKeywords[kw] = text;
+  if ( (!kw.empty()) && (kw[0] == '_') )
+    ++this->settingsVersion;
+  keywordChanged(kw);
+  keywordEntry(std::move(kw)) = std::move(text);
+}
+
+void Silicon::setKeywords(Silicon::StringMap keywords)
+{
+  /* Room for all of them at once */
+  localKeywords.reserve(localKeywords.size()+keywords.size());
+  setKeywords(std::make_move_iterator(keywords.begin()), std::make_move_iterator(keywords.end()));
+}
+
+void Silicon::updateKeyword(const std::string& kw, const std::string& text)
+{
+  if ( (!kw.empty()) && (kw[0] == '_') )
+    ++this->settingsVersion;
+  keywordChanged(kw);
+  /* Assigning to the existing value reuses its memory */
+  keywordEntry(kw) = text;
 }
 
 void Silicon::delKeyword(std::string kw)
 {
+  /* Can't be removed from the prototype */
+  if (layerFind(&Layer::keywords, kw))
+    detach();
+
   auto k = localKeywords.find(kw);
   if (k != localKeywords.end())
-    localKeywords.erase(k);
+    {
+      if ( (!kw.empty()) && (kw[0] == '_') )
+	++this->settingsVersion;
+      keywordChanged(kw);
+      localKeywords.erase(k);
+      ++keywordsLayout;
+    }
 }
 
 
 void Silicon::setGlobalKeyword(std::string kw, std::string text)
 {
-  globalKeywords[kw] = text;
+  if ( (!kw.empty()) && (kw[0] == '_') )
+    ++globalSettingsVersion;
+  ++globalKeywordVersions[kw];
+  std::size_t before = globalKeywords.size();
+  globalKeywords[std::move(kw)] = std::move(text);
+  if (globalKeywords.size() != before)
+    ++globalKeywordsLayout;
 }
 
 bool Silicon::getKeyword(std::string kw, std::string &text)
@@ -1339,6 +3223,14 @@ bool Silicon::getKeyword(std::string kw, std::string &text)
       return true;
     }
 
+  /* Is a prototype keyword? */
+  const std::string* base = layerFind(&Layer::keywords, kw);
+  if (base)
+    {
+      text = *base;
+      return true;
+    }
+
   /* Is a global keyword? */
   index = globalKeywords.find(kw);
   if (index != globalKeywords.end())
@@ -1360,49 +3252,147 @@ std::string Silicon::getKeyword(std::string kw)
 }
 
 
-std::string Silicon::putKeyword(std::string keyword)
+const std::string* Silicon::findKeyword(const char* kw, std::size_t len, uint32_t hash, const SiliconValue::Path* path)
 {
-  std::string text;
+  if (this->dependencies)
+    recordKeyword(std::string(kw, len));
+
+  /* Is a local keyword? */
+  auto index = localKeywords.find(kw, len, hash);
+  if (index != localKeywords.end())
+    return &index->second;
+
+  /* Is a prototype keyword? */
+  const std::string* base = layerFind(&Layer::keywords, kw, len, hash);
+  if (base)
+    return base;
+
+  /* Is a global keyword? */
+  index = globalKeywords.find(kw, len, hash);
+  if (index != globalKeywords.end())
+    return &index->second;
+
+  /* Is a value? */
+  if ( (localValues.empty()) && (valueScopes.empty()) && ( (!this->layer) || (!this->layer->hasValues) ) )
+    return NULL;
+
+  const SiliconValue* value = (path)?findValue(*path):findValue(SiliconValue::parsePath(kw, len));
+  return ( (value) && (value->type() == SiliconValue::STRING) )?&value->str():NULL;
+}
 
+const SiliconValue* Silicon::findValue(const SiliconValue::Path& path)
+{
+  if (path.empty())
+    return NULL;
+
+  const SiliconValue::Segment* first = path.data();
+  const SiliconValue::Segment* last = first+path.size();
+  /* Inside a loop over values? */
+  for (auto sc = valueScopes.rbegin(); sc != valueScopes.rend(); ++sc)
+    {
+      const SiliconValue::Path& loop = *sc->path;
+      if ( (loop.size() <= path.size()) && (std::equal(loop.begin(), loop.end(), path.begin())) )
+	return (sc->element)?sc->element->find(first+loop.size(), last):NULL;
+    }
+
+  if (first->index >= 0)
+    return NULL;
+
+  if (this->dependencies)
+    this->dependencies->push_back({ true, first->key, collectionVersion(first->key) });
+
+  auto local = localValues.find(first->key.data(), first->key.size(), first->hash);
+  const SiliconValue* root = (local != localValues.end())?&local->second:layerFind(&Layer::values, first->key.data(), first->key.size(), first->hash);
+  return (root)?root->find(first+1, last):NULL;
+}
+
+void Silicon::putKeyword(std::string& destination, const SiliconTemplate& tpl, const SiliconTemplate::Node& node)
+{
   addKeywordToStats();		/* Stats*/
 
-  if (!getKeyword(keyword, text))
+  /* Rendering spans: put template pieces instead of copying them */
+  if ( (spanRecorder) && (spanRecorder->contents) && (&destination == spanRecorder->buffer) &&
+       (!node.filtered) && (node.name == Silicon::contentsKeyword) )
+    {
+      spanRecorder->flush();
+      spanRecorder->pieces.insert(spanRecorder->pieces.end(), spanRecorder->contents->begin(), spanRecorder->contents->end());
+      return;
+    }
+
+  putKeyword(destination, node.name, findKeyword(node.name.data(), node.name.size(), node.hash, &node.path), node.escape, node.filtered, tpl.source().data()+node.pos, node.len);
+}
+
+void Silicon::putKeyword(std::string& destination, const std::string& name, const std::string* text, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen)
+{
+  if (text)
     {
-      if (this->localConfig.leaveUnmatchedKwds)
-	return "{{"+keyword+"}}";
+      /* Contents keywords have rendered output, don't escape them */
+      if ( (!filtered) && ( (!this->localConfig.autoEscape) || (name == Silicon::contentsKeyword) || (name == "block._contents") ) )
+	escape = SiliconEscape::NONE;
 
-      return "";
+      /* renderTo(): big raw values (template output in the layout) go to the sink as they are */
+      if ( (outputStream) && (&destination == outputStream->buffer) && (escape == SiliconEscape::NONE) && (text->size() >= outputStream->chunk) )
+	{
+	  outputStream->drain();
+	  (*outputStream->sink)(text->data(), text->size());
+	  return;
+	}
+
+      SiliconEscape::append(escape, destination, text->data(), text->size());
     }
-  else
-    return text;
+  else if (this->localConfig.leaveUnmatchedKwds)
+    destination.append(tag, tagLen);
 }
 
 void Silicon::setFunction(std::string name, Silicon::TemplateFunction callable)
 {
-  localFunctions[name] = callable;
+  localFunctions[std::move(name)] = std::move(callable);
 }
 
 void Silicon::setGlobalFunction(std::string name, Silicon::TemplateFunction callable)
 {
-  globalFunctions[name] = callable;
+  globalFunctions[std::move(name)] = std::move(callable);
 }
 
 void Silicon::setLayout(Silicon::LayoutType ltype, const char* layout)
 {
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(layoutMutex);
+#endif
 
   if (Silicon::layoutData!=NULL)
     free(Silicon::layoutData);
 
+  /* A new layout starts a new estimation */
+  std::atomic_store(&Silicon::layoutEstimate, (ltype==FILE)?fileOutputEstimate(filePath(layout, this->localConfig.basePath)):std::make_shared<OutputEstimate>());
+
+  /* It will be compiled when rendered */
+  for (auto& l : Silicon::layoutCompiled)
+    l.reset();
+  Silicon::layoutReloaded = false;
   if (ltype==FILE)
     {
-#if USEMUTEX
-      std::lock_guard<std::mutex> lock(layoutMutex);
-#endif
-      this->extractFile(&Silicon::layoutData, layout);
+      Silicon::layoutPath = filePath(layout, this->localConfig.basePath);
+      /* Bundled layouts are used as they were built, for both settings */
+      std::shared_ptr<const SiliconTemplate> inBundle = bundled(Silicon::layoutPath);
+      Silicon::layoutBundled = (bool) inBundle;
+      for (auto& l : Silicon::layoutCompiled)
+	l = inBundle;
+      if (inBundle)
+	this->copyBuffer(&Silicon::layoutData, inBundle->source().c_str());
+      else
+	this->extractFile(&Silicon::layoutData, layout);
+      Silicon::layoutName = layout;
+      Silicon::layoutGenerated = findGenerated(layout, Silicon::layoutData);
+      Silicon::layoutBasePath = this->localConfig.basePath;
     }
   else
     {
       this->copyBuffer(&Silicon::layoutData, layout);
+      Silicon::layoutName.clear();
+      Silicon::layoutGenerated = NULL;
+      Silicon::layoutPath.clear();
+      Silicon::layoutBundled = false;
     }
 }
 
@@ -1424,16 +3414,14 @@ std::string Silicon::getContentsKeyword()
 
 long Silicon::getCurrentLine()
 {
-  #if SILICON_DEBUG
-  return Stats.line;
-  #endif
-  return 0;
+  long line, pos;
+  locate((sources.empty())?NULL:sources.back().data, tagPosition, line, pos);
+  return line;
 }
 
 long Silicon::getCurrentPos()
 {
-  #if SILICON_DEBUG
-  return Stats.pos;
-  #endif
-  return 0;
+  long line, pos;
+  locate((sources.empty())?NULL:sources.back().data, tagPosition, line, pos);
+  return pos;
 }
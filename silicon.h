@@ -16,10 +16,22 @@
 #include <functional>
 #include <map>
 #include <vector>
+#include <set>
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#include "siliconarena.h"
+#include "siliconescape.h"
+#include "silicontemplate.h"
+#include "siliconhash.h"
+#include "siliconvalue.h"
 
 #if USEMUTEX
   #include <mutex>
 #endif
+#if defined(__unix__) || defined(__APPLE__)
+  #include <sys/uio.h>
+#endif
 /** This will be our default maximum buffer length. Templates must not exceed
  this size in bytes */
 #define MAXBUFFERLEN 16384
@@ -37,7 +49,7 @@
 
 /**
  * Silicon Exceptions
- * These exceptions store line and position to know if
+ * These exceptions store file, line and position to know if
  * we have any syntax error.
  */
 class SiliconException : public std::exception
@@ -47,15 +59,12 @@ class SiliconException : public std::exception
    * Silicon Exception
    * @param code
    * @param message
-   * @param line
+   * @param line (0 if unknown)
    * @param pos Character in line
    */
- SiliconException(const int& code, const std::string &message, long line, long pos): _code(code), _line(line), _pos(pos)
+ SiliconException(const int& code, const std::string &message, long line, long pos): _code(code), _text(message), _line(line), _pos(pos), _located(false)
   {
-    _message = "Error "+std::to_string(_code)+": "+message;
-    #if SILICON_DEBUG
-    _message+=" on line "+std::to_string(_line)+":"+std::to_string(_pos);
-    #endif
+    buildMessage();
   }
 
   virtual ~SiliconException() throw ()
@@ -78,15 +87,78 @@ class SiliconException : public std::exception
     return _code;
   }
 
+  /**
+   * Gets error line (0 if unknown)
+   */
+  long line() const
+  {
+    return _line;
+  }
+
+  /**
+   * Gets error position in line
+   */
+  long pos() const
+  {
+    return _pos;
+  }
+
+  /**
+   * Gets template file name where the error is
+   */
+  const std::string& file() const
+  {
+    return _file;
+  }
+
+  /**
+   * Sets where the error is. Only the first call (from the
+   * innermost template) is taken. Line and position are only
+   * used if we didn't know them yet.
+   *
+   * @param file Template file
+   * @param line Line
+   * @param pos Character in line
+   */
+  void setLocation(const std::string& file, long line, long pos)
+  {
+    if (_located)
+      return;
+
+    _located = true;
+    _file = file;
+    if (_line == 0)
+      {
+	_line = line;
+	_pos = pos;
+      }
+    buildMessage();
+  }
+
 protected:
+  void buildMessage()
+  {
+    _message = "Error "+std::to_string(_code)+": "+_text;
+    if (_line>0)
+      _message+=" on line "+std::to_string(_line)+":"+std::to_string(_pos);
+    if (!_file.empty())
+      _message+=" in "+_file;
+  }
+
   /** Error code */
   int _code;
   /** Error message  */
   std::string _message;
+  /** Error description, without code and position */
+  std::string _text;
+  /* Error file */
+  std::string _file;
   /* Error line */
   long _line;
   /* Error pos */
   long _pos;
+  /* File, line and pos are already set */
+  bool _located;
 };
 
 /**
@@ -119,7 +191,19 @@ public:
   /**
    * When we have several functions we call them by their name
    */
-  using FunctionMap = std::map<std::string, TemplateFunction>;
+  using FunctionMap = SiliconHashMap<TemplateFunction>;
+
+  /**
+   * Keywords and collections by name
+   */
+  using KeywordMap = SiliconHashMap<std::string>;
+  using CollectionMap = SiliconHashMap<std::vector<StringMap> >;
+
+  /**
+   * Collection rows on demand. Adds the next rows to the (empty) vector
+   * it gets, as many as it wants. No rows added: the collection is over
+   */
+  using CollectionSource = std::function<void(std::vector<StringMap>& rows)>;
 
   /**
    * Used to compare strings
@@ -136,6 +220,107 @@ public:
    */
   using DoubleOperator = std::function<bool(Silicon*, long double, long double)>;
 
+  /**
+   * Strings and maps used while parsing. They are taken from
+   * the render arena, so they are reused between renders.
+   */
+  using TempString = std::basic_string<char, std::char_traits<char>, SiliconArenaAllocator<char> >;
+  using TempStringMap = std::map<TempString, TempString, std::less<TempString>, SiliconArenaAllocator<std::pair<const TempString, TempString> > >;
+
+  /**
+   * Output size statistics. Each template (and the layout) keeps an
+   * estimation of its output size to reserve the output buffer
+   * before rendering.
+   */
+  struct RenderStats
+  {
+    /** Bytes reserved for the next template render */
+    std::size_t templateEstimate;
+    /** Last template output size */
+    std::size_t templateSize;
+    /** Template renders */
+    unsigned long templateRenders;
+    /** Template renders bigger than the estimate */
+    unsigned long templateMisses;
+    /** Bytes reserved for the next layout render */
+    std::size_t layoutEstimate;
+    /** Last layout output size */
+    std::size_t layoutSize;
+    /** Layout renders */
+    unsigned long layoutRenders;
+    /** Layout renders bigger than the estimate */
+    unsigned long layoutMisses;
+  };
+
+  /**
+   * Rendered output as a list of pieces, ready for writev()/sendmsg().
+   * Long literal runs point to the compiled template source, the rest
+   * of the output (keywords, functions, short texts) is stored here.
+   * Pieces are valid while this object lives: it holds the compiled
+   * templates, even if the instance changes its template later.
+   */
+  class Spans
+  {
+  public:
+    /**
+     * One piece of output. Same layout as struct iovec
+     */
+    struct Span
+    {
+      const char* base;
+      std::size_t len;
+    };
+
+    Spans() = default;
+    Spans(Spans&&) = default;
+    Spans& operator=(Spans&&) = default;
+
+    /**
+     * Output pieces, in order
+     */
+    const std::vector<Span>& spans() const
+    {
+      return _spans;
+    }
+
+    /**
+     * Total output size
+     */
+    std::size_t size() const
+    {
+      return _size;
+    }
+
+    /**
+     * Output as one string (copies everything)
+     */
+    std::string str() const;
+
+#if defined(__unix__) || defined(__APPLE__)
+    /**
+     * Pieces as iovec array for writev(). Remember writev() takes
+     * IOV_MAX pieces at most.
+     */
+    const struct iovec* iovecs() const
+    {
+      return reinterpret_cast<const struct iovec*>(_spans.data());
+    }
+#endif
+
+  private:
+    friend class Silicon;
+
+    Spans(const Spans&) = delete;
+    Spans& operator=(const Spans&) = delete;
+
+    std::vector<Span> _spans;
+    std::size_t _size = 0;
+    /* Dynamic output. On the heap, so moving Spans won't move them */
+    std::vector<std::unique_ptr<std::string> > buffers;
+    /* Templates literal pieces point to */
+    std::vector<std::shared_ptr<const SiliconTemplate> > templates;
+  };
+
   /**
    * Destroy !!!
    */
@@ -158,6 +343,171 @@ public:
   static Silicon createFromStr(std::string& data, long maxBufferLen=0);
   static Silicon createFromStr(const char* data, long maxBufferLen=0);
 
+  /**
+   * Gets this instance ready to be forked: compiles its template and
+   * moves its keywords, functions, operators, collections and values
+   * to a layer shared with its forks, on top of the layers it already
+   * had. Call it once the prototype is set up. Data set later stays
+   * in this instance until freeze() is called again.
+   */
+  void freeze();
+
+  /**
+   * Creates an instance sharing this one's template and frozen data
+   * (@see freeze()). Frozen data is not copied: the new instance looks
+   * it up in the layers, behind its own data, which always wins. Data
+   * set after the last freeze() is copied. Changes to this instance
+   * made after fork() are not seen by instances forked before.
+   * Extension data is not shared. This instance doesn't change, so
+   * several threads can fork it at once.
+   *
+   *    Silicon proto = Silicon::createFromFile("page.html");
+   *    proto.setFunction(...); proto.setKeyword(...);
+   *    proto.freeze();
+   *    // each request
+   *    Silicon s = proto.fork();
+   *    s.setKeyword("user", user);
+   *
+   * @return new instance
+   */
+  Silicon fork() const;
+
+  /**
+   * Template translated to C++ by siliconc
+   */
+  struct Generated
+  {
+    /** Template file name, as given to createFromFile() or setLayout() */
+    const char* name;
+    /** Template source it was generated from */
+    const char* source;
+    std::size_t len;
+    /** Renders template */
+    void (*render)(Silicon& s, std::string& destination);
+    /** Keywords used (generatedKeyword() slots) */
+    std::size_t slots;
+    /** First slot of this template among all generated templates (set by addGenerated()) */
+    std::size_t slotBase;
+  };
+
+  /**
+   * Registers a generated template. Templates and layouts created from
+   * a file with the same name and source will be rendered by it (except
+   * in incremental renders, spans, or while SiliconReload is running).
+   * siliconc output calls it when the program starts.
+   *
+   * @param generated Generated template
+   *
+   * @return true
+   */
+  static bool addGenerated(const Generated& generated);
+
+  /**
+   * Is this template rendered by generated code?
+   */
+  inline bool isGenerated()
+  {
+    return (this->generated != NULL);
+  }
+
+  /**
+   * Gets compiled template, compiling it if needed
+   */
+  std::shared_ptr<const SiliconTemplate> getTemplate();
+
+  /**
+   * Gets compiled layout, compiling it if needed
+   *
+   * @return compiled layout, or empty pointer if there is no layout
+   */
+  std::shared_ptr<const SiliconTemplate> getLayoutTemplate();
+
+  /**
+   * Template file name, empty if created from string
+   */
+  inline const std::string& getTemplateName()
+  {
+    return this->_dataName;
+  }
+
+  /**
+   * Layout file name, empty if not created from file
+   */
+  static std::string getLayoutName();
+
+  /**
+   * Collection loop, one row at a time. Sets collection keywords for
+   * each row, like {%collection}} does.
+   */
+  class CollectionLoop
+  {
+  public:
+    /**
+     * @param s Instance with the collection
+     * @param collectionVar Collection
+     * @param arguments Collection arguments (loops)
+     * @param path collectionVar split as a value path, if it's done
+     */
+    CollectionLoop(Silicon& s, const std::string& collectionVar, const StringMap& arguments, const SiliconValue::Path* path=NULL);
+    ~CollectionLoop();
+
+    /**
+     * Sets keywords for next row
+     *
+     * @return false when the loop is over
+     */
+    bool next();
+
+  private:
+    CollectionLoop(const CollectionLoop&) = delete;
+    CollectionLoop& operator=(const CollectionLoop&) = delete;
+
+    /* Next rows from the source */
+    bool fetch(std::vector<StringMap>& into);
+
+    Silicon& s;
+    /* Collection rows, or the current batch of the source */
+    const std::vector<StringMap>* rows;
+    const CollectionSource* source;
+    std::vector<StringMap> batch;
+    std::vector<StringMap> nextBatch;
+    bool haveNext;
+    /* Array of values, its path and current element */
+    const SiliconValue* array;
+    SiliconValue::Path ownPath;
+    std::size_t scope;
+    std::size_t row;
+    long line;
+    /* -1 when unknown (source without size) */
+    long iterations;
+    std::string prefix;
+    std::string kwLast;
+    std::string kwEven;
+    std::string kwLineNumber;
+    std::string kwField;
+  };
+
+  /* Used by code generated with siliconc, don't call them directly */
+  void generatedTag(const char* tag)
+  {
+    tagPosition = tag;
+  }
+  void generatedKeyword(std::string& destination, std::size_t slot, const std::string& name, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen);
+  bool generatedCondition(const std::string& condition);
+  /* Conditions split by siliconc: operands (empty or otherwise if not found) and tests */
+  const std::string& generatedOperand(std::size_t slot, const std::string& name);
+  const std::string& generatedOperand(std::size_t slot, const std::string& name, const std::string& otherwise);
+  static bool generatedTrue(const std::string& value);
+  static int generatedCompare(const std::string& a, const std::string& b, bool numeric);
+  bool generatedIffun(const std::vector<std::string>& functions);
+  void generatedFunction(std::string& destination, const std::string& name, const StringMap& arguments, std::string&& body);
+  void generatedCollection(const std::string& name, const StringMap& arguments, const std::function<void()>& body);
+  /* Used by templates compiled from literals (siliconliteral.h) */
+  void generatedKeyword(std::string& destination, const std::string& name, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen);
+  void generatedRender(const char* source, const std::function<void()>& render);
+  /* Used by async rendering (siliconasync.h) */
+  void generatedLocate(SiliconException& e, const std::string& name, const char* source);
+
   /**
    * Renders template
    *
@@ -167,7 +517,253 @@ public:
    */
   std::string render(bool useLayout=true);
 
+  /**
+   * Renders template into spans (@see Spans). Output is the same
+   * as render(), but literal text is not copied.
+   *
+   * @useLayout Also renders layout
+   * @return output pieces
+   */
+  Spans renderSpans(bool useLayout=true);
+
+  /**
+   * Gets output pieces, in order (@see renderTo())
+   */
+  using OutputSink = std::function<void(const char* data, std::size_t len)>;
+
+  /**
+   * Renders template giving the output to sink while it's produced,
+   * in pieces of about chunk bytes, so it's never whole in memory
+   * (template output is, when it goes inside the layout). Output is
+   * the same as render(), async blocks are rendered in place. If it
+   * throws, sink may have got part of the output.
+   *
+   * @param sink Output receiver
+   * @param useLayout Also renders layout
+   * @param chunk Output size to call sink
+   */
+  void renderTo(const OutputSink& sink, bool useLayout=true, std::size_t chunk=16384);
+
+  /**
+   * Gets output size estimations for this template and the layout
+   *
+   * @return stats
+   */
+  RenderStats getRenderStats();
+
+  /**
+   * Data for one render of a batch
+   */
+  struct RenderContext
+  {
+    /** Keywords, added to the instance ones (or replacing them) */
+    StringMap keywords;
+    /** Collections, replacing the instance ones */
+    std::map<std::string, std::vector<StringMap> > collections;
+  };
+
+  struct BatchStats
+  {
+    /** Contexts rendered */
+    std::size_t rendered;
+    /** Contexts failed (see errors) */
+    std::size_t failed;
+    /** Threads used */
+    unsigned threads;
+  };
+
+  /**
+   * Renders this template once for each context, in several
+   * threads. Compiled template, keywords, functions and collections
+   * of this instance are shared by all renders, and each context is
+   * put on top of them. An error in one render doesn't stop the others.
+   * Neither this instance nor globals can change while the batch runs.
+   *
+   * @param contexts Data for each render
+   * @param count Number of contexts
+   * @param outputs Output for each context (resized to count)
+   * @param errors Error for each context, empty if rendered (resized to count)
+   * @param threads Threads to use, 0 for one per core
+   * @param useLayout Also renders layout
+   *
+   * @return counters
+   */
+  BatchStats renderBatch(const RenderContext* contexts, std::size_t count, std::vector<std::string>& outputs, std::vector<std::string>& errors, unsigned threads=0, bool useLayout=true);
+
+  BatchStats renderBatch(const std::vector<RenderContext>& contexts, std::vector<std::string>& outputs, std::vector<std::string>& errors, unsigned threads=0, bool useLayout=true)
+  {
+    return renderBatch(contexts.data(), contexts.size(), outputs, errors, threads, useLayout);
+  }
+
+  /**
+   * What a template uses
+   */
+  struct References
+  {
+    /** Keywords (outside collections). Keywords set by blocks not included */
+    std::set<std::string> keywords;
+    /** Collections, and fields used of each of them */
+    std::map<std::string, std::set<std::string> > collections;
+    /** Called functions ({!function}}) */
+    std::set<std::string> functions;
+    /** Used builtins (if, iffun, collection) */
+    std::set<std::string> builtins;
+    /** Block template files */
+    std::set<std::string> blocks;
+    /** Layout file, if followed */
+    std::string layout;
+  };
+
+  /**
+   * Gets everything the template can reach: keywords, collections
+   * and their fields, functions, builtins and blocks. Blocks are followed,
+   * and the layout too if useLayout is set.
+   * Result is computed once, until template or layout change.
+   *
+   * @param useLayout Follow the layout
+   *
+   * @return references
+   */
+  const References& getReferences(bool useLayout=true);
+
+  /**
+   * Regions counters of the last incremental render
+   */
+  struct IncrementalStats
+  {
+    /** Regions whose previous output was reused */
+    unsigned long reused;
+    /** Regions rendered again */
+    unsigned long rendered;
+  };
+
+  /**
+   * Incremental rendering. Each region (keyword, if, iffun, collection
+   * and function, at any level outside collections) remembers its output
+   * and the keywords and collections it read. Next renders only render
+   * again the regions whose keywords or collections changed.
+   * Functions (and regions containing them) are always rendered, as we
+   * can't know what they read, or what they change.
+   *
+   * @param val Enable / disable
+   */
+  void setIncremental(bool val);
+
+  /**
+   * Is incremental rendering enabled?
+   */
+  inline bool getIncremental()
+  {
+    return this->incremental;
+  }
+
+  /**
+   * Gets region counters of the last render
+   */
+  inline IncrementalStats getIncrementalStats()
+  {
+    return this->incrementalStats;
+  }
+
+  /**
+   * Gets how many renders this instance has started
+   *
+   * @return render number
+   */
+  inline unsigned long getRenderNumber()
+  {
+    return this->renderNumber;
+  }
+
+  /**
+   * Are we inside render()?
+   *
+   * @return true if rendering
+   */
+  inline bool isRendering()
+  {
+    return (this->renderDepth>0);
+  }
+
+  /**
+   * Keywords starting with _ are used as settings by extensions
+   * (_baseURL, _renderResources...). This number changes every time
+   * one of them changes, locally or globally, so extensions can
+   * cache values computed from them.
+   *
+   * @return settings version
+   */
+  inline unsigned long getSettingsVersion()
+  {
+    return this->settingsVersion + globalSettingsVersion.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Extension data filled by templates while rendering (like the
+   * assets of SiliconWeb). Async blocks are rendered by other
+   * instances, and their data is given back to the instance that
+   * started them, to be put where each block was.
+   */
+  struct RenderData
+  {
+    virtual ~RenderData() {}
+
+    /**
+     * An async block starts here
+     *
+     * @param s Instance rendering
+     * @param id Block id
+     */
+    virtual void blockStarted(Silicon* s, std::size_t id) = 0;
+
+    /**
+     * Puts data of an async block where it started. If it's
+     * not known here, it was created after the block started.
+     *
+     * @param id Block id
+     * @param block Data filled by the block (same type)
+     */
+    virtual void blockRendered(std::size_t id, RenderData& block) = 0;
+  };
+
+  /**
+   * Gets extension data. Extensions (like SiliconWeb) keep their
+   * per-instance state here. It's created the first time we ask
+   * for it, and each name must always be used with the same type.
+   * If T is a RenderData it goes back from async blocks.
+   *
+   * @param name Extension data name
+   *
+   * @return data
+   */
+  template <typename T>
+  T& getExtensionData(const std::string& name)
+  {
+    auto& entry = extensionData[name];
+    if (!entry.data)
+      {
+	std::shared_ptr<T> data = std::make_shared<T>();
+	entry.render = renderData(data.get());
+	entry.data = std::move(data);
+      }
+
+    return *static_cast<T*>(entry.data.get());
+  }
+
+  /**
+   * Waits for async blocks started so far in this render, and gives
+   * their RenderData back. Functions reading RenderData (like
+   * renderCss) call it first, so they see what blocks before them
+   * added, as if blocks were rendered in place.
+   */
+  void joinAsync();
+
+  /**
+   * Moves template, keywords, collections, functions and settings.
+   * Don't move an instance while it's rendering.
+   */
   Silicon(Silicon&& sil);
+  Silicon& operator=(Silicon&& sil);
 
   /* Basic getters/setters */
 
@@ -228,6 +824,66 @@ public:
     return this->localConfig.leaveUnmatchedKwds;
   }
 
+  /**
+   * Setter for auto escape. When enabled, keyword values are escaped
+   * depending on where they are (HTML text, attribute value, URL,
+   * script or style). Use {{keyword|raw}} to write one keyword as is,
+   * or {{keyword|html}}, {{keyword|attr}}, {{keyword|url}},
+   * {{keyword|js}}, {{keyword|css}} to choose the escape (these work
+   * with auto escape disabled too).
+   *
+   * @param newval New value
+   */
+  inline void setAutoEscape(bool newval)
+  {
+    this->localConfig.autoEscape = newval;
+  }
+
+  /**
+   * Setter for global auto escape setting
+   * It's static-called!
+   *
+   * @param newval New value
+   */
+  static void setAutoEscapeGlobal(bool newval);
+
+  /**
+   * Getter for auto escape
+   *
+   * @return Current autoEscape value
+   */
+  inline bool getAutoEscape()
+  {
+    return this->localConfig.autoEscape;
+  }
+
+  /**
+   * Setter for minify. When enabled, literal HTML text of the template,
+   * layout and blocks is minified once, when they are compiled
+   * (@see SiliconTemplate::minify()), so renders don't pay for it.
+   *
+   * @param newval New value
+   */
+  void setMinify(bool newval);
+
+  /**
+   * Setter for global minify setting
+   * It's static-called!
+   *
+   * @param newval New value
+   */
+  static void setMinifyGlobal(bool newval);
+
+  /**
+   * Getter for minify
+   *
+   * @return Current minify value
+   */
+  inline bool getMinify()
+  {
+    return this->localConfig.minify;
+  }
+
   /**
    * Setter for max. buffer length
    *
@@ -285,6 +941,36 @@ public:
    */
   void setKeyword(std::string kw, std::string text);
 
+  /**
+   * Sets several local keywords. Room for them is made once.
+   *
+   * @param keywords Keywords (without {{ }}) and texts
+   */
+  void setKeywords(StringMap keywords);
+
+  /**
+   * Sets several local keywords from a range of pairs. Values are
+   * moved when iterators are std::move_iterator.
+   *
+   * @param first First keyword/text pair
+   * @param last End of range
+   */
+  template <typename Iterator>
+  void setKeywords(Iterator first, Iterator last)
+  {
+    bool settings = false;
+    for (; first != last; ++first)
+      {
+	auto&& kv = *first;
+	const std::string& kw = kv.first;
+	settings = ( (settings) || ( (!kw.empty()) && (kw[0] == '_') ) );
+	keywordChanged(kw);
+	keywordEntry(kw) = std::forward<decltype(kv)>(kv).second;
+      }
+    if (settings)
+      ++this->settingsVersion;
+  }
+
   /**
    * Delete new local keyword
    *
@@ -352,7 +1038,7 @@ public:
    *
    * @return Collection. empty collection if not found
    */
-  std::vector<StringMap> getCollection(std::string kw);
+  const std::vector<StringMap>& getCollection(const std::string& kw);
 
   /**
    * Adds map to collection, as one element of collection vector.
@@ -363,6 +1049,16 @@ public:
    */
   void addToCollection(std::string kw, StringMap content);
 
+  /**
+   * Adds an empty row to collection, to fill it in place. If the
+   * collection doesn't exist, creates new one
+   *
+   * @param kw Keyword
+   *
+   * @return new row. Valid until this collection changes again
+   */
+  StringMap& emplaceRow(const std::string& kw);
+
   /**
    * Adds string pair to collection vector in the given position.
    * If the collection doesn't exist, creates new one
@@ -375,6 +1071,45 @@ public:
    */
   long addToCollection(std::string kw, long pos, std::string key, std::string val);
 
+  /**
+   * Collection whose rows come from a source while it's being rendered,
+   * a batch at a time, so the whole collection is never in memory. Each
+   * {%collection}} loop asks for rows until the source adds none, or
+   * until totalLines (or loops) rows are rendered. It's
+   * used instead of a collection with the same name (addCollection()
+   * removes the source), getCollection() doesn't see it.
+   * It's not copied by fork(), renderBatch() or async blocks.
+   *
+   * @param kw Keyword
+   * @param source Rows generator. Empty to remove the source
+   * @param totalLines Number of rows, if it's known (-1 otherwise). Without
+   *                   it, _totalLines and _totalIterations are removed
+   */
+  void setCollectionSource(std::string kw, CollectionSource source, long totalLines=-1);
+
+  /* Values related methods */
+
+  /**
+   * Sets tree-shaped value (objects, arrays and strings). Templates reach
+   * it with paths: {{name.member}}, {{name.list[2].member}}, and
+   * {%collection var="name.list"}} loops over its arrays, even the ones
+   * inside the current row of another loop. Keywords with the same name
+   * are found first.
+   *
+   * @param name Name
+   * @param value Value
+   */
+  void setValue(std::string name, SiliconValue value);
+
+  /**
+   * Gets value
+   *
+   * @param name Name
+   *
+   * @return value or NULL if not found
+   */
+  const SiliconValue* getValue(const std::string& name);
+
   /* Functions related methods */
 
   /**
@@ -446,8 +1181,40 @@ public:
 
   /**
    * Simple parse for fast templates. Caution with this!
+   * Compiled snippets are cached, so parsing the same text again
+   * doesn't tokenize it again.
+   */
+  std::string parse(const std::string& templ);
+
+  /**
+   * Gets counters of the cache used by parse() (and blocks)
+   *
+   * @return cache stats
+   */
+  static SiliconTemplateCache::Stats getParseCacheStats();
+
+  /**
+   * Sets how many compiled snippets parse() can keep
+   *
+   * @param entries Maximum snippets. 0 disables the cache
+   */
+  static void setParseCacheSize(std::size_t entries);
+
+  /**
+   * Gets render arena counters for the current thread. Once the arena
+   * is warm, systemAllocations must not grow between renders.
+   *
+   * @return arena stats
    */
-  std::string parse(std::string templ);
+  static const SiliconArena::Stats& getArenaStats();
+
+  /**
+   * Sets threads rendering async blocks ({!block template=x async=1/}).
+   * Call it before the first async block is rendered.
+   *
+   * @param threads Threads to use, 0 for one per core
+   */
+  static void setAsyncThreads(unsigned threads);
 protected:
   /* Protected methods. Constructor */
 
@@ -472,17 +1239,16 @@ protected:
   /* Parsing and string building */
 
   /**
-   * Parses template data
+   * Compiles template data
    *
-   * @param destination Destination string
+   * @param tpl Compiled template we are filling. strptr is inside its source
    * @param strptr Pointer to data source
-   * @param write Whether to write parsed contents to destination or not
    * @param nested When we are parsing a function or condition. It's a nested case
    * @param level Nesting level we are parsing now
    *
-   * @return Data read from strptr
+   * @return Last character read (end of closing tag or '\0')
    */
-  long _parse(std::string& destination, char* strptr, bool write=true, std::string nested="", int level=0);
+  const char* compile(SiliconTemplate& tpl, const char* strptr, const char* nested=NULL, int level=0);
 
   /**
    * Parse keyword {{keyword}}
@@ -492,7 +1258,7 @@ protected:
    *
    * @return Data read from strptr (0 if not a keyword and nothing parsed)
    */
-  long parseKeyword(char* strptr, std::string& keyword);
+  long parseKeyword(const char* strptr, TempString& keyword);
 
   /**
    * Parse function {{!function}} or {{%function}}
@@ -506,7 +1272,7 @@ protected:
    *
    * @return Data read from strptr (0 if not a function and nothing parsed)
    */
-  long parseFunction(char* strptr, int &type, std::string& fname, StringMap &arguments, bool &autoClosed);
+  long parseFunction(const char* strptr, int &type, TempString& fname, TempStringMap &arguments, bool &autoClosed);
 
   /**
    * Parse closing tag {/clostag}}
@@ -516,16 +1282,29 @@ protected:
    *
    * @return Data read from strptr ((0 if not a closing tag and nothing parsed)
    */
-  long parseCloseNested(char* strptr, std::string closeName);
+  long parseCloseNested(const char* strptr, const char* closeName);
 
   /**
-   * Return keyword or leave it like this, depending on configuration
+   * Writes keyword or leave it like this, depending on configuration
    *
-   * @param keyword Keyword to put
+   * @param destination Destination string
+   * @param tpl Compiled template
+   * @param node Keyword node
+   */
+  void putKeyword(std::string& destination, const SiliconTemplate& tpl, const SiliconTemplate::Node& node);
+
+  /**
+   * Writes keyword
    *
-   * @return Contents of the keyword
+   * @param destination Destination string
+   * @param name Keyword
+   * @param text Keyword value (NULL if it doesn't exist)
+   * @param escape Escape context
+   * @param filtered Escape was given with a filter
+   * @param tag Keyword tag (written if keyword doesn't exist)
+   * @param tagLen Tag length
    */
-  std::string putKeyword(std::string keyword);
+  void putKeyword(std::string& destination, const std::string& name, const std::string* text, SiliconEscape::Context escape, bool filtered, const char* tag, std::size_t tagLen);
 
   /* Helpers */
 
@@ -540,70 +1319,85 @@ protected:
    *
    * @return Numeric value
    */
-  long getNumericArgument(StringMap &args, std::string argument, long defaultVal=0, bool required=false);
+  long getNumericArgument(const StringMap &args, const char* argument, long defaultVal=0, bool required=false);
 
   /**
-   * Compute internal builtin function
+   * Compiles internal builtin function (if, iffun, collection)
    *
-   * @param strptr Pointer to data source
-   * @param destination Destination string
+   * @param tpl Compiled template
+   * @param tagStart Where the builtin tag starts
+   * @param strptr End of the builtin tag
    * @param bif Built-In Function
    * @param arguments Arguments for builtin function
    * @param autoClosed Is it autoClosed?
-   * @param write whether to write on destination or not
    * @param level Nesting level (for debugging or limiting)
    *
-   * @return Data read from strptr (0 if nothing read)
+   * @return Last character read (end of closing tag)
    */
-  long computeBuiltin(char* strptr, std::string &destination, std::string bif, StringMap &arguments, bool &autoClosed, bool write, int level);
+  const char* compileBuiltin(SiliconTemplate& tpl, const char* tagStart, const char* strptr, const TempString& bif, TempStringMap &arguments, bool autoClosed, int level);
 
   /**
-   * Compute conditionals (internal builtin function if)
+   * Renders compiled nodes
    *
-   * @param strptr Pointer to data source
    * @param destination Destination string
-   * @param arguments Arguments for builtin function
-   * @param write whether to write on destination or not
-   * @param level Nesting level (for debugging or limiting)
-   *
-   * @return Data read from strptr (0 if nothing read)
+   * @param tpl Compiled template
+   * @param first First node
+   * @param last Node after the last one
    */
-  long computeBuiltinIf(char* strptr, std::string &destination, StringMap &arguments, bool write, int level);
+  void evaluate(std::string& destination, const SiliconTemplate& tpl, std::size_t first, std::size_t last);
 
   /**
-   * Checks if function exists. Parses data if exists
+   * Checks if any of the functions exists (builtin function iffun)
    *
-   * @param strptr Pointer to data source
-   * @param destination Destination string
-   * @param arguments Arguments for builtin function
-   * @param write whether to write on destination or not
-   * @param level Nesting level (for debugging or limiting)
+   * @param functions Function names
    *
-   * @return Data read from strptr (0 if nothing read)
+   * @return true if a function exists
    */
-  long computeBuiltinIffun(char* strptr, std::string &destination, StringMap &arguments, bool write, int level);
+  bool evaluateIffun(const std::vector<std::string>& functions);
 
   /**
    * Compute loops in collections (builtin function collection)
    *
-   * @param strptr Pointer to data source
    * @param destination Destination string
-   * @param arguments Arguments for builtin function
-   * @param write whether to write on destination or not
-   * @param level Nesting level (for debugging or limiting)
+   * @param tpl Compiled template
+   * @param index Collection node
+   */
+  void evaluateCollection(std::string& destination, const SiliconTemplate& tpl, std::size_t index);
+
+  /**
+   * Sets collection keywords for each row and calls body
    *
-   * @return Data read from strptr (0 if nothing read)
+   * @param collectionVar Collection
+   * @param arguments Collection arguments (loops)
+   * @param body Renders body
+   * @param path collectionVar split as a value path, if it's done
    */
-  long computeBuiltinCollection(char* strptr, std::string &destination, StringMap &arguments, bool write, int level);
+  template <typename F>
+  void loopCollection(const std::string& collectionVar, const StringMap& arguments, F body, const SiliconValue::Path* path=NULL);
 
   /**
    * Looks for function. First in local functions, then in global functions
    *
    * @param fun Function name
+   * @param hash Name hash (@see SiliconHash)
    *
    * @return function
    */
-  TemplateFunction getFunction(std::string fun);
+  const TemplateFunction& getFunction(const std::string& fun, uint32_t hash);
+  const TemplateFunction& getFunction(const std::string& fun)
+  {
+    return getFunction(fun, SiliconHash::of(fun));
+  }
+
+  /**
+   * Calls function, appends its output to destination
+   *
+   * @param destination Where the output goes
+   * @param f Function
+   * @param arguments Function arguments
+   * @param body Rendered body
+   */
+  void callFunction(std::string& destination, const TemplateFunction& f, const StringMap& arguments, std::string&& body);
 
   /**
    * Evaluate boolean condition
@@ -612,7 +1406,7 @@ protected:
    *
    * @return is it true or false?
    */
-  bool evaluateCondition(std::string condition);
+  bool evaluateCondition(const TempString& condition);
 
   /**
    * Separate arguments will reorder keys and values when
@@ -622,7 +1416,7 @@ protected:
    *
    * @return New StringMap with right arguments
    */
-  StringMap separateArguments(StringMap &arguments);
+  TempStringMap separateArguments(TempStringMap &arguments);
 
   /* Operators' stuff */
 
@@ -660,14 +1454,69 @@ protected:
   bool conditionLongOperator(std::string op, long long a, long long b);
 
   /**
-   * Gets current line
+   * Compiles a whole template source (template, layout or block). If
+   * a SiliconException is thrown inside, it will be located in this
+   * source.
+   *
+   * @param name Source name (file name or empty)
+   * @param data Source data
+   * @param len Source length
+   *
+   * @return Compiled template
+   */
+  std::shared_ptr<const SiliconTemplate> compileSource(const std::string& name, const char* data, std::size_t len);
+
+  /**
+   * Renders a compiled source. Exceptions are located like in compileSource()
+   *
+   * @param destination Destination string
+   * @param name Source name (file name or empty)
+   * @param tpl Compiled template
+   */
+  void renderSource(std::string& destination, const std::string& name, const SiliconTemplate& tpl);
+
+  /**
+   * Parses a source, compiling it only if it's not in the parse cache
+   *
+   * @param destination Destination string
+   * @param name Source name (file name or empty)
+   * @param data Source data
+   * @param len Source length
+   */
+  void parseSource(std::string& destination, const std::string& name, const char* data, std::size_t len);
+
+  /**
+   * Gets compiled source from the parse cache, compiling it if needed
+   */
+  std::shared_ptr<const SiliconTemplate> getCachedSource(const std::string& name, const char* data, std::size_t len);
+
+  /**
+   * Gets file template from the loaded bundle, if any
+   *
+   * @param path File path (base path included)
+   */
+  std::shared_ptr<const SiliconTemplate> bundled(const std::string& path);
+
+  /**
+   * Adds what a compiled template uses to refs
+   *
+   * @param refs References found
+   * @param tpl Compiled template
+   * @param visited Blocks already followed
+   */
+  void collectReferences(References& refs, const SiliconTemplate& tpl, std::set<std::string>& visited);
+
+  /**
+   * Gets current line. It's calculated here, from the position of
+   * the tag we are parsing, so don't use it unless you really
+   * need it (e.g. throwing exceptions)
    *
    * @return current line when parsing
    */
   long getCurrentLine();
 
   /**
-   * Gets current position
+   * Gets current position. Calculated like getCurrentLine()
    *
    * @return current character when parsing
    */
@@ -688,7 +1537,12 @@ protected:
   static std::string globalFuncDate(Silicon* s, StringMap options);
 
   /**
-   * Function block. Gets contents of a block template
+   * Function block. Gets contents of a block template. With async=1
+   * the block is rendered in another thread, with a copy of the
+   * keywords and collections at this point, and it's put where it
+   * was started when render() finishes. Extension RenderData filled
+   * by the block (CSS and JS included...) is merged back. Blocks
+   * in function bodies are rendered in place.
    *
    * @param s Silicon instance
    * @param options Options for function
@@ -753,11 +1607,396 @@ protected:
    *
    * @return Result
    */
-  std::string getArgValue(std::string original);
+  std::string getArgValue(const TempString& original);
 
 private:
+  friend class SiliconReload;
+
+  /**
+   * Copy for fork(), renderBatch() workers and async blocks. Compiled template
+   * is shared (source is only copied if it's not compiled yet, setMinify()
+   * takes it from the compiled one), extension data is not copied (async
+   * blocks give RenderData back).
+   */
+  Silicon(const Silicon& sil);
+  friend class SiliconBundle;
+
+  /* Takes everything from sil (move constructor and assignment) */
+  void moveFrom(Silicon& sil);
+
+  /**
+   * Data shared by a prototype and its forks (@see freeze()). It never
+   * changes once built: local data goes on top of it, and changing
+   * something only found here copies it to local data first. Each
+   * freeze() puts a layer on top of the previous ones.
+   */
+  struct Layer
+  {
+    KeywordMap keywords;
+    FunctionMap functions;
+    CollectionMap collections;
+    SiliconHashMap<StringOperator> stringOperators;
+    SiliconHashMap<LongOperator> longOperators;
+    SiliconHashMap<DoubleOperator> doubleOperators;
+    SiliconHashMap<SiliconValue> values;
+    /* This layer or the ones below have values */
+    bool hasValues = false;
+    std::shared_ptr<const Layer> parent;
+  };
+
+  std::shared_ptr<const Layer> layer;
+
+  /* Finds key in a map of the layers, the newest first. NULL if not found */
+  template <typename T, typename... Key>
+  const T* layerFind(SiliconHashMap<T> Layer::*map, const Key&... key) const
+  {
+    for (const Layer* l = this->layer.get(); l; l = l->parent.get())
+      {
+	auto found = (l->*map).find(key...);
+	if (found != (l->*map).end())
+	  return &found->second;
+      }
+
+    return NULL;
+  }
+
+  /* Local data takes everything from the layers, which are dropped */
+  void detach();
+
+  /* Local keyword, copied from the layer if it's only there. end() if none */
+  KeywordMap::iterator localKeyword(const std::string& kw);
+
+  /* Local collection to change it, copied from the layer if it's only there */
+  std::vector<StringMap>& localCollection(const std::string& kw);
+
+  /* Collection, local or from the layer. NULL if not found */
+  const std::vector<StringMap>* findCollection(const std::string& kw);
+
+  /* Async blocks of the render running, shared with their workers */
+  struct AsyncSections;
+  std::shared_ptr<AsyncSections> asyncSections;
+  /* Async blocks can be used (render() running, not incremental) */
+  bool asyncBlocks = false;
+
+  /* Render output where async blocks are put (NULL: blocks are not async here) */
+  std::string* asyncDestination = NULL;
+  /* Where the output of the function being called goes */
+  const std::string* functionDestination = NULL;
+  /* Blocks in asyncDestination: position and block id */
+  std::vector<std::pair<std::size_t, std::size_t> > asyncPlaceholders;
+
+  /* Starts rendering block in another thread. Its output will be at
+     the end of asyncDestination */
+  void asyncBlock(const std::string& file, const StringMap& keywords);
+
+  /* Puts blocks in asyncDestination, waiting for them */
+  void spliceAsync();
+
+  /* Render finished: blocks not started are dropped */
+  void endAsync();
+
+  /**
+   * Running estimation of the output size of a template. It grows
+   * fast when an output doesn't fit, and decreases slowly, so it
+   * follows a high percentile of recent renders.
+   */
+  class OutputEstimate
+  {
+  public:
+    /**
+     * Bytes to reserve before rendering
+     */
+    std::size_t reserve() const;
+
+    /**
+     * Updates estimation with a new output size
+     *
+     * @param size Output size
+     */
+    void update(std::size_t size);
+
+    std::atomic<std::size_t> estimate {0};
+    std::atomic<std::size_t> last {0};
+    std::atomic<unsigned long> renders {0};
+    std::atomic<unsigned long> misses {0};
+  };
+
+  /**
+   * Gets output estimation for a template file. All instances
+   * using the same file share it.
+   *
+   * @param file Template file name (with path)
+   */
+  static std::shared_ptr<OutputEstimate> fileOutputEstimate(const std::string& file);
+
   char* _data = NULL;
 
+  /* Template file name, empty if created from string */
+  std::string _dataName;
+
+  /* Template file name with base path */
+  std::string _dataPath;
+
+  /* Generated code for _data, if any */
+  const Generated* generated = NULL;
+
+  /**
+   * Finds generated template for a file
+   *
+   * @param name File name
+   * @param data File contents
+   *
+   * @return generated template or NULL if there isn't any, or source differs
+   */
+  static const Generated* findGenerated(const std::string& name, const char* data);
+
+  /* Renders generated template */
+  void renderGenerated(std::string& destination, const Generated& gen);
+
+  /**
+   * Keyword found by generated code. Keyword values never move while
+   * keywords are not added or removed, so they are looked up once.
+   */
+  struct KeywordSlot
+  {
+    bool resolved;
+    const std::string* value;
+  };
+
+  std::vector<KeywordSlot> slots;
+  /* Slots of the generated template being rendered */
+  std::size_t slotBase = 0;
+  /* Keywords added or removed, slots are valid while it doesn't change */
+  unsigned long keywordsLayout = 0;
+  unsigned long slotsLayout = 0;
+  static std::atomic<unsigned long> globalKeywordsLayout;
+  static std::size_t generatedSlots;
+
+  /* Keyword in slot of the generated template, NULL if not found */
+  const std::string* slotKeyword(std::size_t slot, const std::string& name);
+
+  /* Gets local keyword to assign it, adding it if needed */
+  std::string& keywordEntry(const std::string& kw)
+  {
+    std::size_t before = localKeywords.size();
+    std::string& value = localKeywords[kw];
+    if (localKeywords.size() != before)
+      ++keywordsLayout;
+
+    return value;
+  }
+
+  std::string& keywordEntry(std::string&& kw)
+  {
+    std::size_t before = localKeywords.size();
+    std::string& value = localKeywords[std::move(kw)];
+    if (localKeywords.size() != before)
+      ++keywordsLayout;
+
+    return value;
+  }
+
+  /* Reload generation of compiledData */
+  unsigned long reloadGeneration = 0;
+  /* compiledData was taken from SiliconReload */
+  bool reloaded = false;
+
+  /**
+   * Gets file name with base path
+   */
+  static std::string filePath(const std::string& file, const std::string& basePath);
+
+  /**
+   * Gets compiled block template file
+   *
+   * @param file Block file name
+   */
+  std::shared_ptr<const SiliconTemplate> getBlock(const std::string& file);
+
+  /* _data compiled, when rendered for the first time */
+  std::shared_ptr<const SiliconTemplate> compiledData;
+
+  /* Gets compiled _data / layout, compiling them if needed */
+  std::shared_ptr<const SiliconTemplate> getCompiled();
+  std::shared_ptr<const SiliconTemplate> getCompiledLayout();
+
+  /**
+   * Pieces recorded by renderSpans() while rendering into buffer
+   */
+  struct SpanRecorder
+  {
+    struct Piece
+    {
+      /* Literal text, or NULL if it's in buffer */
+      const char* base;
+      /* Offset in buffer (if not literal) */
+      std::size_t offset;
+      std::size_t len;
+      const std::string* buffer;
+    };
+
+    /* Dynamic output goes here */
+    std::string* buffer;
+    std::vector<Piece> pieces;
+    /* Bytes of buffer already in pieces */
+    std::size_t flushed;
+    /* Template pieces, to put them where the layout uses the contents keyword */
+    const std::vector<Piece>* contents;
+
+    /* Adds pending dynamic output to pieces */
+    void flush();
+    void literal(const char* base, std::size_t len);
+  };
+
+  /* Set while rendering spans */
+  SpanRecorder* spanRecorder = NULL;
+
+  /**
+   * Output of renderTo() being rendered into buffer
+   */
+  struct OutputStream
+  {
+    std::string* buffer;
+    const OutputSink* sink;
+    std::size_t chunk;
+
+    /* Gives buffer to the sink */
+    void drain();
+  };
+
+  /* Set while rendering with renderTo() */
+  OutputStream* outputStream = NULL;
+
+  /**
+   * Something a region read, and its version when it was read
+   */
+  struct RegionDependency
+  {
+    bool collection;
+    std::string name;
+    unsigned long version;
+
+    bool operator<(const RegionDependency& other) const
+    {
+      return (collection != other.collection)?(collection < other.collection):(name < other.name);
+    }
+
+    bool operator==(const RegionDependency& other) const
+    {
+      return ( (collection == other.collection) && (name == other.name) );
+    }
+  };
+
+  /**
+   * Last output of a region
+   */
+  struct Region
+  {
+    bool valid = false;
+    std::string output;
+    std::vector<RegionDependency> dependencies;
+  };
+
+  /**
+   * Regions of a compiled template (indexed like its nodes), and
+   * settings they were rendered with.
+   */
+  struct IncrementalState
+  {
+    std::shared_ptr<const SiliconTemplate> tpl;
+    std::vector<Region> regions;
+    bool autoEscape;
+    bool leaveUnmatchedKwds;
+    std::string contentsKeyword;
+  };
+
+  /* getReferences() result, and what it was computed from */
+  References references;
+  std::shared_ptr<const SiliconTemplate> referencesTemplate;
+  std::shared_ptr<const SiliconTemplate> referencesLayout;
+  bool referencesValid = false;
+
+  bool incremental = false;
+  IncrementalStats incrementalStats = { 0, 0 };
+  IncrementalState incrementalTemplate;
+  IncrementalState incrementalLayout;
+  /* Dependencies of the region being rendered (NULL if we are not recording) */
+  std::vector<RegionDependency>* dependencies = NULL;
+  /* Keywords prefixes of collections being rendered. They depend on the collection */
+  std::vector<const std::string*> loopPrefixes;
+  /* Keywords changed while rendering a batch item (NULL if we are not recording) */
+  std::vector<std::string>* changedKeywords = NULL;
+  /* Changes of keywords and collections (only when incremental) */
+  std::map<std::string, unsigned long> keywordVersions;
+  std::map<std::string, unsigned long> collectionVersions;
+  static std::map<std::string, unsigned long> globalKeywordVersions;
+
+  /* Marks keyword / collection as changed */
+  inline void keywordChanged(const std::string& kw)
+  {
+    if (this->changedKeywords)
+      this->changedKeywords->push_back(kw);
+    if (this->incremental)
+      ++keywordVersions[kw];
+  }
+
+  inline void collectionChanged(const std::string& name)
+  {
+    if (this->incremental)
+      ++collectionVersions[name];
+  }
+
+  unsigned long keywordVersion(const std::string& kw);
+  unsigned long collectionVersion(const std::string& name);
+
+  /* Adds keyword to the dependencies of the current region */
+  void recordKeyword(const std::string& kw);
+
+  /* Did anything a region read change? */
+  bool regionUnchanged(const Region& region);
+
+  /**
+   * Renders nodes reusing unchanged regions
+   *
+   * @return false if output can't be reused (there are functions)
+   */
+  bool evaluateIncremental(std::string& destination, const SiliconTemplate& tpl, IncrementalState& state, std::size_t first, std::size_t last);
+
+  /* Renders tpl incrementally with state */
+  void renderIncremental(std::string& destination, const std::string& name, const std::shared_ptr<const SiliconTemplate>& tpl, IncrementalState& state);
+
+  /* Output size estimation for _data */
+  std::shared_ptr<OutputEstimate> outputEstimate = std::make_shared<OutputEstimate>();
+
+  /* Renders started, and renders running now */
+  unsigned long renderNumber = 0;
+  int renderDepth = 0;
+
+  /* Changes of local _keywords (@see getSettingsVersion) */
+  unsigned long settingsVersion = 0;
+  /* Changes of global _keywords */
+  static std::atomic<unsigned long> globalSettingsVersion;
+
+  /* Extensions' data (@see getExtensionData) */
+  struct ExtensionEntry
+  {
+    std::shared_ptr<void> data;
+    /* data, if it's a RenderData */
+    RenderData* render = NULL;
+  };
+  typedef std::map<std::string, ExtensionEntry> ExtensionMap;
+  ExtensionMap extensionData;
+
+  static inline RenderData* renderData(RenderData* data)
+  {
+    return data;
+  }
+
+  static inline RenderData* renderData(void*)
+  {
+    return NULL;
+  }
+
 #if USEMUTEX
   static std::mutex layoutMutex;
 #endif
@@ -770,6 +2009,12 @@ private:
     /* Leave unmatched keywords */
     bool leaveUnmatchedKwds;
 
+    /* Escape keyword values */
+    bool autoEscape;
+
+    /* Minify literal text when compiling */
+    bool minify;
+
     /* Base view path */
     std::string basePath;
   } localConfig;
@@ -777,52 +2022,118 @@ private:
   void extractFile(char **ptr, std::string filename, bool usePath=true);
   void copyBuffer(char **ptr, const char* origin);
 
-  StringMap localKeywords;
+  KeywordMap localKeywords;
   FunctionMap localFunctions;
-  std::map<std::string, std::vector<StringMap > > localCollections;
+  CollectionMap localCollections;
+
+  struct CollectionSourceEntry
+  {
+    CollectionSource source;
+    long totalLines;
+  };
+  SiliconHashMap<CollectionSourceEntry> collectionSources;
+
+  SiliconHashMap<SiliconValue> localValues;
+  /* Loops over values being rendered, innermost last. Paths starting
+     with the loop path go on from its current element */
+  struct ValueScope
+  {
+    const SiliconValue::Path* path;
+    const SiliconValue* element;
+  };
+  std::vector<ValueScope> valueScopes;
 
   static std::string contentsKeyword;
   static char* layoutData;
-  static StringMap globalKeywords;
+  static std::string layoutName;
+  /* Renders copy it while setLayout() replaces it: use atomic_load() / atomic_store() */
+  static std::shared_ptr<OutputEstimate> layoutEstimate;
+  /* Compiled layout for each minify setting ([minify]) */
+  static std::shared_ptr<const SiliconTemplate> layoutCompiled[2];
+  /* layoutCompiled comes from a bundle, it's used as it was built */
+  static bool layoutBundled;
+  /* Layout file with base path, and base path to find its blocks */
+  static std::string layoutPath;
+  static std::string layoutBasePath;
+  static const Generated* layoutGenerated;
+  static unsigned long layoutGeneration[2];
+  static bool layoutReloaded;
+  static SiliconTemplateCache parseCache;
+  static KeywordMap globalKeywords;
   static FunctionMap globalFunctions;
 
   /* operators */
-  std::map<std::string, StringOperator> localConditionStringOperators;
-  std::map<std::string, LongOperator> localConditionLongOperators;
-  std::map<std::string, DoubleOperator> localConditionDoubleOperators;
+  SiliconHashMap<StringOperator> localConditionStringOperators;
+  SiliconHashMap<LongOperator> localConditionLongOperators;
+  SiliconHashMap<DoubleOperator> localConditionDoubleOperators;
 
-  static std::map<std::string, StringOperator> globalConditionStringOperators;
-  static std::map<std::string, LongOperator> globalConditionLongOperators;
-  static std::map<std::string, DoubleOperator> globalConditionDoubleOperators;
+  static SiliconHashMap<StringOperator> globalConditionStringOperators;
+  static SiliconHashMap<LongOperator> globalConditionLongOperators;
+  static SiliconHashMap<DoubleOperator> globalConditionDoubleOperators;
 
   /* caches and so... */
 
+  /* Finds keyword (local, prototype, global, then values). NULL if not
+     found. Without path, it's split from kw when values are looked up */
+  const std::string* findKeyword(const char* kw, std::size_t len, uint32_t hash, const SiliconValue::Path* path=NULL);
+  const std::string* findKeyword(const char* kw, std::size_t len)
+  {
+    return findKeyword(kw, len, SiliconHash::of(kw, len));
+  }
+  const std::string* findKeyword(const std::string& kw)
+  {
+    return findKeyword(kw.data(), kw.size(), SiliconHash::of(kw));
+  }
+
+  /* Value at path. NULL if not found */
+  const SiliconValue* findValue(const SiliconValue::Path& path);
+
+  /* Sets local keyword, reusing the memory of its current value */
+  void updateKeyword(const std::string& kw, const std::string& text);
+
   /* operator helpers */
-  std::string getOperator(std::string condition, size_t pos, std::string &b);
-  short conditionNumericAB(std::string a, std::string b, long long &lla, long long &llb);
-  short conditionDoubleAB(std::string a, std::string b, long double &lda, long double &ldb);
+  TempString getOperator(const TempString& condition, size_t pos, TempString &b);
+  short conditionNumericAB(const std::string& a, const TempString& b, long long &lla, long long &llb);
+  short conditionDoubleAB(const std::string& a, const TempString& b, long double &lda, long double &ldb);
 
   void configure();
 
+  /**
+   * Source being parsed (template, layout, block...). Positions
+   * are only calculated from here when we need them.
+   */
+  struct SourceFrame
+  {
+    const std::string* name;
+    const char* data;
+  };
+
+  /* Sources being parsed, innermost last */
+  std::vector<SourceFrame> sources;
+
+  /* Start of the tag we are parsing or computing */
+  const char* tagPosition = NULL;
+
+  /* Gets line and position of ptr inside data */
+  static void locate(const char* data, const char* ptr, long &line, long &pos);
+
+  /* Runs f with data as current source, locating exceptions there */
+  template <typename F>
+  void inSource(const std::string& name, const char* data, F f);
+
   #if SILICON_DEBUG
   struct
   {
-    long line;
-    long pos;
     long keywords;
     long functions;
-    bool update;
   } Stats;
   #endif
 
   inline void resetStats()
   {
     #if SILICON_DEBUG
-    Stats.line =1;
-    Stats.pos =1;
     Stats.keywords =0;
     Stats.functions =0;
-    Stats.update = true;
     #endif
   }
 
@@ -833,40 +2144,16 @@ private:
     #endif
   }
 
-  inline void stopStatsUpdate()
+  inline void ahead(const char ** ptr, long howmany=1)
   {
-    #if SILICON_DEBUG
-    Stats.update = false;
-    #endif
-  }
-
-  inline void ahead(char ** ptr, long howmany=1)
-  {
-    #if SILICON_DEBUG
-    while ( (howmany-->0) && (**ptr != '\0') )
-      {
-	++*ptr;
-	if (Stats.update)
-	  {
-	    ++Stats.pos;
-	    if (**ptr == '\n')
-	      {
-		Stats.line++;
-		Stats.pos=1;
-	      }
-	  }
-      }
-    Stats.update = true;
-    #else
-      *ptr+=howmany;
-    #endif
+    *ptr+=howmany;
   }
 
   inline void functionParserFill(int &status,
-				 std::string& fname, 
-				 std::map<std::string, std::string> &arguments,
-				 std::string &currentString,
-				 std::string &tempKey,
+				 TempString& fname,
+				 TempStringMap &arguments,
+				 TempString &currentString,
+				 TempString &tempKey,
 				 int &autoKey)
   {
     switch (status)
@@ -881,7 +2168,9 @@ private:
 	if (tempKey.empty())
 	  {
 	    /* empty key, use autoKey number */
-	    arguments.insert({std::to_string(autoKey++), currentString});
+	    char autoKeyStr[16];
+	    int len = snprintf(autoKeyStr, sizeof(autoKeyStr), "%d", autoKey++);
+	    arguments.insert({TempString(autoKeyStr, len), currentString});
 	  }
 	else
 	  {
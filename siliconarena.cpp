@@ -0,0 +1,155 @@
+/**
+*************************************************************
+* @file siliconarena.cpp
+* @brief Monotonic arena for render temporaries
+*
+* Parser and evaluator temporaries (keyword names, function
+* arguments, conditions...) are taken from here instead of
+* asking malloc() for every one of them.
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*   20261018 : Heap memory when no Scope is open
+*
+*************************************************************/
+
+#include "siliconarena.h"
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+  /* Every allocation will be aligned to this */
+  const std::size_t arenaAlignment = 16;
+
+  inline std::size_t alignSize(std::size_t bytes)
+  {
+    if (bytes == 0)
+      bytes = 1;
+    return (bytes + arenaAlignment - 1) & ~(arenaAlignment - 1);
+  }
+}
+
+SiliconArena::SiliconArena(std::size_t blockSize): blockSize(alignSize(blockSize)), current(0), used(0), inUse(0), depth(0)
+{
+  _stats.systemAllocations = 0;
+  _stats.allocations = 0;
+  _stats.reserved = 0;
+  _stats.peak = 0;
+  _stats.resets = 0;
+}
+
+SiliconArena::~SiliconArena()
+{
+  for (auto& b : blocks)
+    free(b.data);
+}
+
+void* SiliconArena::allocate(std::size_t bytes)
+{
+  if (depth == 0)
+    return ::operator new(bytes);
+
+  std::size_t size = alignSize(bytes);
+
+  if ( (blocks.empty()) || (used + size > blocks[current].size) )
+    {
+      /* Try blocks we had from previous renders */
+      std::size_t next = (blocks.empty())?0:current+1;
+      while ( (next<blocks.size()) && (blocks[next].size<size) )
+	++next;
+
+      if (next == blocks.size())
+	{
+	  Block b;
+	  b.size = (size>blockSize)?size:blockSize;
+	  b.data = (char*) malloc(b.size);
+	  if (b.data == NULL)
+	    throw std::bad_alloc();
+	  blocks.push_back(b);
+	  ++_stats.systemAllocations;
+	  _stats.reserved+=b.size;
+	}
+      current = next;
+      used = 0;
+    }
+
+  void* ptr = blocks[current].data + used;
+  used+=size;
+  inUse+=size;
+  ++_stats.allocations;
+  if (inUse > _stats.peak)
+    _stats.peak = inUse;
+
+  return ptr;
+}
+
+void SiliconArena::deallocate(void* ptr, std::size_t bytes)
+{
+  if (!owns(ptr))
+    {
+      ::operator delete(ptr);
+      return;
+    }
+
+  std::size_t size = alignSize(bytes);
+
+  /* Last allocation? We can use it again */
+  if ( (!blocks.empty()) && (used>=size) && (static_cast<char*>(ptr) + size == blocks[current].data + used) )
+    {
+      used-=size;
+      inUse-=size;
+    }
+}
+
+bool SiliconArena::owns(const void* ptr) const
+{
+  const char* p = static_cast<const char*>(ptr);
+  for (auto& b : blocks)
+    {
+      if ( (p >= b.data) && (p < b.data+b.size) )
+	return true;
+    }
+
+  return false;
+}
+
+SiliconArena::Mark SiliconArena::mark() const
+{
+  return { current, used, inUse };
+}
+
+void SiliconArena::rewind(const SiliconArena::Mark& m)
+{
+  current = m.block;
+  used = m.used;
+  inUse = m.inUse;
+}
+
+void SiliconArena::reset()
+{
+  current = 0;
+  used = 0;
+  inUse = 0;
+  ++_stats.resets;
+}
+
+SiliconArena& SiliconArena::local()
+{
+  static thread_local SiliconArena arena;
+  return arena;
+}
+
+SiliconArena::Scope::Scope(SiliconArena& arena): arena(arena)
+{
+  ++arena.depth;
+}
+
+SiliconArena::Scope::~Scope()
+{
+  if (--arena.depth == 0)
+    arena.reset();
+}
@@ -0,0 +1,192 @@
+/* @(#)siliconarena.h
+ */
+
+#ifndef _SILICONARENA_H
+#define _SILICONARENA_H 1
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Monotonic arena for render temporaries.
+ * Memory is taken from big blocks which are never given back while
+ * rendering. When the outermost render finishes, the arena is reset:
+ * blocks are kept, so the next render in the same thread doesn't ask
+ * the system for memory again.
+ */
+class SiliconArena
+{
+public:
+  /**
+   * Arena counters
+   */
+  struct Stats
+  {
+    /** Blocks requested to the system (malloc calls) */
+    unsigned long systemAllocations;
+    /** Allocations served by the arena */
+    unsigned long allocations;
+    /** Bytes reserved in blocks */
+    std::size_t reserved;
+    /** Maximum bytes used between two resets */
+    std::size_t peak;
+    /** Times the arena has been reset */
+    unsigned long resets;
+  };
+
+  /**
+   * Position inside the arena. We can rewind to it when everything
+   * allocated after it is not used anymore.
+   */
+  struct Mark
+  {
+    std::size_t block;
+    std::size_t used;
+    std::size_t inUse;
+  };
+
+  /**
+   * Render scope. Arena will be reset when the outermost scope
+   * finishes (even if we leave because of an exception).
+   */
+  class Scope
+  {
+  public:
+    Scope(SiliconArena& arena);
+    ~Scope();
+  private:
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    SiliconArena& arena;
+  };
+
+  /**
+   * Constructor
+   *
+   * @param blockSize Minimum size for each block
+   */
+  SiliconArena(std::size_t blockSize=16384);
+  ~SiliconArena();
+
+  /**
+   * Gets memory from the arena. Outside a Scope nothing would reset
+   * the arena, so memory comes from the heap.
+   *
+   * @param bytes How many bytes
+   *
+   * @return Pointer to memory (aligned)
+   */
+  void* allocate(std::size_t bytes);
+
+  /**
+   * Gives memory back. Only the last allocation is really
+   * recovered, the rest will be recovered when resetting. Memory
+   * not taken from the blocks goes back to the heap.
+   *
+   * @param ptr Pointer returned by allocate()
+   * @param bytes Bytes asked for
+   */
+  void deallocate(void* ptr, std::size_t bytes);
+
+  /**
+   * Current position
+   */
+  Mark mark() const;
+
+  /**
+   * Go back to a previous position. Everything allocated
+   * after the mark must be dead.
+   */
+  void rewind(const Mark& m);
+
+  /**
+   * Rewinds the whole arena. Blocks are kept.
+   */
+  void reset();
+
+  /**
+   * Gets arena counters
+   */
+  const Stats& stats() const
+  {
+    return _stats;
+  }
+
+  /**
+   * Arena for the current thread
+   */
+  static SiliconArena& local();
+
+private:
+  SiliconArena(const SiliconArena&) = delete;
+  SiliconArena& operator=(const SiliconArena&) = delete;
+
+  /* ptr is inside one of our blocks */
+  bool owns(const void* ptr) const;
+
+  struct Block
+  {
+    char* data;
+    std::size_t size;
+  };
+
+  std::vector<Block> blocks;
+  std::size_t blockSize;
+  std::size_t current;
+  std::size_t used;
+  /* Bytes given, without counting block tails we skipped */
+  std::size_t inUse;
+  int depth;
+  Stats _stats;
+};
+
+/**
+ * STL allocator taking memory from the thread's arena. It's stateless,
+ * so objects using it must live and die in the same thread and inside
+ * the same render. Out of a render, memory comes from the heap.
+ */
+template <typename T>
+struct SiliconArenaAllocator
+{
+  typedef T value_type;
+
+  SiliconArenaAllocator() noexcept
+  {
+  }
+
+  template <typename U>
+  SiliconArenaAllocator(const SiliconArenaAllocator<U>&) noexcept
+  {
+  }
+
+  template <typename U>
+  struct rebind
+  {
+    typedef SiliconArenaAllocator<U> other;
+  };
+
+  T* allocate(std::size_t n)
+  {
+    return static_cast<T*>(SiliconArena::local().allocate(n*sizeof(T)));
+  }
+
+  void deallocate(T* ptr, std::size_t n)
+  {
+    SiliconArena::local().deallocate(ptr, n*sizeof(T));
+  }
+};
+
+template <typename T, typename U>
+inline bool operator==(const SiliconArenaAllocator<T>&, const SiliconArenaAllocator<U>&)
+{
+  return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const SiliconArenaAllocator<T>&, const SiliconArenaAllocator<U>&)
+{
+  return false;
+}
+
+#endif /* _SILICONARENA_H */
@@ -0,0 +1,617 @@
+/* @(#)siliconasync.h
+ */
+
+#ifndef _SILICONASYNC_H
+#define _SILICONASYNC_H 1
+
+#if __cplusplus < 202002L
+  #error "siliconasync.h needs C++20"
+#endif
+
+#include <string>
+#include <map>
+#include <deque>
+#include <optional>
+#include <functional>
+#include <exception>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <coroutine>
+#include <memory>
+#include "silicon.h"
+
+/**
+ * Asynchronous rendering with C++20 coroutines. Async template
+ * functions return a Task<std::string>, and may co_await (a reply
+ * from a cache daemon, a file...) without blocking the thread:
+ * render() suspends there, and the thread renders other requests
+ * until the function finishes.
+ *
+ *    SiliconAsync::EventLoop loop;
+ *    SiliconAsync::setFunction(s, "profile", [&](Silicon*, Silicon::StringMap args, std::string) -> SiliconAsync::Task<std::string>
+ *      {
+ *        SiliconAsync::Pending<std::string> reply(loop);
+ *        cache.get(args["id"], [reply](std::string v) mutable { reply.set(std::move(v)); });
+ *        co_return co_await reply;
+ *      });
+ *    loop.spawn(request(s));	// request() co_awaits SiliconAsync::render(s)
+ *    loop.run();
+ *
+ * Normal functions, blocks and keywords work as usual. An instance
+ * must not be changed while its render is suspended.
+ */
+namespace SiliconAsync
+{
+  template <typename T>
+  class Task;
+
+  namespace detail
+  {
+    /* Resumes whoever awaits the task when it finishes */
+    template <typename Promise>
+    struct FinalAwaiter
+    {
+      bool await_ready() noexcept
+      {
+	return false;
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+      {
+	std::coroutine_handle<> continuation = h.promise().continuation;
+	return (continuation)?continuation:std::noop_coroutine();
+      }
+
+      void await_resume() noexcept
+      {
+      }
+    };
+
+    struct PromiseBase
+    {
+      std::coroutine_handle<> continuation;
+      std::exception_ptr error;
+
+      std::suspend_always initial_suspend() noexcept
+      {
+	return {};
+      }
+
+      void unhandled_exception() noexcept
+      {
+	error = std::current_exception();
+      }
+    };
+
+    template <typename T>
+    struct Promise : PromiseBase
+    {
+      std::optional<T> value;
+
+      Task<T> get_return_object() noexcept;
+
+      FinalAwaiter<Promise> final_suspend() noexcept
+      {
+	return {};
+      }
+
+      void return_value(T v)
+      {
+	value = std::move(v);
+      }
+
+      T result()
+      {
+	if (error)
+	  std::rethrow_exception(error);
+	return std::move(*value);
+      }
+    };
+
+    template <>
+    struct Promise<void> : PromiseBase
+    {
+      Task<void> get_return_object() noexcept;
+
+      FinalAwaiter<Promise> final_suspend() noexcept
+      {
+	return {};
+      }
+
+      void return_void() noexcept
+      {
+      }
+
+      void result()
+      {
+	if (error)
+	  std::rethrow_exception(error);
+      }
+    };
+  }
+
+  /**
+   * Coroutine result. It starts when awaited.
+   */
+  template <typename T>
+  class Task
+  {
+  public:
+    typedef detail::Promise<T> promise_type;
+
+    explicit Task(std::coroutine_handle<promise_type> h): h(h)
+    {
+    }
+
+    Task(Task&& t) noexcept: h(t.h)
+    {
+      t.h = nullptr;
+    }
+
+    Task& operator=(Task&& t) noexcept
+    {
+      if (this != &t)
+	{
+	  if (h)
+	    h.destroy();
+	  h = t.h;
+	  t.h = nullptr;
+	}
+      return *this;
+    }
+
+    ~Task()
+    {
+      if (h)
+	h.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+      return false;
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+      h.promise().continuation = awaiting;
+      return h;
+    }
+
+    T await_resume()
+    {
+      return h.promise().result();
+    }
+
+  private:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    std::coroutine_handle<promise_type> h;
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    Task<T> Promise<T>::get_return_object() noexcept
+    {
+      return Task<T>(std::coroutine_handle<Promise>::from_promise(*this));
+    }
+
+    inline Task<void> Promise<void>::get_return_object() noexcept
+    {
+      return Task<void>(std::coroutine_handle<Promise>::from_promise(*this));
+    }
+
+    /* Started tasks, nobody awaits them */
+    struct Detached
+    {
+      struct promise_type
+      {
+	Detached get_return_object() noexcept
+	{
+	  return {};
+	}
+
+	std::suspend_never initial_suspend() noexcept
+	{
+	  return {};
+	}
+
+	std::suspend_never final_suspend() noexcept
+	{
+	  return {};
+	}
+
+	void return_void() noexcept
+	{
+	}
+
+	void unhandled_exception() noexcept
+	{
+	  std::terminate();
+	}
+      };
+    };
+  }
+
+  /**
+   * Single-threaded executor. Coroutines are resumed in the thread
+   * calling run(). post() may be called from any thread.
+   */
+  class EventLoop
+  {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * Resumes h in the loop
+     */
+    void post(std::coroutine_handle<> h)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	ready.push_back(h);
+      }
+      wake.notify_one();
+    }
+
+    /**
+     * Resumes h in the loop, after delay
+     */
+    void postAfter(Clock::duration delay, std::coroutine_handle<> h)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	timers.insert({ Clock::now()+delay, h });
+      }
+      wake.notify_one();
+    }
+
+    /**
+     * co_await loop.sleep(d): suspends the coroutine for d
+     */
+    auto sleep(Clock::duration delay)
+    {
+      struct Awaiter
+      {
+	EventLoop& loop;
+	Clock::duration delay;
+
+	bool await_ready() const noexcept
+	{
+	  return false;
+	}
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+	  loop.postAfter(delay, h);
+	}
+
+	void await_resume() const noexcept
+	{
+	}
+      };
+      return Awaiter { *this, delay };
+    }
+
+    /**
+     * co_await loop.yield(): lets other coroutines run
+     */
+    auto yield()
+    {
+      return sleep(Clock::duration::zero());
+    }
+
+    /**
+     * Starts task in the loop. If it fails, run() throws its
+     * exception (the first one), when there's nothing else to do.
+     */
+    void spawn(Task<void> task)
+    {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	++running;
+      }
+      start(std::move(task));
+    }
+
+    /**
+     * Runs coroutines until all spawned tasks are finished
+     */
+    void run()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+	{
+	  /* Timers due */
+	  Clock::time_point now = Clock::now();
+	  while ( (!timers.empty()) && (timers.begin()->first <= now) )
+	    {
+	      ready.push_back(timers.begin()->second);
+	      timers.erase(timers.begin());
+	    }
+
+	  if (!ready.empty())
+	    {
+	      std::coroutine_handle<> h = ready.front();
+	      ready.pop_front();
+	      lock.unlock();
+	      h.resume();
+	      lock.lock();
+	    }
+	  else if (running == 0)
+	    break;
+	  else if (!timers.empty())
+	    wake.wait_until(lock, timers.begin()->first);
+	  else
+	    wake.wait(lock);	/* Waiting for a post() from another thread */
+	}
+
+      if (error)
+	{
+	  std::exception_ptr e = error;
+	  error = nullptr;
+	  std::rethrow_exception(e);
+	}
+    }
+
+  private:
+    detail::Detached start(Task<void> task)
+    {
+      co_await yield();
+      try
+	{
+	  co_await task;
+	}
+      catch (...)
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  if (!error)
+	    error = std::current_exception();
+	}
+      std::lock_guard<std::mutex> lock(mutex);
+      --running;
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::coroutine_handle<> > ready;
+    std::multimap<Clock::time_point, std::coroutine_handle<> > timers;
+    std::size_t running = 0;
+    std::exception_ptr error;
+  };
+
+  /**
+   * Value set later, maybe from another thread (a callback with a
+   * reply...). Copies share the value. co_await it to get the value.
+   */
+  template <typename T>
+  class Pending
+  {
+  public:
+    explicit Pending(EventLoop& loop): state(std::make_shared<State>(loop))
+    {
+    }
+
+    void set(T value)
+    {
+      finish([&](State& s)
+	     {
+	       s.value = std::move(value);
+	     });
+    }
+
+    void fail(std::exception_ptr error)
+    {
+      finish([&](State& s)
+	     {
+	       s.error = error;
+	     });
+    }
+
+    bool await_ready() const
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      return state->done;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->done)
+	return false;
+      state->waiting = h;
+      return true;
+    }
+
+    T await_resume()
+    {
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (state->error)
+	std::rethrow_exception(state->error);
+      return std::move(*state->value);
+    }
+
+  private:
+    struct State
+    {
+      explicit State(EventLoop& loop): loop(loop)
+      {
+      }
+
+      EventLoop& loop;
+      std::mutex mutex;
+      bool done = false;
+      std::optional<T> value;
+      std::exception_ptr error;
+      std::coroutine_handle<> waiting;
+    };
+
+    template <typename F>
+    void finish(F f)
+    {
+      std::coroutine_handle<> h;
+      {
+	std::lock_guard<std::mutex> lock(state->mutex);
+	if (state->done)
+	  return;
+	f(*state);
+	state->done = true;
+	h = state->waiting;
+      }
+      if (h)
+	state->loop.post(h);
+    }
+
+    std::shared_ptr<State> state;
+  };
+
+  typedef std::function<Task<std::string>(Silicon*, Silicon::StringMap, std::string)> Function;
+  typedef std::map<std::string, Function> Functions;
+
+  /**
+   * Sets async function for an instance. It's called like any other
+   * function: {!name args}}body{/name}}
+   */
+  inline void setFunction(Silicon& s, const std::string& name, Function f)
+  {
+    s.getExtensionData<Functions>("async.functions")[name] = std::move(f);
+  }
+
+  namespace detail
+  {
+    /* Walks compiled nodes. Synchronous parts are done by Silicon
+       (generatedRender() keeps the arena and error location for them),
+       nothing from the arena is kept while suspended. */
+    class Renderer
+    {
+    public:
+      Renderer(Silicon& s, const SiliconTemplate& tpl): s(s), tpl(tpl), source(tpl.source().c_str()),
+							 functions(s.getExtensionData<Functions>("async.functions"))
+      {
+      }
+
+      Task<void> evaluate(std::string& destination, std::size_t first, std::size_t last)
+      {
+	const std::vector<SiliconTemplate::Node>& nodes = tpl.nodes();
+	for (std::size_t i=first; i<last; i=nodes[i].end)
+	  {
+	    const SiliconTemplate::Node& node = nodes[i];
+	    switch (node.type)
+	      {
+	      case SiliconTemplate::Node::TEXT:
+		destination.append(source+node.pos, node.len);
+		break;
+	      case SiliconTemplate::Node::KEYWORD:
+		s.generatedRender(source, [&]()
+				  {
+				    s.generatedTag(source+node.pos);
+				    s.generatedKeyword(destination, node.name, node.escape, node.filtered, source+node.pos, node.len);
+				  });
+		break;
+	      case SiliconTemplate::Node::FUNCTION:
+		{
+		  std::string body;
+		  if (node.body)
+		    co_await evaluate(body, i+1, node.end);
+		  auto f = functions.find(node.name);
+		  if (f == functions.end())
+		    {
+		      s.generatedRender(source, [&]()
+					{
+					  s.generatedTag(source+node.pos);
+					  s.generatedFunction(destination, node.name, node.arguments, std::move(body));
+					});
+		      break;
+		    }
+		  s.generatedTag(source+node.pos);
+		  destination+=co_await f->second(&s, node.arguments, std::move(body));
+		}
+		break;
+	      case SiliconTemplate::Node::IF:
+		{
+		  /* The last condition wins */
+		  bool res = false;
+		  s.generatedRender(source, [&]()
+				    {
+				      s.generatedTag(source+node.pos);
+				      for (auto& c : node.values)
+					res = s.generatedCondition(c);
+				    });
+		  if (res)
+		    co_await evaluate(destination, i+1, node.end);
+		}
+		break;
+	      case SiliconTemplate::Node::IFFUN:
+		{
+		  bool res = false;
+		  for (auto& f : node.values)
+		    res = ( (res) || (functions.find(f) != functions.end()) );
+		  if (!res)
+		    s.generatedRender(source, [&]()
+				      {
+					s.generatedTag(source+node.pos);
+					res = s.generatedIffun(node.values);
+				      });
+		  if (res)
+		    co_await evaluate(destination, i+1, node.end);
+		}
+		break;
+	      case SiliconTemplate::Node::COLLECTION:
+		{
+		  s.generatedTag(source+node.pos);
+		  Silicon::CollectionLoop loop(s, node.name, node.arguments);
+		  while (loop.next())
+		    co_await evaluate(destination, i+1, node.end);
+		}
+		break;
+	      }
+	  }
+      }
+
+    private:
+      Silicon& s;
+      const SiliconTemplate& tpl;
+      const char* source;
+      Functions& functions;
+    };
+
+    inline Task<std::string> renderSource(Silicon& s, const std::string& name, std::shared_ptr<const SiliconTemplate> tpl)
+    {
+      std::string out;
+      Renderer renderer(s, *tpl);
+      try
+	{
+	  co_await renderer.evaluate(out, 0, tpl->nodes().size());
+	}
+      catch (SiliconException& e)
+	{
+	  s.generatedLocate(e, name, tpl->source().c_str());
+	  throw;
+	}
+      co_return out;
+    }
+  }
+
+  /**
+   * Renders template, suspending in async functions
+   *
+   * @param s Silicon instance
+   * @param useLayout Also renders layout
+   *
+   * @return output string
+   */
+  inline Task<std::string> render(Silicon& s, bool useLayout=true)
+  {
+    std::string out = co_await detail::renderSource(s, s.getTemplateName(), s.getTemplate());
+    std::shared_ptr<const SiliconTemplate> layout = (useLayout)?s.getLayoutTemplate():nullptr;
+    if (!layout)
+      co_return out;
+
+    s.setKeyword(Silicon::getContentsKeyword(), std::move(out));
+    co_return co_await detail::renderSource(s, Silicon::getLayoutName(), layout);
+  }
+}
+
+#endif /* _SILICONASYNC_H */
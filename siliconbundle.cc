@@ -0,0 +1,127 @@
+/**
+*************************************************************
+* @file siliconbundle.cc
+* @brief Compiles a views tree into a template bundle
+*
+* Usage: siliconbundle [-b basePath] [-m] -o views.bundle file|directory...
+*
+* Files and directories are relative to basePath. Directories are
+* walked recursively, hidden files are skipped. Blocks included by
+* the templates are added too. Load the result with
+* SiliconBundle::load("views.bundle", basePath). With -m, literal
+* text is minified (see Silicon::setMinify()).
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "siliconbundle.h"
+
+namespace
+{
+  std::string join(const std::string& dir, const std::string& name)
+  {
+    if ( (dir.empty()) || (dir == ".") )
+      return name;
+
+    return (dir.back() == '/')?dir+name:dir+"/"+name;
+  }
+
+  /* Adds path (relative to basePath) or the files below it */
+  void addFiles(const std::string& basePath, const std::string& path, std::vector<std::string>& files)
+  {
+    std::string full = (basePath.empty())?path:join(basePath, path);
+    struct stat st;
+    if (stat(full.c_str(), &st) != 0)
+      {
+	std::cerr << "siliconbundle: " << full << " not found\n";
+	exit(2);
+      }
+
+    if (!S_ISDIR(st.st_mode))
+      {
+	files.push_back(path);
+	return;
+      }
+
+    DIR* dir = opendir(full.c_str());
+    if (!dir)
+      return;
+
+    std::vector<std::string> names;
+    struct dirent* ent;
+    while ( (ent = readdir(dir)) != NULL)
+      {
+	if (ent->d_name[0] != '.')
+	  names.push_back(ent->d_name);
+      }
+    closedir(dir);
+
+    /* Same input, same bundle */
+    std::sort(names.begin(), names.end());
+    for (auto& n : names)
+      addFiles(basePath, join(path, n), files);
+  }
+
+  void usage()
+  {
+    std::cerr << "Usage: siliconbundle [-b basePath] [-m] -o views.bundle file|directory...\n";
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::string basePath;
+  std::string output;
+  std::vector<std::string> paths;
+
+  for (int i=1; i<argc; ++i)
+    {
+      std::string arg = argv[i];
+      if ( ( (arg == "-b") || (arg == "-o") ) && (i+1<argc) )
+	((arg == "-b")?basePath:output) = argv[++i];
+      else if (arg == "-m")
+	Silicon::setMinifyGlobal(true);
+      else if ( (arg.empty()) || (arg[0] == '-') )
+	{
+	  usage();
+	  return 1;
+	}
+      else
+	paths.push_back(arg);
+    }
+
+  if ( (paths.empty()) || (output.empty()) )
+    {
+      usage();
+      return 1;
+    }
+
+  std::vector<std::string> files;
+  for (auto& p : paths)
+    addFiles(basePath, p, files);
+
+  try
+    {
+      SiliconBundle::write(output, files, basePath);
+    }
+  catch (SiliconException& e)
+    {
+      std::cerr << "siliconbundle: " << e.what() << "\n";
+      return 2;
+    }
+
+  std::cout << files.size() << " templates written to " << output << "\n";
+  return 0;
+}
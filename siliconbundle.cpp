@@ -0,0 +1,427 @@
+/**
+*************************************************************
+* @file siliconbundle.cpp
+* @brief Precompiled template bundles
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include "siliconbundle.h"
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+std::atomic<bool> SiliconBundle::_loaded(false);
+char* SiliconBundle::mapping = NULL;
+std::size_t SiliconBundle::mappingSize = 0;
+bool SiliconBundle::verify = true;
+std::string SiliconBundle::basePath;
+std::map<std::string, SiliconBundle::Entry> SiliconBundle::entries;
+SiliconBundle::Stats SiliconBundle::_stats = { 0, 0, 0 };
+#if USEMUTEX
+std::mutex SiliconBundle::mutex;
+#endif
+
+namespace
+{
+  const char bundleMagic[8] = { 'S', 'I', 'L', 'B', 'N', 'D', 'L', '\0' };
+  const uint32_t byteOrder = 0x01020304;
+
+  void fileTime(const std::string& path, int64_t& mtime, int64_t& size)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+      {
+#ifdef __linux__
+	mtime = st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+#else
+	mtime = st.st_mtime*1000000000LL;
+#endif
+	size = st.st_size;
+      }
+    else
+      {
+	mtime = 0;
+	size = -1;
+      }
+  }
+
+  /* Tables start at 8 byte boundaries */
+  void align(std::string& out)
+  {
+    out.append((8 - out.size()%8)%8, '\0');
+  }
+
+  template <typename T>
+  uint64_t appendTable(std::string& out, const std::vector<T>& table)
+  {
+    align(out);
+    uint64_t offset = out.size();
+    if (!table.empty())
+      out.append((const char*) table.data(), table.size()*sizeof(T));
+
+    return offset;
+  }
+
+  /* Is [offset, offset+len) inside size? */
+  bool inside(uint64_t offset, uint64_t len, uint64_t size)
+  {
+    return ( (offset <= size) && (len <= size-offset) );
+  }
+}
+
+void SiliconBundle::write(const std::string& bundleFile, const std::vector<std::string>& files, const std::string& basePath)
+{
+  Silicon compiler = Silicon::createFromStr("");
+  compiler.localConfig.basePath = basePath;
+
+  std::vector<Template> templates;
+  std::vector<Node> nodes;
+  std::vector<Arg> args;
+  std::vector<uint32_t> deps;
+  std::vector<String> strings;
+  std::map<std::string, uint32_t> ids;
+  std::string pool;
+
+  auto intern = [&](const std::string& s) -> uint32_t
+    {
+      auto i = ids.find(s);
+      if (i != ids.end())
+	return i->second;
+
+      strings.push_back({ (uint32_t) pool.size(), (uint32_t) s.size() });
+      pool+=s;
+      ids.insert({ s, strings.size()-1 });
+      return strings.size()-1;
+    };
+
+  /* Blocks found are compiled too */
+  std::vector<std::string> pending(files);
+  std::set<std::string> seen(files.begin(), files.end());
+  for (std::size_t i=0; i<pending.size(); ++i)
+    {
+      std::string file = pending[i];
+      char* data = NULL;
+      compiler.extractFile(&data, file);
+      std::shared_ptr<const SiliconTemplate> tpl;
+      try
+	{
+	  tpl = compiler.compileSource(file, data, strlen(data));
+	}
+      catch (...)
+	{
+	  free(data);
+	  throw;
+	}
+      free(data);
+
+      Template t;
+      t.path = intern(file);
+      t.source = intern(tpl->source());
+      t.firstNode = nodes.size();
+      t.nodes = tpl->nodes().size();
+      t.firstDep = deps.size();
+      /* Files are compared with the source, without minified text */
+      t.hash = SiliconTemplate::hash(tpl->source().data(), tpl->length());
+      fileTime(Silicon::filePath(file, basePath), t.mtime, t.size);
+
+      for (auto& node : tpl->nodes())
+	{
+	  Node n;
+	  n.type = node.type;
+	  n.escape = node.escape;
+	  n.filtered = node.filtered;
+	  n.body = node.body;
+	  n.name = intern(node.name);
+	  n.pos = node.pos;
+	  n.len = node.len;
+	  n.end = node.end;
+	  n.firstArg = args.size();
+	  for (auto& a : node.arguments)
+	    args.push_back({ intern(a.first), intern(a.second) });
+	  for (auto& v : node.values)
+	    args.push_back({ none, intern(v) });
+	  n.args = args.size()-n.firstArg;
+	  nodes.push_back(n);
+
+	  if ( (node.type != SiliconTemplate::Node::FUNCTION) || (node.name != "block") )
+	    continue;
+
+	  auto block = node.arguments.find("template");
+	  if (block == node.arguments.end())
+	    continue;
+
+	  deps.push_back(intern(block->second));
+	  struct stat st;
+	  if ( (seen.insert(block->second).second) && (stat(Silicon::filePath(block->second, basePath).c_str(), &st) == 0) )
+	    pending.push_back(block->second);
+	}
+      t.deps = deps.size()-t.firstDep;
+      templates.push_back(t);
+    }
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, bundleMagic, sizeof(h.magic));
+  h.version = version;
+  h.byteOrder = byteOrder;
+  h.templates = templates.size();
+  h.nodes = nodes.size();
+  h.args = args.size();
+  h.deps = deps.size();
+  h.strings = strings.size();
+
+  std::string out((const char*) &h, sizeof(h));
+  h.templateTable = appendTable(out, templates);
+  h.nodeTable = appendTable(out, nodes);
+  h.argTable = appendTable(out, args);
+  h.depTable = appendTable(out, deps);
+  h.stringTable = appendTable(out, strings);
+  align(out);
+  h.pool = out.size();
+  out+=pool;
+  h.size = out.size();
+  memcpy(&out[0], &h, sizeof(h));
+
+  std::ofstream fd(bundleFile, std::ios::binary);
+  fd.write(out.data(), out.size());
+  fd.close();
+  if (fd.fail())
+    throw SiliconException(30, "Can't write bundle "+bundleFile, 0, 0);
+}
+
+void SiliconBundle::load(const std::string& bundleFile, const std::string& basePath, bool verify)
+{
+  int fd = open(bundleFile.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw SiliconException(27, "Can't open bundle "+bundleFile, 0, 0);
+
+  struct stat st;
+  void* data = MAP_FAILED;
+  if ( (fstat(fd, &st) == 0) && (st.st_size > 0) )
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    throw SiliconException(27, "Can't map bundle "+bundleFile, 0, 0);
+
+  try
+    {
+      validate((const char*) data, st.st_size);
+    }
+  catch (...)
+    {
+      munmap(data, st.st_size);
+      throw;
+    }
+
+  unload();
+
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  mapping = (char*) data;
+  mappingSize = st.st_size;
+  SiliconBundle::verify = verify;
+  SiliconBundle::basePath = basePath;
+
+  const Header* h = (const Header*) mapping;
+  const Template* templates = (const Template*) (mapping+h->templateTable);
+  for (uint32_t i=0; i<h->templates; ++i)
+    entries[Silicon::filePath(string(templates[i].path), basePath)] = { &templates[i], UNCHECKED, std::shared_ptr<const SiliconTemplate>() };
+
+  _stats.templates = entries.size();
+  _stats.used = 0;
+  _stats.fallbacks = 0;
+  _loaded.store(true, std::memory_order_release);
+}
+
+void SiliconBundle::unload()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  _loaded.store(false, std::memory_order_release);
+  entries.clear();
+  if (mapping)
+    munmap(mapping, mappingSize);
+  mapping = NULL;
+  mappingSize = 0;
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconBundle::get(const std::string& path)
+{
+  if (!loaded())
+    return std::shared_ptr<const SiliconTemplate>();
+
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  auto e = entries.find(path);
+  if (e == entries.end())
+    return std::shared_ptr<const SiliconTemplate>();
+
+  Entry& entry = e->second;
+  if (entry.state == UNCHECKED)
+    {
+      entry.state = ( (!verify) || (unchanged(path, *entry.tpl)) )?VALID:CHANGED;
+      if (entry.state == CHANGED)
+	++_stats.fallbacks;
+    }
+
+  if (entry.state == CHANGED)
+    return std::shared_ptr<const SiliconTemplate>();
+
+  if (!entry.compiled)
+    {
+      entry.compiled = build(*entry.tpl);
+      ++_stats.used;
+    }
+
+  return entry.compiled;
+}
+
+std::vector<std::string> SiliconBundle::dependencies(const std::string& path)
+{
+  std::vector<std::string> res;
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  auto e = entries.find(path);
+  if (e == entries.end())
+    return res;
+
+  const Header* h = (const Header*) mapping;
+  const uint32_t* deps = (const uint32_t*) (mapping+h->depTable);
+  for (uint32_t i=0; i<e->second.tpl->deps; ++i)
+    res.push_back(Silicon::filePath(string(deps[e->second.tpl->firstDep+i]), basePath));
+
+  return res;
+}
+
+SiliconBundle::Stats SiliconBundle::stats()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  return _stats;
+}
+
+void SiliconBundle::validate(const char* data, std::size_t size)
+{
+  const Header* h = (const Header*) data;
+  if ( (size < sizeof(Header)) || (memcmp(h->magic, bundleMagic, sizeof(h->magic)) != 0) )
+    throw SiliconException(28, "Not a template bundle", 0, 0);
+
+  if ( (h->version != version) || (h->byteOrder != byteOrder) )
+    throw SiliconException(29, "Unsupported bundle version "+std::to_string(h->version), 0, 0);
+
+  if ( (h->size != size) ||
+       (!inside(h->templateTable, (uint64_t) h->templates*sizeof(Template), size)) ||
+       (!inside(h->nodeTable, (uint64_t) h->nodes*sizeof(Node), size)) ||
+       (!inside(h->argTable, (uint64_t) h->args*sizeof(Arg), size)) ||
+       (!inside(h->depTable, (uint64_t) h->deps*sizeof(uint32_t), size)) ||
+       (!inside(h->stringTable, (uint64_t) h->strings*sizeof(String), size)) ||
+       (!inside(h->pool, 0, size)) ||
+       ( (h->templateTable | h->nodeTable | h->argTable | h->depTable | h->stringTable) % 8 != 0) )
+    throw SiliconException(28, "Corrupt bundle tables", 0, 0);
+
+  const String* strings = (const String*) (data+h->stringTable);
+  for (uint32_t i=0; i<h->strings; ++i)
+    {
+      if (!inside(strings[i].offset, strings[i].len, size-h->pool))
+	throw SiliconException(28, "Corrupt bundle strings", 0, 0);
+    }
+
+  const uint32_t* deps = (const uint32_t*) (data+h->depTable);
+  for (uint32_t i=0; i<h->deps; ++i)
+    {
+      if (deps[i] >= h->strings)
+	throw SiliconException(28, "Corrupt bundle dependencies", 0, 0);
+    }
+
+  const Template* templates = (const Template*) (data+h->templateTable);
+  for (uint32_t i=0; i<h->templates; ++i)
+    {
+      const Template& t = templates[i];
+      if ( (t.path >= h->strings) || (t.source >= h->strings) ||
+	   (!inside(t.firstNode, t.nodes, h->nodes)) || (!inside(t.firstDep, t.deps, h->deps)) )
+	throw SiliconException(28, "Corrupt bundle templates", 0, 0);
+    }
+}
+
+bool SiliconBundle::unchanged(const std::string& path, const SiliconBundle::Template& tpl)
+{
+  int64_t mtime, size;
+  fileTime(path, mtime, size);
+  /* Not deployed, the bundle is all we have */
+  if ( (size < 0) || ( (size == tpl.size) && (mtime == tpl.mtime) ) )
+    return true;
+
+  std::ifstream fd(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(fd)), std::istreambuf_iterator<char>());
+  const Header* h = (const Header*) mapping;
+  const String& source = ((const String*) (mapping+h->stringTable))[tpl.source];
+  /* Minified text goes after the source */
+  const char* text = mapping+h->pool+source.offset;
+  std::size_t len = strnlen(text, source.len);
+
+  return ( (data.size() == len) &&
+	   (SiliconTemplate::hash(data.data(), data.size()) == tpl.hash) &&
+	   (memcmp(data.data(), text, len) == 0) );
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconBundle::build(const SiliconBundle::Template& tpl)
+{
+  const Header* h = (const Header*) mapping;
+  const String& source = ((const String*) (mapping+h->stringTable))[tpl.source];
+  const Node* nodes = (const Node*) (mapping+h->nodeTable) + tpl.firstNode;
+  const Arg* args = (const Arg*) (mapping+h->argTable);
+
+  std::shared_ptr<SiliconTemplate> res = std::make_shared<SiliconTemplate>(mapping+h->pool+source.offset, source.len);
+  for (uint32_t i=0; i<tpl.nodes; ++i)
+    {
+      const Node& n = nodes[i];
+      if ( (n.type > SiliconTemplate::Node::COLLECTION) || (n.escape > SiliconEscape::STYLE) || (n.name >= h->strings) ||
+	   (!inside(n.pos, n.len, source.len)) || (n.end <= i) || (n.end > tpl.nodes) || (!inside(n.firstArg, n.args, h->args)) )
+	throw SiliconException(28, "Corrupt bundle node", 0, 0);
+
+      std::size_t index = res->add((SiliconTemplate::Node::Type) n.type, n.pos, n.len);
+      SiliconTemplate::Node& node = res->node(index);
+      node.end = n.end;
+      node.name = string(n.name);
+      node.escape = (SiliconEscape::Context) n.escape;
+      node.filtered = n.filtered;
+      node.body = n.body;
+      for (uint32_t a=n.firstArg; a<n.firstArg+n.args; ++a)
+	{
+	  if ( ( (args[a].key != none) && (args[a].key >= h->strings) ) || (args[a].value >= h->strings) )
+	    throw SiliconException(28, "Corrupt bundle arguments", 0, 0);
+
+	  if (args[a].key == none)
+	    node.values.push_back(string(args[a].value));
+	  else
+	    node.arguments.insert({ string(args[a].key), string(args[a].value) });
+	}
+    }
+  res->hashNames();
+
+  return res;
+}
+
+std::string SiliconBundle::string(uint32_t id)
+{
+  const Header* h = (const Header*) mapping;
+  const String& s = ((const String*) (mapping+h->stringTable))[id];
+
+  return std::string(mapping+h->pool+s.offset, s.len);
+}
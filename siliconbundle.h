@@ -0,0 +1,216 @@
+/* @(#)siliconbundle.h
+ */
+
+#ifndef _SILICONBUNDLE_H
+#define _SILICONBUNDLE_H 1
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "silicon.h"
+#include "silicontemplate.h"
+
+#if USEMUTEX
+  #include <mutex>
+#endif
+
+/**
+ * Precompiled template bundles. A build step compiles a whole views
+ * tree into one file (see write(), or the siliconbundle tool), and
+ * programs mmap it at startup (load()). Templates, layouts and blocks
+ * found in the bundle are not read nor tokenized: nodes are taken
+ * from the mapped file the first time they are used.
+ *
+ * Paths are stored relative to the views directory, so a bundle can
+ * be moved with it. Each template keeps its source hash, size and
+ * modification time: if the file on disk changed, the bundle is not
+ * used for it and the source is compiled as usual. If the file is not
+ * there, the bundle version is used.
+ *
+ * File format (version 1, native byte order, all offsets from file start):
+ *   Header
+ *   Template[templates]   path, source, nodes, dependencies, hash, mtime, size
+ *   Node[nodes]           as SiliconTemplate::Node, names as string ids
+ *   Arg[args]             key and value string ids (no key for values)
+ *   uint32_t[deps]        blocks included by each template (string ids)
+ *   String[strings]       interned strings: offset in pool, length
+ *   pool                  string bytes, sources included
+ */
+class SiliconBundle
+{
+public:
+  struct Stats
+  {
+    /** Templates in the bundle */
+    std::size_t templates;
+    /** Templates taken from the bundle */
+    unsigned long used;
+    /** Templates changed on disk, compiled from source */
+    unsigned long fallbacks;
+  };
+
+  /**
+   * Compiles templates and writes a bundle. Blocks included by them
+   * are added too.
+   *
+   * @param bundleFile Bundle to write
+   * @param files Templates, relative to basePath
+   * @param basePath Views directory
+   */
+  static void write(const std::string& bundleFile, const std::vector<std::string>& files, const std::string& basePath);
+
+  /**
+   * Maps a bundle. Templates are found by their path in basePath,
+   * like Silicon instances created with the same base path find them.
+   * Replaces the bundle loaded before. Throws SiliconException.
+   *
+   * @param bundleFile Bundle file
+   * @param basePath Views directory
+   * @param verify Compare templates with the files on disk
+   */
+  static void load(const std::string& bundleFile, const std::string& basePath, bool verify=true);
+
+  /**
+   * Unmaps the bundle. Templates already taken remain valid.
+   */
+  static void unload();
+
+  /**
+   * Is a bundle loaded?
+   */
+  static bool loaded()
+  {
+    return _loaded.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Gets compiled template for a file
+   *
+   * @param path File path (base path included)
+   *
+   * @return compiled template, or empty pointer if it's not in the
+   * bundle or changed
+   */
+  static std::shared_ptr<const SiliconTemplate> get(const std::string& path);
+
+  /**
+   * Blocks included by a template
+   *
+   * @param path File path (base path included)
+   */
+  static std::vector<std::string> dependencies(const std::string& path);
+
+  /**
+   * Gets counters
+   */
+  static Stats stats();
+
+private:
+  static const uint32_t version = 1;
+  static const uint32_t none = 0xffffffff;
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    /* 0x01020304 as written, a bundle from another architecture won't load */
+    uint32_t byteOrder;
+    uint32_t templates;
+    uint32_t nodes;
+    uint32_t args;
+    uint32_t deps;
+    uint32_t strings;
+    uint32_t reserved;
+    uint64_t templateTable;
+    uint64_t nodeTable;
+    uint64_t argTable;
+    uint64_t depTable;
+    uint64_t stringTable;
+    uint64_t pool;
+    uint64_t size;
+  };
+
+  struct Template
+  {
+    uint32_t path;
+    uint32_t source;
+    uint32_t firstNode;
+    uint32_t nodes;
+    uint32_t firstDep;
+    uint32_t deps;
+    uint64_t hash;
+    int64_t mtime;
+    int64_t size;
+  };
+
+  struct Node
+  {
+    uint8_t type;
+    uint8_t escape;
+    uint8_t filtered;
+    uint8_t body;
+    uint32_t name;
+    uint32_t pos;
+    uint32_t len;
+    uint32_t end;
+    uint32_t firstArg;
+    uint32_t args;
+  };
+
+  struct Arg
+  {
+    uint32_t key;
+    uint32_t value;
+  };
+
+  struct String
+  {
+    uint32_t offset;
+    uint32_t len;
+  };
+
+  enum State
+    {
+      UNCHECKED,
+      VALID,
+      CHANGED
+    };
+
+  /* Template in the mapped bundle */
+  struct Entry
+  {
+    const Template* tpl;
+    State state;
+    std::shared_ptr<const SiliconTemplate> compiled;
+  };
+
+  /* Checks every table and string is inside the file */
+  static void validate(const char* data, std::size_t size);
+
+  /* Is the file on disk the one in the bundle? */
+  static bool unchanged(const std::string& path, const Template& tpl);
+
+  /* Builds SiliconTemplate from mapped nodes */
+  static std::shared_ptr<const SiliconTemplate> build(const Template& tpl);
+
+  static std::string string(uint32_t id);
+
+  static std::atomic<bool> _loaded;
+  /* Mapped file */
+  static char* mapping;
+  static std::size_t mappingSize;
+  static bool verify;
+  static std::string basePath;
+  /* Full path -> template */
+  static std::map<std::string, Entry> entries;
+  static Stats _stats;
+#if USEMUTEX
+  static std::mutex mutex;
+#endif
+};
+
+#endif /* _SILICONBUNDLE_H */
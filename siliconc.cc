@@ -0,0 +1,407 @@
+/**
+*************************************************************
+* @file siliconc.cc
+* @brief Translates templates to C++ render functions
+*
+* Usage: siliconc [-b basePath] [-m] [-o output.cpp] template...
+*
+* Templates are compiled with the same parser used when rendering,
+* so syntax errors are found at build time. Output has one render
+* function per template, which registers itself with
+* Silicon::addGenerated() when the program starts. Link it with the
+* program and templates created from these files will be rendered by
+* the generated code, as long as their source doesn't change.
+* With -m, literal text is minified (see Silicon::setMinify()).
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*   20261018 : Conditions compiled to comparisons of keyword slots
+*
+*************************************************************/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include "silicon.h"
+
+namespace
+{
+  /* C++ literal for text */
+  std::string quote(const std::string& text, bool splitLines=false)
+  {
+    std::string res = "\"";
+    for (std::size_t i=0; i<text.size(); ++i)
+      {
+	unsigned char c = text[i];
+	switch (c)
+	  {
+	  case '\\': res+="\\\\"; break;
+	  case '"': res+="\\\""; break;
+	  case '?': res+="\\?"; break; /* trigraphs */
+	  case '\t': res+="\\t"; break;
+	  case '\r': res+="\\r"; break;
+	  case '\n':
+	    res+="\\n";
+	    if ( (splitLines) && (i+1<text.size()) )
+	      res+="\"\n  \"";
+	    break;
+	  default:
+	    if ( (c < 0x20) || (c >= 0x7f) )
+	      {
+		char oct[5];
+		snprintf(oct, sizeof(oct), "\\%03o", c);
+		res+=oct;
+	      }
+	    else
+	      res+=c;
+	  }
+      }
+
+    return res+"\"";
+  }
+
+  const char* escapeName(SiliconEscape::Context escape)
+  {
+    switch (escape)
+      {
+      case SiliconEscape::HTML: return "SiliconEscape::HTML";
+      case SiliconEscape::ATTRIBUTE: return "SiliconEscape::ATTRIBUTE";
+      case SiliconEscape::URL: return "SiliconEscape::URL";
+      case SiliconEscape::SCRIPT: return "SiliconEscape::SCRIPT";
+      case SiliconEscape::STYLE: return "SiliconEscape::STYLE";
+      default: return "SiliconEscape::NONE";
+      }
+  }
+
+  std::string stringMap(const std::map<std::string, std::string>& m)
+  {
+    std::string res = "{";
+    for (auto& i : m)
+      res+=" { "+quote(i.first)+", "+quote(i.second)+" },";
+    if (!m.empty())
+      res.pop_back();
+
+    return res+" }";
+  }
+
+  /**
+   * Writes render code for a template
+   */
+  class Generator
+  {
+  public:
+    Generator(const SiliconTemplate& tpl, const std::string& id): tpl(tpl), id(id)
+    {
+    }
+
+    /* Static data (names, arguments...) */
+    std::ostringstream data;
+    /* Render function body */
+    std::ostringstream code;
+    /* Keyword -> slot */
+    std::map<std::string, std::size_t> slots;
+
+    void nodes(std::size_t first, std::size_t last, const std::string& out, int level)
+    {
+      const std::vector<SiliconTemplate::Node>& n = tpl.nodes();
+      for (std::size_t i=first; i<last; i=n[i].end)
+	node(i, out, level);
+    }
+
+  private:
+    const SiliconTemplate& tpl;
+    std::string id;
+
+    std::string indent(int level)
+    {
+      return std::string(level*2, ' ');
+    }
+
+    /* Name for static data of node (or slot) i */
+    std::string name(const char* what, std::size_t i)
+    {
+      return what+id+"_"+std::to_string(i);
+    }
+
+    std::string tag(const SiliconTemplate::Node& node)
+    {
+      return "source"+id+"+"+std::to_string(node.pos);
+    }
+
+    /* Every keyword is looked up once, while keywords are not added or removed */
+    std::size_t slot(const std::string& keyword)
+    {
+      auto s = slots.find(keyword);
+      if (s == slots.end())
+	{
+	  s = slots.insert({ keyword, slots.size() }).first;
+	  data << "  const std::string " << name("kw", s->second) << "(" << quote(keyword) << ");\n";
+	}
+
+      return s->second;
+    }
+
+    /**
+     * C++ test for a condition, split as Silicon::evaluateCondition()
+     * does: operands are keyword slots, the operator is a comparison.
+     * Empty when it must be evaluated when rendering: custom operators
+     * (!op!) and errors, thrown there.
+     *
+     * @param cond Condition
+     * @param cname Name for its static data
+     */
+    std::string condition(const std::string& cond, const std::string& cname)
+    {
+      std::size_t start = 0;
+      bool invert = false;
+      std::size_t op = cond.find_first_of("!<>=");
+      if ( (op == 0) && (cond[0] == '!') )
+	{
+	  invert = true;
+	  start = 1;
+	  op = cond.find_first_of("!<>=", start);
+	}
+
+      if (op == std::string::npos)
+	{
+	  std::string a = cond.substr(start);
+	  if (a.empty())
+	    return "";
+	  /* Numbers are not inverted */
+	  else if (std::all_of(a.begin(), a.end(), ::isdigit))
+	    return (a.find_first_not_of('0') != std::string::npos)?"true":"false";
+
+	  std::size_t s = slot(a);
+	  return std::string((invert)?"!":"")+"Silicon::generatedTrue(s.generatedOperand("+std::to_string(s)+", "+name("kw", s)+"))";
+	}
+
+      char next = cond[op+1];
+      std::size_t oplen = 1;
+      const char* test;
+      switch (cond[op])
+	{
+	case '!':
+	  if (next != '=')
+	    return "";
+	  test = "!= 0";
+	  oplen = 2;
+	  break;
+	case '=':
+	  test = "== 0";
+	  oplen = (next == '=')?2:1;
+	  break;
+	case '<':
+	  test = (next == '=')?"<= 0":(next == '>')?"!= 0":"< 0";
+	  oplen = ( (next == '=') || (next == '>') )?2:1;
+	  break;
+	default:
+	  test = (next == '=')?">= 0":"> 0";
+	  oplen = (next == '=')?2:1;
+	}
+
+      std::string b = cond.substr(op+oplen);
+      if (b.empty())
+	return "";
+
+      std::size_t a = slot(cond.substr(start, op-start));
+      std::string left = "s.generatedOperand("+std::to_string(a)+", "+name("kw", a)+")";
+      std::string right;
+      bool quoted = ( (b.front() == '"') && (b.back() == '"') );
+      if (quoted)
+	{
+	  data << "  const std::string " << cname << "(" << quote((b.size() > 1)?b.substr(1, b.size()-2):"") << ");\n";
+	  right = cname;
+	}
+      else
+	{
+	  /* A keyword, or the text itself */
+	  std::size_t s = slot(b);
+	  data << "  const std::string " << cname << "(" << quote(b) << ");\n";
+	  right = "s.generatedOperand("+std::to_string(s)+", "+name("kw", s)+", "+cname+")";
+	}
+
+      std::string compare = "Silicon::generatedCompare("+left+", "+right+", "+((quoted)?"false":"true")+") "+test;
+
+      return (invert)?"!("+compare+")":compare;
+    }
+
+    void node(std::size_t i, const std::string& out, int level)
+    {
+      const SiliconTemplate::Node& node = tpl.nodes()[i];
+      std::string in = indent(level);
+      switch (node.type)
+	{
+	case SiliconTemplate::Node::TEXT:
+	  /* Literal runs point to the source, they are never copied */
+	  code << in << out << ".append(" << tag(node) << ", " << node.len << ");\n";
+	  break;
+	case SiliconTemplate::Node::KEYWORD:
+	  {
+	    std::size_t s = slot(node.name);
+	    code << in << "s.generatedKeyword(" << out << ", " << s << ", " << name("kw", s) << ", "
+		 << escapeName(node.escape) << ", " << ((node.filtered)?"true":"false") << ", " << tag(node) << ", " << node.len << ");\n";
+	  }
+	  break;
+	case SiliconTemplate::Node::FUNCTION:
+	  {
+	    std::string body = name("body", i);
+	    data << "  const std::string " << name("fn", i) << "(" << quote(node.name) << ");\n";
+	    data << "  const Silicon::StringMap " << name("args", i) << " = " << stringMap(node.arguments) << ";\n";
+	    code << in << "{\n"
+		 << in << "  std::string " << body << ";\n";
+	    nodes(i+1, node.end, body, level+1);
+	    code << in << "  s.generatedTag(" << tag(node) << ");\n"
+		 << in << "  s.generatedFunction(" << out << ", " << name("fn", i) << ", " << name("args", i) << ", std::move(" << body << "));\n"
+		 << in << "}\n";
+	  }
+	  break;
+	case SiliconTemplate::Node::IF:
+	  {
+	    /* No conditions, never true */
+	    if (node.values.empty())
+	      break;
+
+	    code << in << "s.generatedTag(" << tag(node) << ");\n";
+	    /* The last condition wins. Others are evaluated only if they may throw */
+	    for (std::size_t c=0; c<node.values.size(); ++c)
+	      {
+		std::string cond = name("cond", i)+"_"+std::to_string(c);
+		std::string test = condition(node.values[c], cond);
+		if (test.empty())
+		  {
+		    data << "  const std::string " << cond << "(" << quote(node.values[c]) << ");\n";
+		    test = "s.generatedCondition("+cond+")";
+		    if (c+1<node.values.size())
+		      code << in << test << ";\n";
+		  }
+		if (c+1==node.values.size())
+		  code << in << "if (" << test << ")\n";
+	      }
+	    block(i, out, level);
+	  }
+	  break;
+	case SiliconTemplate::Node::IFFUN:
+	  {
+	    data << "  const std::vector<std::string> " << name("iffun", i) << " = {";
+	    for (std::size_t f=0; f<node.values.size(); ++f)
+	      data << ((f)?", ":" ") << quote(node.values[f]);
+	    data << " };\n";
+	    code << in << "s.generatedTag(" << tag(node) << ");\n"
+		 << in << "if (s.generatedIffun(" << name("iffun", i) << "))\n";
+	    block(i, out, level);
+	  }
+	  break;
+	case SiliconTemplate::Node::COLLECTION:
+	  data << "  const std::string " << name("coll", i) << "(" << quote(node.name) << ");\n";
+	  data << "  const Silicon::StringMap " << name("args", i) << " = " << stringMap(node.arguments) << ";\n";
+	  code << in << "s.generatedTag(" << tag(node) << ");\n"
+	       << in << "s.generatedCollection(" << name("coll", i) << ", " << name("args", i) << ", [&]()\n";
+	  block(i, out, level);
+	  code << in << ");\n";
+	  break;
+	}
+    }
+
+    /* Body of node i in braces */
+    void block(std::size_t i, const std::string& out, int level)
+    {
+      code << indent(level+1) << "{\n";
+      nodes(i+1, tpl.nodes()[i].end, out, level+2);
+      code << indent(level+1) << "}\n";
+    }
+  };
+
+  void usage()
+  {
+    std::cerr << "Usage: siliconc [-b basePath] [-m] [-o output.cpp] template...\n";
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  std::string basePath;
+  std::string output;
+  std::vector<std::string> templates;
+
+  for (int i=1; i<argc; ++i)
+    {
+      std::string arg = argv[i];
+      if ( ( (arg == "-b") || (arg == "-o") ) && (i+1<argc) )
+	((arg == "-b")?basePath:output) = argv[++i];
+      else if (arg == "-m")
+	Silicon::setMinifyGlobal(true);
+      else if ( (arg.empty()) || (arg[0] == '-') )
+	{
+	  usage();
+	  return 1;
+	}
+      else
+	templates.push_back(arg);
+    }
+
+  if (templates.empty())
+    {
+      usage();
+      return 1;
+    }
+
+  std::ostringstream res;
+  res << "/* Generated by siliconc. Don't edit, changes will be lost */\n\n"
+      << "#include <string>\n"
+      << "#include <vector>\n"
+      << "#include \"silicon.h\"\n\n"
+      << "namespace\n{\n";
+
+  for (std::size_t t=0; t<templates.size(); ++t)
+    {
+      std::shared_ptr<const SiliconTemplate> tpl;
+      try
+	{
+	  Silicon s = Silicon::createFromFile(templates[t], basePath);
+	  tpl = s.getTemplate();
+	}
+      catch (SiliconException& e)
+	{
+	  std::cerr << "siliconc: " << templates[t] << ": " << e.what() << "\n";
+	  return 2;
+	}
+
+      std::string id = std::to_string(t);
+      Generator gen(*tpl, id);
+      gen.nodes(0, tpl->nodes().size(), "out", 2);
+
+      res << "  /* " << templates[t] << " */\n"
+	  << "  const char source" << id << "[] = " << quote(tpl->source(), true) << ";\n"
+	  << gen.data.str()
+	  << "\n"
+	  << "  void render" << id << "(Silicon& s, std::string& out)\n"
+	  << "  {\n"
+	  << gen.code.str()
+	  << "  }\n\n"
+	  << "  const bool added" << id << " = Silicon::addGenerated({ " << quote(templates[t]) << ", source" << id
+	  << ", " << tpl->length() << ", render" << id << ", " << gen.slots.size() << ", 0 });\n\n";
+    }
+  res << "}\n";
+
+  if (output.empty())
+    std::cout << res.str();
+  else
+    {
+      std::ofstream fd(output);
+      fd << res.str();
+      if (fd.fail())
+	{
+	  std::cerr << "siliconc: can't write " << output << "\n";
+	  return 3;
+	}
+    }
+
+  return 0;
+}
@@ -0,0 +1,118 @@
+/**
+*************************************************************
+* @file silicondeflate.cpp
+* @brief Compression output stage for Silicon::renderTo()
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include "silicondeflate.h"
+#include <algorithm>
+#include <climits>
+
+SiliconDeflate::SiliconDeflate(Silicon::OutputSink sink, SiliconDeflate::Format format, int level, std::size_t flushEvery, std::size_t bufferSize):
+  sink(std::move(sink)), buffer(bufferSize, '\0'), flushEvery(flushEvery), pending(0), finished(false)
+{
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  /* windowBits selects the format: negative is raw, +16 is gzip */
+  int windowBits = (format == DEFLATE)?-MAX_WBITS:(format == GZIP)?MAX_WBITS+16:MAX_WBITS;
+  if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw SiliconException(31, "Can't start compression (level "+std::to_string(level)+")", 0, 0);
+}
+
+SiliconDeflate::~SiliconDeflate()
+{
+  deflateEnd(&stream);
+}
+
+void SiliconDeflate::deflateAll(int mode)
+{
+  do
+    {
+      stream.next_out = (Bytef*) &buffer[0];
+      stream.avail_out = buffer.size();
+      int res = deflate(&stream, mode);
+      if (res == Z_STREAM_ERROR)
+	throw SiliconException(32, "Compression failed", 0, 0);
+
+      std::size_t len = buffer.size()-stream.avail_out;
+      if (len)
+	sink(buffer.data(), len);
+    }
+  /* A full buffer may leave output inside zlib */
+  while ( (stream.avail_in) || (stream.avail_out == 0) );
+}
+
+void SiliconDeflate::write(const char* data, std::size_t len)
+{
+  if (finished)
+    throw SiliconException(33, "Compressed stream already finished", 0, 0);
+
+  while (len)
+    {
+      std::size_t piece = std::min<std::size_t>(len, UINT_MAX);
+      if ( (flushEvery) && (piece > flushEvery-pending) )
+	piece = flushEvery-pending;
+
+      stream.next_in = (Bytef*) data;
+      stream.avail_in = piece;
+      pending += piece;
+      if ( (flushEvery) && (pending == flushEvery) )
+	{
+	  deflateAll(Z_SYNC_FLUSH);
+	  pending = 0;
+	}
+      else
+	deflateAll(Z_NO_FLUSH);
+      data += piece;
+      len -= piece;
+    }
+}
+
+void SiliconDeflate::flush()
+{
+  if (finished)
+    return;
+
+  stream.avail_in = 0;
+  deflateAll(Z_SYNC_FLUSH);
+  pending = 0;
+}
+
+void SiliconDeflate::finish()
+{
+  if (finished)
+    return;
+
+  stream.avail_in = 0;
+  deflateAll(Z_FINISH);
+  finished = true;
+}
+
+Silicon::OutputSink SiliconDeflate::input()
+{
+  return [this](const char* data, std::size_t len)
+    {
+      write(data, len);
+    };
+}
+
+std::string SiliconDeflate::render(Silicon& s, SiliconDeflate::Format format, int level, bool useLayout)
+{
+  std::string res;
+  SiliconDeflate compressor([&res](const char* data, std::size_t len)
+			    {
+			      res.append(data, len);
+			    }, format, level);
+  s.renderTo(compressor.input(), useLayout);
+  compressor.finish();
+
+  return res;
+}
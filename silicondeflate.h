@@ -0,0 +1,106 @@
+/* @(#)silicondeflate.h
+ */
+
+#ifndef _SILICONDEFLATE_H
+#define _SILICONDEFLATE_H 1
+
+#include <string>
+#include <cstddef>
+#include <zlib.h>
+#include "silicon.h"
+
+/**
+ * Compression output stage (zlib, link with -lz). Output is compressed
+ * while it's rendered, and compressed bytes go to a sink as soon as
+ * there's a buffer of them:
+ *
+ *   SiliconDeflate gz(sink, SiliconDeflate::GZIP);
+ *   s.renderTo(gz.input());
+ *   gz.finish();
+ *
+ * Or just SiliconDeflate::render(s) to get the compressed string.
+ */
+class SiliconDeflate
+{
+public:
+  enum Format
+    {
+      DEFLATE,			/* Raw deflate */
+      ZLIB,			/* zlib stream (HTTP "deflate") */
+      GZIP			/* gzip */
+    };
+
+  /**
+   * @param sink Gets compressed bytes
+   * @param format Stream format
+   * @param level Compression level (0-9), Z_DEFAULT_COMPRESSION
+   * @param flushEvery Input bytes between sync flushes, so the client can
+   *                   decompress what it got. 0: only when finishing
+   * @param bufferSize Compressed bytes given to sink at once
+   */
+  SiliconDeflate(Silicon::OutputSink sink, Format format=GZIP, int level=Z_DEFAULT_COMPRESSION, std::size_t flushEvery=0, std::size_t bufferSize=16384);
+  ~SiliconDeflate();
+
+  /**
+   * Compresses data
+   */
+  void write(const char* data, std::size_t len);
+
+  /**
+   * Sync flush. Everything written can be decompressed with the
+   * bytes given to the sink
+   */
+  void flush();
+
+  /**
+   * Ends stream. Nothing can be written after it
+   */
+  void finish();
+
+  /**
+   * Sink writing here, for Silicon::renderTo()
+   */
+  Silicon::OutputSink input();
+
+  /**
+   * Input and output bytes
+   */
+  std::size_t bytesIn() const
+  {
+    return stream.total_in;
+  }
+
+  std::size_t bytesOut() const
+  {
+    return stream.total_out;
+  }
+
+  /**
+   * Renders compressed
+   *
+   * @param s Template instance
+   * @param format Stream format
+   * @param level Compression level
+   * @param useLayout Also renders layout
+   *
+   * @return compressed output
+   */
+  static std::string render(Silicon& s, Format format=GZIP, int level=Z_DEFAULT_COMPRESSION, bool useLayout=true);
+
+private:
+  SiliconDeflate(const SiliconDeflate&) = delete;
+  SiliconDeflate& operator=(const SiliconDeflate&) = delete;
+
+  /* Runs deflate() until input is used and the flush is done */
+  void deflateAll(int mode);
+
+  Silicon::OutputSink sink;
+  z_stream stream;
+  std::string buffer;
+  std::size_t flushEvery;
+  /* Input since the last flush */
+  std::size_t pending;
+  bool finished;
+};
+
+#endif /* _SILICONDEFLATE_H */
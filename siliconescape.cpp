@@ -0,0 +1,284 @@
+/**
+*************************************************************
+* @file siliconescape.cpp
+* @brief Escaping for HTML text, attributes, URLs, scripts and styles
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*   20261018 : Each block tested once, even when it has many characters to escape
+*   20261018 : Quotes escaped in HTML text. Script and style contexts. Context
+*              found scanning forward, quoted '>' don't end tags
+*
+*************************************************************/
+
+#include "siliconescape.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+  #include <emmintrin.h>
+#endif
+
+namespace
+{
+  const char hexDigits[] = "0123456789ABCDEF";
+
+  inline bool isAlnum(unsigned char c)
+  {
+    return ( ( (c>='A') && (c<='Z') ) || ( (c>='a') && (c<='z') ) || ( (c>='0') && (c<='9') ) );
+  }
+
+  inline bool isUnreserved(unsigned char c)
+  {
+    return ( (isAlnum(c)) || (c=='-') || (c=='.') || (c=='_') || (c=='~') );
+  }
+
+  /* Quotes too: text may end in an attribute value we didn't see */
+  inline bool htmlSpecial(unsigned char c)
+  {
+    return ( (c=='&') || (c=='<') || (c=='>') || (c=='"') || (c=='\'') );
+  }
+
+  inline bool urlSpecial(unsigned char c)
+  {
+    return !isUnreserved(c);
+  }
+
+  /* ASCII but letters, digits, space, comma, dot and underscore. UTF-8 is kept */
+  inline bool scriptSpecial(unsigned char c)
+  {
+    return ( (c<0x80) && (!isAlnum(c)) && (c!=' ') && (c!=',') && (c!='.') && (c!='_') );
+  }
+
+  /* ASCII but letters and digits */
+  inline bool styleSpecial(unsigned char c)
+  {
+    return ( (c<0x80) && (!isAlnum(c)) );
+  }
+
+  inline void appendEntity(std::string& dest, char c)
+  {
+    switch (c)
+      {
+      case '&': dest.append("&amp;", 5);
+	break;
+      case '<': dest.append("&lt;", 4);
+	break;
+      case '>': dest.append("&gt;", 4);
+	break;
+      case '"': dest.append("&quot;", 6);
+	break;
+      case '\'': dest.append("&#39;", 5);
+	break;
+      default: dest+=c;
+      }
+  }
+
+  inline void appendPercent(std::string& dest, char c)
+  {
+    char enc[3] = { '%', hexDigits[(unsigned char)c >> 4], hexDigits[(unsigned char)c & 0xf] };
+    dest.append(enc, 3);
+  }
+
+  /* \xHH, valid in JavaScript strings */
+  inline void appendScriptHex(std::string& dest, char c)
+  {
+    char enc[4] = { '\\', 'x', hexDigits[(unsigned char)c >> 4], hexDigits[(unsigned char)c & 0xf] };
+    dest.append(enc, 4);
+  }
+
+  /* \HH and a space, so the next character is not taken as a digit */
+  inline void appendStyleHex(std::string& dest, char c)
+  {
+    char enc[4] = { '\\', hexDigits[(unsigned char)c >> 4], hexDigits[(unsigned char)c & 0xf], ' ' };
+    dest.append(enc, 4);
+  }
+
+#if defined(__SSE2__)
+  /* Bitmask of the 16 bytes in v needing escape */
+  inline int htmlMask(__m128i v)
+  {
+    __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')),
+					  _mm_cmpeq_epi8(v, _mm_set1_epi8('<'))),
+			     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')),
+					  _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+						       _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')))));
+    return _mm_movemask_epi8(m);
+  }
+
+  /* lo <= v <= hi. Signed comparison, so bytes >= 0x80 are never in range */
+  inline __m128i inRange(__m128i v, char lo, char hi)
+  {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo-1)),
+			 _mm_cmpgt_epi8(_mm_set1_epi8(hi+1), v));
+  }
+
+  inline __m128i alnum(__m128i v)
+  {
+    return _mm_or_si128(_mm_or_si128(inRange(v, 'A', 'Z'), inRange(v, 'a', 'z')), inRange(v, '0', '9'));
+  }
+
+  inline int urlMask(__m128i v)
+  {
+    __m128i ok = _mm_or_si128(alnum(v),
+			      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+							_mm_cmpeq_epi8(v, _mm_set1_epi8('.'))),
+					   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+							_mm_cmpeq_epi8(v, _mm_set1_epi8('~')))));
+    return (~_mm_movemask_epi8(ok)) & 0xffff;
+  }
+
+  /* Bytes >= 0x80 are negative */
+  inline int scriptMask(__m128i v)
+  {
+    __m128i ok = _mm_or_si128(_mm_or_si128(alnum(v), _mm_cmplt_epi8(v, _mm_setzero_si128())),
+			      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+							_mm_cmpeq_epi8(v, _mm_set1_epi8(','))),
+					   _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+							_mm_cmpeq_epi8(v, _mm_set1_epi8('_')))));
+    return (~_mm_movemask_epi8(ok)) & 0xffff;
+  }
+
+  inline int styleMask(__m128i v)
+  {
+    __m128i ok = _mm_or_si128(alnum(v), _mm_cmplt_epi8(v, _mm_setzero_si128()));
+    return (~_mm_movemask_epi8(ok)) & 0xffff;
+  }
+#endif
+
+  /**
+   * Copies plain runs with one append and escapes special characters.
+   * Every block of 16 bytes is tested once, special characters in it
+   * are taken from its mask.
+   */
+  template <bool (*special)(unsigned char),
+#if defined(__SSE2__)
+	    int (*mask)(__m128i),
+#endif
+	    void (*encode)(std::string&, char)>
+  void escapeRuns(std::string& dest, const char* src, std::size_t len)
+  {
+    /* Plain run not copied yet starts here */
+    std::size_t run = 0;
+    std::size_t i = 0;
+#if defined(__SSE2__)
+    for (; i+16 <= len; i+=16)
+      {
+	int m = mask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src+i)));
+	if (__builtin_popcount(m) > 4)
+	  {
+	    /* Runs are too short, one byte at a time is faster */
+	    if (i>run)
+	      dest.append(src+run, i-run);
+	    for (std::size_t j=i; j<i+16; ++j)
+	      {
+		if (m & (1 << (j-i)))
+		  encode(dest, src[j]);
+		else
+		  dest+=src[j];
+	      }
+	    run = i+16;
+	    continue;
+	  }
+
+	for (; m; m&= m-1)
+	  {
+	    std::size_t j = i + __builtin_ctz(m);
+	    if (j>run)
+	      dest.append(src+run, j-run);
+	    encode(dest, src[j]);
+	    run = j+1;
+	  }
+      }
+#endif
+    for (; i<len; ++i)
+      {
+	if (!special(src[i]))
+	  continue;
+
+	if (i>run)
+	  dest.append(src+run, i-run);
+	encode(dest, src[i]);
+	run = i+1;
+      }
+    if (len>run)
+      dest.append(src+run, len-run);
+  }
+
+#if defined(__SSE2__)
+  #define SILICON_ESCAPE(special, mask, encode) escapeRuns<special, mask, encode>
+#else
+  #define SILICON_ESCAPE(special, mask, encode) escapeRuns<special, encode>
+#endif
+}
+
+void SiliconEscape::append(SiliconEscape::Context ctx, std::string& dest, const char* src, std::size_t len)
+{
+  switch (ctx)
+    {
+    case HTML:
+    case ATTRIBUTE:
+      SILICON_ESCAPE(htmlSpecial, htmlMask, appendEntity)(dest, src, len);
+      break;
+    case URL:
+      SILICON_ESCAPE(urlSpecial, urlMask, appendPercent)(dest, src, len);
+      break;
+    case SCRIPT:
+      SILICON_ESCAPE(scriptSpecial, scriptMask, appendScriptHex)(dest, src, len);
+      break;
+    case STYLE:
+      SILICON_ESCAPE(styleSpecial, styleMask, appendStyleHex)(dest, src, len);
+      break;
+    default:
+      dest.append(src, len);
+    }
+}
+
+std::string SiliconEscape::escape(SiliconEscape::Context ctx, const std::string& src)
+{
+  std::string res;
+  res.reserve(src.size());
+  append(ctx, res, src.data(), src.size());
+
+  return res;
+}
+
+void SiliconEscape::appendScalar(SiliconEscape::Context ctx, std::string& dest, const char* src, std::size_t len)
+{
+  for (std::size_t i=0; i<len; ++i)
+    {
+      char c = src[i];
+      if ( ( (ctx == HTML) || (ctx == ATTRIBUTE) ) && (htmlSpecial(c)) )
+	appendEntity(dest, c);
+      else if ( (ctx == URL) && (urlSpecial(c)) )
+	appendPercent(dest, c);
+      else if ( (ctx == SCRIPT) && (scriptSpecial(c)) )
+	appendScriptHex(dest, c);
+      else if ( (ctx == STYLE) && (styleSpecial(c)) )
+	appendStyleHex(dest, c);
+      else
+	dest+=c;
+    }
+}
+
+bool SiliconEscape::fromName(const char* name, std::size_t len, SiliconEscape::Context& ctx)
+{
+  if ( (len == 3) && (strncmp(name, "raw", 3) == 0) )
+    ctx = NONE;
+  else if ( (len == 4) && (strncmp(name, "html", 4) == 0) )
+    ctx = HTML;
+  else if ( (len == 4) && (strncmp(name, "attr", 4) == 0) )
+    ctx = ATTRIBUTE;
+  else if ( (len == 3) && (strncmp(name, "url", 3) == 0) )
+    ctx = URL;
+  else if ( (len == 2) && (strncmp(name, "js", 2) == 0) )
+    ctx = SCRIPT;
+  else if ( (len == 3) && (strncmp(name, "css", 3) == 0) )
+    ctx = STYLE;
+  else
+    return false;
+
+  return true;
+}
@@ -0,0 +1,333 @@
+/* @(#)siliconescape.h
+ */
+
+#ifndef _SILICONESCAPE_H
+#define _SILICONESCAPE_H 1
+
+#include <string>
+#include <cstddef>
+
+/* Scanner is used in constant evaluation by siliconliteral.h */
+#if __cplusplus >= 201402L
+  #define SILICON_CONSTEXPR constexpr
+#else
+  #define SILICON_CONSTEXPR inline
+#endif
+
+/**
+ * Escaping for keyword values. Escaped text is written directly to
+ * the destination string. On x86 with SSE2 we look for characters
+ * needing escape 16 bytes at a time, and plain runs are copied with
+ * one append.
+ */
+class SiliconEscape
+{
+public:
+  /**
+   * Where the text will be written
+   */
+  enum Context
+  {
+    NONE,			/* Raw, no escape */
+    HTML,			/* HTML text: & < > " ' */
+    ATTRIBUTE,			/* Attribute value: & < > " ' */
+    URL,			/* URL component: percent-encoding */
+    SCRIPT,			/* <script> or on* attribute: \xHH */
+    STYLE			/* <style> or style attribute: \HH */
+  };
+
+  /**
+   * Follows HTML text one character at a time, to know the context
+   * where the next character goes. Quotes in attribute values,
+   * comments and <script> or <style> contents are taken into
+   * account. Only literal text is fed, template tags are not.
+   *   - Outside tags: HTML
+   *   - Inside href, src or action values, after '?': URL
+   *   - Inside on* values or <script>: SCRIPT
+   *   - Inside style values or <style>: STYLE
+   *   - Elsewhere inside tags: ATTRIBUTE
+   */
+  class Scanner
+  {
+  public:
+    /**
+     * Next character of text
+     */
+    SILICON_CONSTEXPR void feed(char c)
+    {
+      switch (state)
+	{
+	case TEXT:
+	  if (c == '<')
+	    state = LESS;
+	  break;
+	case LESS:
+	  if (c == '!')
+	    {
+	      state = MARKUP;
+	      match = 0;
+	    }
+	  else if ( (c == '/') || (letter(c)) )
+	    {
+	      state = TAG_NAME;
+	      closing = (c == '/');
+	      nameLen = 0;
+	      if (!closing)
+		name[nameLen++] = lower(c);
+	    }
+	  else if (c != '<')
+	    state = TEXT;
+	  break;
+	case MARKUP:
+	  if ( (c == '-') && (++match == 2) )
+	    {
+	      state = COMMENT;
+	      match = 0;
+	    }
+	  else if (c == '>')
+	    state = TEXT;
+	  else if (c != '-')
+	    state = TAG;	/* <!DOCTYPE ... */
+	  break;
+	case COMMENT:
+	  if ( (c == '>') && (match >= 2) )
+	    state = TEXT;
+	  match = (c == '-')?match+1:0;
+	  break;
+	case TAG_NAME:
+	  if ( (space(c)) || (c == '/') || (c == '>') )
+	    {
+	      tag = (closing)?OTHER:
+		(named("script"))?SCRIPT_TAG:
+		(named("style"))?STYLE_TAG:OTHER;
+	      state = TAG;
+	      if (c == '>')
+		endTag();
+	    }
+	  else
+	    addName(c);
+	  break;
+	case TAG:
+	case AFTER_NAME:
+	  if (c == '>')
+	    endTag();
+	  else if ( (c == '=') && (state == AFTER_NAME) )
+	    startValue();
+	  else if (c == '/')
+	    state = TAG;
+	  else if (!space(c))
+	    {
+	      state = ATTRIBUTE_NAME;
+	      nameLen = 0;
+	      addName(c);
+	    }
+	  break;
+	case ATTRIBUTE_NAME:
+	  if (c == '>')
+	    endTag();
+	  else if (c == '=')
+	    startValue();
+	  else if (c == '/')
+	    state = TAG;
+	  else if (space(c))
+	    state = AFTER_NAME;
+	  else
+	    addName(c);
+	  break;
+	case BEFORE_VALUE:
+	  if (c == '>')
+	    endTag();
+	  else if (!space(c))
+	    {
+	      state = VALUE;
+	      quote = ( (c == '"') || (c == '\'') )?c:'\0';
+	      query = (c == '?');
+	    }
+	  break;
+	case VALUE:
+	  if ( (quote) && (c == quote) )
+	    state = TAG;
+	  else if ( (!quote) && (space(c)) )
+	    state = TAG;
+	  else if ( (!quote) && (c == '>') )
+	    endTag();
+	  else if (c == '?')
+	    query = true;
+	  break;
+	case RAW:
+	  {
+	    const char* end = (tag == SCRIPT_TAG)?"</script":"</style";
+	    if ( (end[match] == '\0') && ( (space(c)) || (c == '/') || (c == '>') ) )
+	      {
+		/* </script> */
+		state = TAG;
+		tag = OTHER;
+		if (c == '>')
+		  endTag();
+	      }
+	    else if ( (end[match] != '\0') && (lower(c) == end[match]) )
+	      ++match;
+	    else
+	      match = (c == '<')?1:0;
+	  }
+	  break;
+	}
+    }
+
+    /**
+     * Context of the next character
+     */
+    SILICON_CONSTEXPR Context context() const
+    {
+      switch (state)
+	{
+	case TEXT:
+	case LESS:
+	case MARKUP:
+	case COMMENT:
+	  return HTML;
+	case RAW:
+	  return (tag == SCRIPT_TAG)?SCRIPT:STYLE;
+	case VALUE:
+	  if ( (attribute == URL_ATTRIBUTE) && (query) )
+	    return URL;
+	  else if (attribute == EVENT_ATTRIBUTE)
+	    return SCRIPT;
+	  else if (attribute == STYLE_ATTRIBUTE)
+	    return STYLE;
+	  return ATTRIBUTE;
+	default:
+	  return ATTRIBUTE;
+	}
+    }
+
+  private:
+    enum State
+      {
+	TEXT,
+	LESS,			/* < */
+	MARKUP,			/* <! */
+	COMMENT,		/* <!-- */
+	TAG_NAME,
+	TAG,			/* Between attributes */
+	ATTRIBUTE_NAME,
+	AFTER_NAME,
+	BEFORE_VALUE,		/* name= */
+	VALUE,
+	RAW			/* <script> or <style> contents */
+      };
+
+    enum Kind
+      {
+	OTHER,
+	SCRIPT_TAG,
+	STYLE_TAG,
+	URL_ATTRIBUTE,
+	EVENT_ATTRIBUTE,
+	STYLE_ATTRIBUTE
+      };
+
+    static SILICON_CONSTEXPR char lower(char c)
+    {
+      return ( (c >= 'A') && (c <= 'Z') )?c-'A'+'a':c;
+    }
+
+    static SILICON_CONSTEXPR bool letter(char c)
+    {
+      return ( (lower(c) >= 'a') && (lower(c) <= 'z') );
+    }
+
+    static SILICON_CONSTEXPR bool space(char c)
+    {
+      return ( (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r') || (c == '\f') );
+    }
+
+    SILICON_CONSTEXPR void addName(char c)
+    {
+      if (nameLen < sizeof(name))
+	name[nameLen] = lower(c);
+      ++nameLen;
+    }
+
+    /* Lowercase name is the current tag or attribute name */
+    SILICON_CONSTEXPR bool named(const char* lowercase) const
+    {
+      std::size_t i = 0;
+      for (; lowercase[i] != '\0'; ++i)
+	{
+	  if ( (i >= nameLen) || (name[i] != lowercase[i]) )
+	    return false;
+	}
+
+      return (i == nameLen);
+    }
+
+    SILICON_CONSTEXPR void startValue()
+    {
+      state = BEFORE_VALUE;
+      attribute = ( (named("href")) || (named("src")) || (named("action")) )?URL_ATTRIBUTE:
+	(named("style"))?STYLE_ATTRIBUTE:
+	( (nameLen > 2) && (name[0] == 'o') && (name[1] == 'n') )?EVENT_ATTRIBUTE:OTHER;
+    }
+
+    SILICON_CONSTEXPR void endTag()
+    {
+      state = (tag == OTHER)?TEXT:RAW;
+      match = 0;
+    }
+
+    State state = TEXT;
+    /* Current tag (script or style) and attribute */
+    Kind tag = OTHER;
+    Kind attribute = OTHER;
+    bool closing = false;
+    /* Beginning of the tag or attribute name, lowercase */
+    char name[8] = {};
+    std::size_t nameLen = 0;
+    /* Quote of the value, '\0' when unquoted */
+    char quote = '\0';
+    /* '?' found in the value */
+    bool query = false;
+    /* MARKUP, COMMENT: dashes. RAW: characters of the closing tag */
+    std::size_t match = 0;
+  };
+
+  /**
+   * Appends src escaped for context ctx
+   *
+   * @param ctx Context
+   * @param dest Destination string
+   * @param src Text to escape
+   * @param len Text length
+   */
+  static void append(Context ctx, std::string& dest, const char* src, std::size_t len);
+
+  /**
+   * Escapes src for context ctx
+   *
+   * @param ctx Context
+   * @param src Text to escape
+   *
+   * @return escaped text
+   */
+  static std::string escape(Context ctx, const std::string& src);
+
+  /**
+   * Character by character implementation. Output is the same
+   * as append(), it's used as baseline for benchmarks.
+   */
+  static void appendScalar(Context ctx, std::string& dest, const char* src, std::size_t len);
+
+  /**
+   * Gets context from a filter name (raw, html, attr, url, js, css)
+   *
+   * @param name Filter name
+   * @param len Filter name length
+   * @param ctx Returns context
+   *
+   * @return true if it's a known filter
+   */
+  static bool fromName(const char* name, std::size_t len, Context& ctx);
+};
+
+#endif /* _SILICONESCAPE_H */
@@ -0,0 +1,396 @@
+/* @(#)siliconhash.h
+ */
+
+#ifndef _SILICONHASH_H
+#define _SILICONHASH_H 1
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Hash for names (keywords, functions, collections...). Templates keep
+ * the hash of the names they use, so it's calculated once.
+ */
+class SiliconHash
+{
+public:
+  /* FNV-1a */
+  static uint32_t of(const char* data, std::size_t len)
+  {
+    uint32_t h = 2166136261u;
+    for (std::size_t i=0; i<len; ++i)
+      {
+	h ^= (unsigned char) data[i];
+	h *= 16777619u;
+      }
+    return h;
+  }
+
+  static uint32_t of(const std::string& str)
+  {
+    return of(str.data(), str.size());
+  }
+};
+
+/**
+ * Hash table by name, for keywords, functions, collections and
+ * operators. Entries are found through an open addressing index
+ * (linear probing) which keeps their hashes, so most misses don't
+ * touch the entries.
+ *
+ * Keys can be looked up from any piece of memory, without building a
+ * std::string, and with a hash calculated before.
+ *
+ * Entries never move, references to them remain valid until they are
+ * erased (like std::map). Iteration order is insertion order, until an
+ * erase: the last entry takes the place of the erased one.
+ */
+template <typename T>
+class SiliconHashMap
+{
+public:
+  typedef std::pair<std::string, T> value_type;
+
+  template <typename V, typename Base>
+  class Iterator
+  {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef V value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef V* pointer;
+    typedef V& reference;
+
+    Iterator(Base it): it(it)
+    {
+    }
+
+    /* iterator to const_iterator */
+    template <typename V2, typename Base2>
+    Iterator(const Iterator<V2, Base2>& other): it(other.base())
+    {
+    }
+
+    V& operator*() const
+    {
+      return **it;
+    }
+
+    V* operator->() const
+    {
+      return it->get();
+    }
+
+    Iterator& operator++()
+    {
+      ++it;
+      return *this;
+    }
+
+    Iterator operator+(std::ptrdiff_t n) const
+    {
+      return Iterator(it+n);
+    }
+
+    std::ptrdiff_t operator-(const Iterator& other) const
+    {
+      return it-other.it;
+    }
+
+    bool operator==(const Iterator& other) const
+    {
+      return it == other.it;
+    }
+
+    bool operator!=(const Iterator& other) const
+    {
+      return it != other.it;
+    }
+
+    const Base& base() const
+    {
+      return it;
+    }
+
+  private:
+    Base it;
+  };
+
+  typedef Iterator<value_type, typename std::vector<std::unique_ptr<value_type> >::iterator> iterator;
+  typedef Iterator<const value_type, typename std::vector<std::unique_ptr<value_type> >::const_iterator> const_iterator;
+
+  SiliconHashMap()
+  {
+  }
+
+  SiliconHashMap(const SiliconHashMap& other): slots(other.slots), hashes(other.hashes)
+  {
+    entries.reserve(other.entries.size());
+    for (auto& e : other.entries)
+      entries.push_back(std::unique_ptr<value_type>(new value_type(*e)));
+  }
+
+  SiliconHashMap(SiliconHashMap&& other) = default;
+
+  SiliconHashMap& operator=(const SiliconHashMap& other)
+  {
+    if (this != &other)
+      *this = SiliconHashMap(other);
+
+    return *this;
+  }
+
+  SiliconHashMap& operator=(SiliconHashMap&& other) = default;
+
+  iterator begin()
+  {
+    return entries.begin();
+  }
+
+  iterator end()
+  {
+    return entries.end();
+  }
+
+  const_iterator begin() const
+  {
+    return entries.begin();
+  }
+
+  const_iterator end() const
+  {
+    return entries.end();
+  }
+
+  std::size_t size() const
+  {
+    return entries.size();
+  }
+
+  bool empty() const
+  {
+    return entries.empty();
+  }
+
+  void clear()
+  {
+    entries.clear();
+    hashes.clear();
+    slots.clear();
+  }
+
+  /**
+   * Makes room for entries, so adding them won't rebuild the index
+   */
+  void reserve(std::size_t count)
+  {
+    if (count*4 > slots.size()*3)
+      rehash(capacity(count));
+  }
+
+  iterator find(const std::string& key)
+  {
+    return find(key.data(), key.size(), SiliconHash::of(key));
+  }
+
+  iterator find(const char* key, std::size_t len)
+  {
+    return find(key, len, SiliconHash::of(key, len));
+  }
+
+  iterator find(const char* key, std::size_t len, uint32_t hash)
+  {
+    std::size_t e = lookup(key, len, hash);
+    return (e == none)?entries.end():entries.begin()+e;
+  }
+
+  const_iterator find(const std::string& key) const
+  {
+    return find(key.data(), key.size(), SiliconHash::of(key));
+  }
+
+  const_iterator find(const char* key, std::size_t len) const
+  {
+    return find(key, len, SiliconHash::of(key, len));
+  }
+
+  const_iterator find(const char* key, std::size_t len, uint32_t hash) const
+  {
+    std::size_t e = lookup(key, len, hash);
+    return (e == none)?entries.end():entries.begin()+e;
+  }
+
+  /**
+   * Gets entry, adding it if it's not there
+   */
+  T& operator[](const std::string& key)
+  {
+    uint32_t hash = SiliconHash::of(key);
+    std::size_t e = lookup(key.data(), key.size(), hash);
+    if (e == none)
+      e = add(value_type(key, T()), hash);
+
+    return entries[e]->second;
+  }
+
+  T& operator[](std::string&& key)
+  {
+    uint32_t hash = SiliconHash::of(key);
+    std::size_t e = lookup(key.data(), key.size(), hash);
+    if (e == none)
+      e = add(value_type(std::move(key), T()), hash);
+
+    return entries[e]->second;
+  }
+
+  /**
+   * Adds entry, if its key is not there
+   *
+   * @return entry with the key, and whether it was added
+   */
+  std::pair<iterator, bool> insert(value_type value)
+  {
+    uint32_t hash = SiliconHash::of(value.first);
+    std::size_t e = lookup(value.first.data(), value.first.size(), hash);
+    if (e != none)
+      return std::make_pair(entries.begin()+e, false);
+
+    e = add(std::move(value), hash);
+    return std::make_pair(entries.begin()+e, true);
+  }
+
+  template <typename Iterator>
+  void insert(Iterator first, Iterator last)
+  {
+    for (; first != last; ++first)
+      insert(value_type(first->first, first->second));
+  }
+
+  /**
+   * Erases entry
+   *
+   * @return entry now in its position (the last one), or end()
+   */
+  iterator erase(iterator it)
+  {
+    std::size_t e = it-entries.begin();
+    std::size_t mask = slots.size()-1;
+    std::size_t hole = slot(e);
+
+    /* Entries after the hole that would not be found go back */
+    for (std::size_t j=(hole+1) & mask; slots[j] != 0; j=(j+1) & mask)
+      {
+	std::size_t home = (slots[j] >> 32) & mask;
+	if ( ((j-home) & mask) >= ((j-hole) & mask) )
+	  {
+	    slots[hole] = slots[j];
+	    hole = j;
+	  }
+      }
+    slots[hole] = 0;
+
+    std::size_t last = entries.size()-1;
+    if (e != last)
+      {
+	slots[slot(last)] = ((uint64_t) hashes[last] << 32) | (e+1);
+	entries[e] = std::move(entries[last]);
+	hashes[e] = hashes[last];
+      }
+    entries.pop_back();
+    hashes.pop_back();
+
+    return entries.begin()+e;
+  }
+
+  std::size_t erase(const std::string& key)
+  {
+    iterator it = find(key);
+    if (it == entries.end())
+      return 0;
+
+    erase(it);
+    return 1;
+  }
+
+private:
+  static const std::size_t none = (std::size_t) -1;
+
+  static std::size_t capacity(std::size_t count)
+  {
+    std::size_t res = 8;
+    while (res*3 < count*4)
+      res*=2;
+
+    return res;
+  }
+
+  std::size_t lookup(const char* key, std::size_t len, uint32_t hash) const
+  {
+    if (slots.empty())
+      return none;
+
+    std::size_t mask = slots.size()-1;
+    for (std::size_t i=hash & mask; slots[i] != 0; i=(i+1) & mask)
+      {
+	if ((uint32_t) (slots[i] >> 32) != hash)
+	  continue;
+
+	std::size_t e = (uint32_t) slots[i] - 1;
+	const std::string& k = entries[e]->first;
+	if ( (k.size() == len) && (memcmp(k.data(), key, len) == 0) )
+	  return e;
+      }
+
+    return none;
+  }
+
+  /* Index slot pointing to entry e */
+  std::size_t slot(std::size_t e) const
+  {
+    std::size_t mask = slots.size()-1;
+    std::size_t i = hashes[e] & mask;
+    while ((uint32_t) slots[i] != e+1)
+      i = (i+1) & mask;
+
+    return i;
+  }
+
+  void place(std::size_t e)
+  {
+    std::size_t mask = slots.size()-1;
+    std::size_t i = hashes[e] & mask;
+    while (slots[i] != 0)
+      i = (i+1) & mask;
+    slots[i] = ((uint64_t) hashes[e] << 32) | (e+1);
+  }
+
+  void rehash(std::size_t size)
+  {
+    slots.assign(size, 0);
+    for (std::size_t e=0; e<entries.size(); ++e)
+      place(e);
+  }
+
+  std::size_t add(value_type&& value, uint32_t hash)
+  {
+    reserve(entries.size()+1);
+    entries.push_back(std::unique_ptr<value_type>(new value_type(std::move(value))));
+    hashes.push_back(hash);
+    place(entries.size()-1);
+
+    return entries.size()-1;
+  }
+
+  /* Entry number+1 (0: empty slot) and hash of its key in the high half */
+  std::vector<uint64_t> slots;
+  std::vector<std::unique_ptr<value_type> > entries;
+  std::vector<uint32_t> hashes;
+};
+
+#endif /* _SILICONHASH_H */
@@ -0,0 +1,641 @@
+/* @(#)siliconliteral.h
+ */
+
+#ifndef _SILICONLITERAL_H
+#define _SILICONLITERAL_H 1
+
+#if __cplusplus < 201703L
+  #error "siliconliteral.h needs C++17"
+#endif
+
+#include <string>
+#include <string_view>
+#include <array>
+#include <cstddef>
+#include "silicon.h"
+
+/**
+ * Templates written as string literals in C++ code, compiled by the
+ * C++ compiler:
+ *
+ *    Silicon s = Silicon::createFromStr("");
+ *    s.setKeyword("name", "world");
+ *    std::string out = SILICON_TEMPLATE("Hello {{name}}!").render(s);
+ *
+ * The literal is tokenized in constant evaluation with the same
+ * grammar as Silicon::compile(), so the nodes are static data and
+ * nothing is parsed when rendering. Syntax errors (unterminated tags,
+ * unmatched close tags...) stop the build: the compiler reports a
+ * call to syntaxError() with the message.
+ * Keywords, functions and collections are still looked up when
+ * rendering, with the Silicon instance given.
+ */
+namespace SiliconLiteral
+{
+  typedef SiliconTemplate::Node::Type Type;
+
+  /* Processed text (names, arguments), in Compiled::chars */
+  struct Text
+  {
+    std::size_t offset = 0;
+    std::size_t len = 0;
+  };
+
+  struct Arg
+  {
+    Text key;
+    Text value;
+  };
+
+  /* Same as SiliconTemplate::Node. Arguments and values are in Compiled::args */
+  struct Node
+  {
+    Type type = SiliconTemplate::Node::TEXT;
+    std::size_t pos = 0;
+    std::size_t len = 0;
+    std::size_t end = 0;
+    Text name;
+    SiliconEscape::Context escape = SiliconEscape::NONE;
+    bool filtered = false;
+    bool body = false;
+    /* FUNCTION: arguments. COLLECTION: loops. IF, IFFUN: values */
+    std::size_t firstArg = 0;
+    std::size_t args = 0;
+  };
+
+  struct Size
+  {
+    std::size_t nodes = 0;
+    std::size_t args = 0;
+    std::size_t chars = 0;
+  };
+
+  /* Not constexpr: calling it in constant evaluation is a compile error */
+  inline void syntaxError(int code, const char* message)
+  {
+    throw SiliconException(code, message, 0, 0);
+  }
+
+  /**
+   * Compiles the literal. N is the literal size, nodes, arguments
+   * and processed text can't be more than that.
+   */
+  template <std::size_t N>
+  class Parser
+  {
+  public:
+    constexpr explicit Parser(std::string_view source): source(source)
+    {
+      compile(0, Text(), false, 0);
+    }
+
+    std::string_view source;
+    std::array<Node, N> nodes {};
+    std::array<Arg, N> args {};
+    /* Auto keys may be longer than the text they come from */
+    std::array<char, 2*N+16> chars {};
+    Size size {};
+
+  private:
+    /* Literal text as HTML, as SiliconTemplate::addText() */
+    SiliconEscape::Scanner html {};
+
+    constexpr char at(std::size_t pos) const
+    {
+      return (pos < source.size())?source[pos]:'\0';
+    }
+
+    constexpr std::string_view str(const Text& text) const
+    {
+      return std::string_view(chars.data()+text.offset, text.len);
+    }
+
+    constexpr Text copy(std::size_t pos, std::size_t len)
+    {
+      Text res { size.chars, len };
+      for (std::size_t i=0; i<len; ++i)
+	chars[size.chars++] = source[pos+i];
+
+      return res;
+    }
+
+    constexpr std::size_t add(Type type, std::size_t pos, std::size_t len)
+    {
+      Node& n = nodes[size.nodes];
+      n.type = type;
+      n.pos = pos;
+      n.len = len;
+      n.end = size.nodes+1;
+
+      return size.nodes++;
+    }
+
+    constexpr void addText(std::size_t pos, std::size_t scope)
+    {
+      html.feed(source[pos]);
+      if (size.nodes > scope)
+	{
+	  Node& last = nodes[size.nodes-1];
+	  if ( (last.type == SiliconTemplate::Node::TEXT) && (last.pos + last.len == pos) )
+	    {
+	      ++last.len;
+	      return;
+	    }
+	}
+
+      add(SiliconTemplate::Node::TEXT, pos, 1);
+    }
+
+    constexpr void close(std::size_t index)
+    {
+      nodes[index].end = size.nodes;
+    }
+
+    /* Arguments are a map: first value for a key stays, sorted by key */
+    constexpr void insertArg(std::size_t first, const Text& key, const Text& value)
+    {
+      for (std::size_t i=first; i<size.args; ++i)
+	{
+	  if (str(args[i].key) == str(key))
+	    return;
+	}
+      args[size.args++] = { key, value };
+    }
+
+    constexpr void sortArgs(std::size_t first)
+    {
+      for (std::size_t i=first+1; i<size.args; ++i)
+	{
+	  Arg a = args[i];
+	  std::size_t j = i;
+	  while ( (j > first) && (str(a.key) < str(args[j-1].key)) )
+	    {
+	      args[j] = args[j-1];
+	      --j;
+	    }
+	  args[j] = a;
+	}
+    }
+
+    static constexpr bool fromName(std::string_view name, SiliconEscape::Context& ctx)
+    {
+      if (name == "raw")
+	ctx = SiliconEscape::NONE;
+      else if (name == "html")
+	ctx = SiliconEscape::HTML;
+      else if (name == "attr")
+	ctx = SiliconEscape::ATTRIBUTE;
+      else if (name == "url")
+	ctx = SiliconEscape::URL;
+      else if (name == "js")
+	ctx = SiliconEscape::SCRIPT;
+      else if (name == "css")
+	ctx = SiliconEscape::STYLE;
+      else
+	return false;
+
+      return true;
+    }
+
+    constexpr std::size_t compile(std::size_t pos, Text nested, bool isNested, int level)
+    {
+      std::size_t scope = size.nodes;
+      bool special = false;
+
+      if (isNested)
+	while (at(pos) == '\n')
+	  ++pos;
+
+      while (at(pos) != '\0')
+	{
+	  if (at(pos) == '\\')
+	    {
+	      if ( (at(pos+1) == '\\') || (at(pos+1) == '{') )
+		++pos;
+
+	      addText(pos, scope);
+	    }
+	  else if (at(pos) == '{')
+	    {
+	      std::size_t tagStart = pos;
+	      std::size_t moved = 0;
+	      int type = -1;
+	      Text fname;
+	      std::size_t firstArg = 0;
+	      bool autoClosed = false;
+	      if ( (moved = parseKeyword(pos)) > 0)
+		{
+		  std::size_t index = add(SiliconTemplate::Node::KEYWORD, tagStart, moved+1);
+		  std::string_view kw = source.substr(pos+2, moved-3);
+		  std::size_t len = kw.size();
+		  auto bar = kw.rfind('|');
+		  if ( (bar != std::string_view::npos) && (fromName(kw.substr(bar+1), nodes[index].escape)) )
+		    {
+		      nodes[index].filtered = true;
+		      len = bar;
+		    }
+		  else
+		    nodes[index].escape = html.context();
+		  nodes[index].name = copy(pos+2, len);
+		  pos+=moved;
+		  special = true;
+		}
+	      else if ( (moved = parseFunction(pos, type, fname, firstArg, autoClosed)) > 0)
+		{
+		  pos+=moved;
+		  if (type == 0)
+		    {
+		      std::size_t index = add(SiliconTemplate::Node::FUNCTION, tagStart, pos-tagStart+1);
+		      nodes[index].name = fname;
+		      nodes[index].firstArg = firstArg;
+		      nodes[index].args = size.args-firstArg;
+		      nodes[index].body = !autoClosed;
+		      if (!autoClosed)
+			pos = compile(pos+1, fname, true, level+1);
+		      close(index);
+		    }
+		  else
+		    pos = compileBuiltin(tagStart, pos, fname, firstArg, autoClosed, level);
+		  special = true;
+		}
+	      else if ( (isNested) && ( (moved = parseCloseNested(pos, nested)) > 0) )
+		return pos+moved;
+	      else
+		addText(pos, scope);
+	    }
+	  else if ( (at(pos) == '\n') && (special) )
+	    {
+	      /* Eat the \n */
+	    }
+	  else
+	    {
+	      addText(pos, scope);
+	      special = false;
+	    }
+	  ++pos;
+	}
+
+      if (level)
+	syntaxError(7, "Didn't close nested action");
+
+      return pos;
+    }
+
+    constexpr std::size_t parseKeyword(std::size_t pos) const
+    {
+      if ( (at(pos+1) != '{') || (at(pos+2) == '\0') )
+	return 0;
+
+      for (std::size_t cursor = pos+2; at(cursor) != '\0'; ++cursor)
+	{
+	  if ( (at(cursor) == '}') && (at(cursor+1) == '}') )
+	    return cursor-pos+1;
+	}
+
+      syntaxError(1, "Unterminated keyword string");
+      return 0;
+    }
+
+    /* Token being read is [token, size.chars) */
+    constexpr void fill(int& status, Text& fname, std::size_t firstArg, std::size_t& token, Text& key, int& autoKey)
+    {
+      Text current { token, size.chars-token };
+      switch (status)
+	{
+	case 0:
+	  fname = current;
+	  status = 2;
+	  break;
+	case 1:
+	  key = current;
+	  status = 2;
+	  break;
+	case 2:
+	  if (key.len == 0)
+	    {
+	      char digits[16] {};
+	      int ndigits = 0;
+	      int n = autoKey++;
+	      do
+		{
+		  digits[ndigits++] = '0'+n%10;
+		  n/=10;
+		}
+	      while (n);
+	      Text autoKeyText { size.chars, (std::size_t) ndigits };
+	      while (ndigits)
+		chars[size.chars++] = digits[--ndigits];
+	      insertArg(firstArg, autoKeyText, current);
+	    }
+	  else
+	    {
+	      insertArg(firstArg, key, current);
+	      key = Text();
+	    }
+	  break;
+	}
+      token = size.chars;
+    }
+
+    constexpr std::size_t parseFunction(std::size_t pos, int& type, Text& fname, std::size_t& firstArg, bool& autoClosed)
+    {
+      type = -1;
+      if (at(pos+1) == '!')
+	type = 0;
+      else if (at(pos+1) == '%')
+	type = 1;
+
+      if ( (type == -1) || (at(pos+2) == '\0') )
+	return 0;
+
+      std::size_t token = size.chars;
+      Text key;
+      int autoKey = 0;
+      int status = 0;
+      bool enclosed = false;
+      std::size_t cursor = pos+2;
+
+      autoClosed = false;
+      fname = Text();
+      firstArg = size.args;
+
+      while (at(cursor) != '\0')
+	{
+	  char c = at(cursor);
+	  if ( (c == '}') && (at(cursor+1) == '}') )
+	    break;
+	  else if ( (c == '/') && (at(cursor+1) == '}') )
+	    {
+	      autoClosed = true;
+	      break;
+	    }
+	  else if ( (c == ' ') && (!enclosed) && (size.chars > token) )
+	    fill(status, fname, firstArg, token, key, autoKey);
+	  else if (c == '"')
+	    {
+	      enclosed = !enclosed;
+	      if (type == 1)
+		chars[size.chars++] = c;
+	    }
+	  else if ( (c == '=') && (!enclosed) && (key.len == 0) && (status == 2) && (type != 1) )
+	    {
+	      status = 1;
+	      fill(status, fname, firstArg, token, key, autoKey);
+	    }
+	  else if ( (c == '\\') && ( (at(cursor+1) == '"') || (at(cursor+1) == '}') || (at(cursor+1) == '=') ) )
+	    {
+	      chars[size.chars++] = at(cursor+1);
+	      ++cursor;
+	    }
+	  else if ( (c != ' ') || (enclosed) || (size.chars > token) )
+	    chars[size.chars++] = c;
+
+	  ++cursor;
+	}
+
+      if (at(cursor) == '\0')
+	syntaxError(2, "Unterminated function string");
+
+      if (enclosed)
+	syntaxError(4, "Unfinished enclosed string");
+
+      fill(status, fname, firstArg, token, key, autoKey);
+      sortArgs(firstArg);
+
+      return cursor-pos+1;
+    }
+
+    constexpr std::size_t parseCloseNested(std::size_t pos, const Text& closeName) const
+    {
+      if ( (at(pos+1) != '/') || (at(pos+2) == '\0') )
+	return 0;
+
+      for (std::size_t cursor = pos+2; at(cursor) != '\0'; ++cursor)
+	{
+	  if ( (at(cursor) == '}') && (at(cursor+1) == '}') )
+	    {
+	      if (source.substr(pos+2, cursor-pos-2) != str(closeName))
+		syntaxError(6, "Unmatching close string");
+
+	      return cursor-pos+1;
+	    }
+	}
+
+      syntaxError(5, "Unterminated keyword close string");
+      return 0;
+    }
+
+    constexpr std::size_t compileBuiltin(std::size_t tagStart, std::size_t pos, const Text& bif, std::size_t firstArg, bool autoClosed, int level)
+    {
+      std::string_view name = str(bif);
+      if ( (autoClosed) && ( (name == "if") || (name == "while") || (name == "for") || (name == "collection") ) )
+	syntaxError(10, "Builtin can't be autoclosed");
+
+      std::size_t index = 0;
+      if ( (name == "if") || (name == "iffun") )
+	{
+	  index = add((name == "if")?SiliconTemplate::Node::IF:SiliconTemplate::Node::IFFUN, tagStart, pos-tagStart+1);
+	  nodes[index].firstArg = firstArg;
+	  nodes[index].args = size.args-firstArg;
+	}
+      else if (name == "collection")
+	{
+	  /* var=name arguments */
+	  std::size_t end = size.args;
+	  size.args = firstArg;
+	  for (std::size_t i=firstArg; i<end; ++i)
+	    {
+	      Arg a = args[i];
+	      auto op = str(a.value).find('=');
+	      if (op != std::string_view::npos)
+		{
+		  a.key = { a.value.offset, op };
+		  a.value = { a.value.offset+op+1, a.value.len-op-1 };
+		}
+	      insertArg(firstArg, a.key, a.value);
+	    }
+	  sortArgs(firstArg);
+
+	  std::size_t var = size.args, loops = size.args;
+	  for (std::size_t i=firstArg; i<size.args; ++i)
+	    {
+	      if (str(args[i].key) == "var")
+		var = i;
+	      else if (str(args[i].key) == "loops")
+		loops = i;
+	    }
+	  if (var == size.args)
+	    syntaxError(21, "Collection not specified");
+
+	  index = add(SiliconTemplate::Node::COLLECTION, tagStart, pos-tagStart+1);
+	  Text value = args[var].value;
+	  if ( (value.len > 1) && (str(value).front() == '"') && (str(value).back() == '"') )
+	    value = { value.offset+1, value.len-2 };
+	  nodes[index].name = value;
+	  nodes[index].firstArg = firstArg;
+	  if (loops != size.args)
+	    {
+	      args[firstArg] = args[loops];
+	      size.args = firstArg+1;
+	    }
+	  else
+	    size.args = firstArg;
+	  nodes[index].args = size.args-firstArg;
+	}
+      else
+	syntaxError(11, "Builtin function not implemented");
+
+      pos = compile(pos+1, bif, true, level+1);
+      close(index);
+
+      return pos;
+    }
+  };
+
+  /**
+   * Compiled literal, as used when rendering
+   */
+  class View
+  {
+  public:
+    constexpr View(const Node* nodes, std::size_t size, const Arg* args, const char* chars, const char* source):
+      nodes(nodes), size(size), args(args), chars(chars), source(source)
+    {
+    }
+
+    /**
+     * Renders template with keywords, functions and collections
+     * of a Silicon instance. Layouts are not used.
+     *
+     * @param s Silicon instance
+     * @return output string
+     */
+    std::string render(Silicon& s) const
+    {
+      std::string out;
+      s.generatedRender(source, [&]()
+			{
+			  evaluate(s, out, 0, size);
+			});
+      return out;
+    }
+
+  private:
+    const Node* nodes;
+    std::size_t size;
+    const Arg* args;
+    const char* chars;
+    const char* source;
+
+    std::string text(const Text& t) const
+    {
+      return std::string(chars+t.offset, t.len);
+    }
+
+    void evaluate(Silicon& s, std::string& destination, std::size_t first, std::size_t last) const
+    {
+      for (std::size_t i=first; i<last; i=nodes[i].end)
+	{
+	  const Node& node = nodes[i];
+	  switch (node.type)
+	    {
+	    case SiliconTemplate::Node::TEXT:
+	      destination.append(source+node.pos, node.len);
+	      break;
+	    case SiliconTemplate::Node::KEYWORD:
+	      s.generatedKeyword(destination, text(node.name), node.escape, node.filtered, source+node.pos, node.len);
+	      break;
+	    case SiliconTemplate::Node::FUNCTION:
+	      {
+		std::string body;
+		evaluate(s, body, i+1, node.end);
+		s.generatedTag(source+node.pos);
+		s.generatedFunction(destination, text(node.name), arguments(node), std::move(body));
+	      }
+	      break;
+	    case SiliconTemplate::Node::IF:
+	      {
+		/* The last condition wins, but all of them are evaluated */
+		bool res = false;
+		s.generatedTag(source+node.pos);
+		for (std::size_t a=node.firstArg; a<node.firstArg+node.args; ++a)
+		  res = s.generatedCondition(text(args[a].value));
+		if (res)
+		  evaluate(s, destination, i+1, node.end);
+	      }
+	      break;
+	    case SiliconTemplate::Node::IFFUN:
+	      {
+		std::vector<std::string> functions;
+		for (std::size_t a=node.firstArg; a<node.firstArg+node.args; ++a)
+		  functions.push_back(text(args[a].value));
+		s.generatedTag(source+node.pos);
+		if (s.generatedIffun(functions))
+		  evaluate(s, destination, i+1, node.end);
+	      }
+	      break;
+	    case SiliconTemplate::Node::COLLECTION:
+	      s.generatedTag(source+node.pos);
+	      s.generatedCollection(text(node.name), arguments(node), [&]()
+				    {
+				      evaluate(s, destination, i+1, node.end);
+				    });
+	      break;
+	    }
+	}
+    }
+
+    Silicon::StringMap arguments(const Node& node) const
+    {
+      Silicon::StringMap res;
+      for (std::size_t a=node.firstArg; a<node.firstArg+node.args; ++a)
+	res.insert({ text(args[a].key), text(args[a].value) });
+
+      return res;
+    }
+  };
+
+  /**
+   * Compiled literal, with just the room it needs
+   */
+  template <std::size_t NODES, std::size_t ARGS, std::size_t CHARS>
+  class Compiled
+  {
+  public:
+    template <std::size_t N>
+    constexpr explicit Compiled(const Parser<N>& parser): source(parser.source)
+    {
+      for (std::size_t i=0; i<NODES; ++i)
+	nodes[i] = parser.nodes[i];
+      for (std::size_t i=0; i<ARGS; ++i)
+	args[i] = parser.args[i];
+      for (std::size_t i=0; i<CHARS; ++i)
+	chars[i] = parser.chars[i];
+    }
+
+    constexpr View view() const
+    {
+      return View(nodes.data(), NODES, args.data(), chars.data(), source.data());
+    }
+
+  private:
+    std::string_view source;
+    std::array<Node, NODES> nodes {};
+    std::array<Arg, ARGS> args {};
+    std::array<char, CHARS> chars {};
+  };
+}
+
+/**
+ * Compiles a string literal template, gets a SiliconLiteral::View
+ */
+#define SILICON_TEMPLATE(literal)					\
+  ([]() -> const SiliconLiteral::View&					\
+   {									\
+     constexpr SiliconLiteral::Parser<sizeof(literal)> parser(literal);	\
+     static constexpr SiliconLiteral::Compiled<parser.size.nodes, parser.size.args, parser.size.chars> compiled(parser); \
+     static constexpr SiliconLiteral::View view = compiled.view();	\
+     return view;							\
+   }())
+
+#endif /* _SILICONLITERAL_H */
@@ -0,0 +1,346 @@
+/**
+*************************************************************
+* @file siliconreload.cpp
+* @brief Hot reload of template files
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*   20261018 : Minified versions for instances with minify enabled
+*
+*************************************************************/
+
+#include "siliconreload.h"
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+  #include <sys/inotify.h>
+  #include <poll.h>
+#endif
+
+#define DIRECTORY_SEPARATOR '/'
+
+std::atomic<bool> SiliconReload::_running(false);
+std::atomic<unsigned long> SiliconReload::_generation(0);
+std::map<std::string, SiliconReload::Entry> SiliconReload::entries;
+std::map<std::string, std::set<std::string> > SiliconReload::dependents;
+std::map<std::string, int> SiliconReload::directories;
+int SiliconReload::inotifyFd = -1;
+SiliconReload::Stats SiliconReload::_stats;
+std::thread SiliconReload::thread;
+std::mutex SiliconReload::mutex;
+std::condition_variable SiliconReload::stopping;
+
+namespace
+{
+  /* Directory containing path, empty for the current one */
+  std::string directoryOf(const std::string& path)
+  {
+    auto slash = path.find_last_of(DIRECTORY_SEPARATOR);
+    return (slash == std::string::npos)?std::string():path.substr(0, slash);
+  }
+
+  void fileTime(const std::string& path, long long& mtime, off_t& size)
+  {
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0)
+      {
+	/* Seconds are not enough, files may change twice in a second */
+#ifdef __linux__
+	mtime = st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+#else
+	mtime = st.st_mtime*1000000000LL;
+#endif
+	size = st.st_size;
+      }
+    else
+      {
+	mtime = 0;
+	size = -1;
+      }
+  }
+}
+
+void SiliconReload::start(unsigned pollInterval, bool forcePolling)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (running())
+    return;
+
+  _stats = Stats();
+  _stats.reloads = 0;
+  _stats.errors = 0;
+#ifdef __linux__
+  inotifyFd = (forcePolling)?-1:inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+#endif
+  _stats.inotify = (inotifyFd >= 0);
+
+  _running.store(true, std::memory_order_release);
+  thread = std::thread(SiliconReload::run, pollInterval);
+}
+
+void SiliconReload::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!running())
+      return;
+
+    _running.store(false, std::memory_order_release);
+  }
+  stopping.notify_all();
+  thread.join();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (inotifyFd >= 0)
+    close(inotifyFd);
+  inotifyFd = -1;
+  entries.clear();
+  dependents.clear();
+  directories.clear();
+  /* Instances will compile their own sources again */
+  ++_generation;
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconReload::get(const std::string& path, const std::string& basePath, bool minify)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto e = entries.find(path);
+    if ( (e != entries.end()) && (e->second.tpl) )
+      return version(e->second, minify);
+  }
+
+  /* Compiling may take a while, don't block the others */
+  std::shared_ptr<const SiliconTemplate> tpl = load(path, basePath);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  Entry& entry = entries[path];
+  if (!entry.tpl)
+    {
+      entry.basePath = basePath;
+      publish(path, entry, tpl);
+      watch(path);
+    }
+
+  return version(entry, minify);
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconReload::version(SiliconReload::Entry& entry, bool minify)
+{
+  if (!minify)
+    return entry.tpl;
+
+  if (!entry.minified)
+    {
+      /* Same nodes, only literal text changes */
+      std::shared_ptr<SiliconTemplate> tpl = std::make_shared<SiliconTemplate>(*entry.tpl);
+      tpl->minify();
+      entry.minified = std::move(tpl);
+    }
+
+  return entry.minified;
+}
+
+SiliconReload::Stats SiliconReload::stats()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Stats res = _stats;
+  res.files = 0;
+  for (auto& e : entries)
+    {
+      if (e.second.tpl)
+	++res.files;
+    }
+  res.directories = directories.size();
+
+  return res;
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconReload::load(const std::string& path, const std::string& basePath)
+{
+  Silicon compiler = Silicon::createFromStr("");
+  compiler.localConfig.basePath = basePath;
+  /* Minified when an instance asks for it (@see version()) */
+  compiler.localConfig.minify = false;
+
+  char* data = NULL;
+  compiler.extractFile(&data, path, false);
+  std::shared_ptr<const SiliconTemplate> tpl;
+  try
+    {
+      tpl = compiler.compileSource(path, data, strlen(data));
+    }
+  catch (...)
+    {
+      free(data);
+      throw;
+    }
+  free(data);
+
+  return tpl;
+}
+
+void SiliconReload::publish(const std::string& path, SiliconReload::Entry& entry, std::shared_ptr<const SiliconTemplate> tpl)
+{
+  for (auto& b : entry.blocks)
+    dependents[b].erase(path);
+  entry.blocks.clear();
+
+  for (auto& node : tpl->nodes())
+    {
+      if ( (node.type != SiliconTemplate::Node::FUNCTION) || (node.name != "block") )
+	continue;
+
+      auto tplt = node.arguments.find("template");
+      if (tplt == node.arguments.end())
+	continue;
+
+      std::string block = Silicon::filePath(tplt->second, entry.basePath);
+      entry.blocks.insert(block);
+      dependents[block].insert(path);
+      /* Block changes must be noticed, even if it's not rendered yet */
+      auto b = entries.find(block);
+      if (b == entries.end())
+	{
+	  Entry& blockEntry = entries[block];
+	  blockEntry.basePath = entry.basePath;
+	  fileTime(block, blockEntry.mtime, blockEntry.size);
+	  watch(block);
+	}
+    }
+
+  fileTime(path, entry.mtime, entry.size);
+  entry.tpl = std::move(tpl);
+  entry.minified.reset();
+  _generation.fetch_add(1, std::memory_order_release);
+}
+
+void SiliconReload::reload(const std::string& path, std::set<std::string>& visited)
+{
+  if (!visited.insert(path).second)
+    return;
+
+  std::string basePath;
+  bool loaded;
+  std::set<std::string> including;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto e = entries.find(path);
+    loaded = ( (e != entries.end()) && (e->second.tpl) );
+    if (loaded)
+      basePath = e->second.basePath;
+    else if (e != entries.end())
+      fileTime(path, e->second.mtime, e->second.size);
+    auto d = dependents.find(path);
+    if (d != dependents.end())
+      including = d->second;
+  }
+
+  if (loaded)
+    {
+      try
+	{
+	  std::shared_ptr<const SiliconTemplate> tpl = load(path, basePath);
+	  std::lock_guard<std::mutex> lock(mutex);
+	  auto e = entries.find(path);
+	  if (e != entries.end())
+	    publish(path, e->second, tpl);
+	  ++_stats.reloads;
+	}
+      catch (SiliconException& e)
+	{
+	  std::lock_guard<std::mutex> lock(mutex);
+	  /* Keep the old version, and don't try again until it changes */
+	  auto en = entries.find(path);
+	  if (en != entries.end())
+	    fileTime(path, en->second.mtime, en->second.size);
+	  ++_stats.errors;
+	  _stats.lastError = path+": "+e.what();
+	}
+    }
+
+  /* Templates including it */
+  for (auto& i : including)
+    reload(i, visited);
+}
+
+void SiliconReload::watch(const std::string& path)
+{
+  std::string dir = directoryOf(path);
+  if (directories.find(dir) != directories.end())
+    return;
+
+  int wd = -1;
+#ifdef __linux__
+  if (inotifyFd >= 0)
+    wd = inotify_add_watch(inotifyFd, (dir.empty())?".":dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+#endif
+  directories[dir] = wd;
+}
+
+void SiliconReload::pollFiles(std::set<std::string>& changed)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  long long mtime;
+  off_t size;
+  for (auto& e : entries)
+    {
+      fileTime(e.first, mtime, size);
+      if ( (mtime != e.second.mtime) || (size != e.second.size) )
+	changed.insert(e.first);
+    }
+}
+
+void SiliconReload::run(unsigned pollInterval)
+{
+  while (running())
+    {
+      std::set<std::string> changed;
+#ifdef __linux__
+      if (inotifyFd >= 0)
+	{
+	  struct pollfd pfd = { inotifyFd, POLLIN, 0 };
+	  if (poll(&pfd, 1, pollInterval) > 0)
+	    {
+	      alignas(struct inotify_event) char buffer[4096];
+	      ssize_t len;
+	      while ( (len = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+		{
+		  std::lock_guard<std::mutex> lock(mutex);
+		  for (char* ptr = buffer; ptr < buffer+len; ptr+=sizeof(struct inotify_event)+((struct inotify_event*)ptr)->len)
+		    {
+		      struct inotify_event* ev = (struct inotify_event*) ptr;
+		      if (ev->len == 0)
+			continue;
+
+		      for (auto& d : directories)
+			{
+			  if (d.second == ev->wd)
+			    changed.insert((d.first.empty())?std::string(ev->name):d.first+DIRECTORY_SEPARATOR+ev->name);
+			}
+		    }
+		}
+	    }
+	}
+      else
+#endif
+	{
+	  std::unique_lock<std::mutex> lock(mutex);
+	  stopping.wait_for(lock, std::chrono::milliseconds(pollInterval), [] { return !running(); });
+	  lock.unlock();
+	  if (running())
+	    pollFiles(changed);
+	}
+
+      std::set<std::string> visited;
+      for (auto& path : changed)
+	reload(path, visited);
+    }
+}
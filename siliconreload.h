@@ -0,0 +1,147 @@
+/* @(#)siliconreload.h
+ */
+
+#ifndef _SILICONRELOAD_H
+#define _SILICONRELOAD_H 1
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/types.h>
+#include "silicon.h"
+#include "silicontemplate.h"
+
+/**
+ * Hot reload of template files. While running, templates, layouts
+ * and blocks created from files are compiled just once and taken from
+ * here. A background thread watches their directories (with inotify
+ * on Linux, or polling file times), compiles again changed files and
+ * publishes the new version. Renders already running keep the version
+ * they started with.
+ * Templates including a block are compiled again when the block changes.
+ */
+class SiliconReload
+{
+public:
+  struct Stats
+  {
+    /** Files compiled again after a change */
+    unsigned long reloads;
+    /** Changed files which couldn't be compiled (old version is kept) */
+    unsigned long errors;
+    /** Files watched */
+    std::size_t files;
+    /** Directories watched */
+    std::size_t directories;
+    /** Using inotify (false: polling) */
+    bool inotify;
+    /** Last reload error */
+    std::string lastError;
+  };
+
+  /**
+   * Starts watching files.
+   *
+   * @param pollInterval Milliseconds between file checks when polling
+   *                     (also the maximum time stop() waits)
+   * @param forcePolling Don't use inotify
+   */
+  static void start(unsigned pollInterval=1000, bool forcePolling=false);
+
+  /**
+   * Stops watching files. Published templates are forgotten, and
+   * instances and the layout compile their own sources again
+   */
+  static void stop();
+
+  /**
+   * Is the reload service running?
+   */
+  static bool running()
+  {
+    return _running.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Changes every time a new version is published, so instances
+   * know when to look for it.
+   */
+  static unsigned long generation()
+  {
+    return _generation.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Gets last version of a file. First time, it's loaded and
+   * watched.
+   *
+   * @param path File path
+   * @param basePath Base path to find the blocks it includes
+   * @param minify Minify setting of the instance asking for it
+   *
+   * @return compiled template
+   */
+  static std::shared_ptr<const SiliconTemplate> get(const std::string& path, const std::string& basePath, bool minify);
+
+  /**
+   * Gets counters
+   */
+  static Stats stats();
+
+private:
+  /* Loaded file, or block watched but not loaded yet (tpl is empty) */
+  struct Entry
+  {
+    std::shared_ptr<const SiliconTemplate> tpl;
+    /* tpl minified, made the first time an instance asks for it */
+    std::shared_ptr<const SiliconTemplate> minified;
+    std::string basePath;
+    /* Blocks included (paths) */
+    std::set<std::string> blocks;
+    /* Last seen, to find changes when polling (ns) */
+    long long mtime = 0;
+    off_t size = 0;
+  };
+
+  /* Reads and compiles file, not minified. Throws SiliconException */
+  static std::shared_ptr<const SiliconTemplate> load(const std::string& path, const std::string& basePath);
+
+  /* Version of a loaded file for a minify setting. Must be locked */
+  static std::shared_ptr<const SiliconTemplate> version(Entry& entry, bool minify);
+
+  /* Stores a new version of a file. Must be locked */
+  static void publish(const std::string& path, Entry& entry, std::shared_ptr<const SiliconTemplate> tpl);
+
+  /* Compiles again path and templates including it */
+  static void reload(const std::string& path, std::set<std::string>& visited);
+
+  /* Watches directory of path. Must be locked */
+  static void watch(const std::string& path);
+
+  /* Finds changed files by their modification time */
+  static void pollFiles(std::set<std::string>& changed);
+
+  /* Background thread */
+  static void run(unsigned pollInterval);
+
+  static std::atomic<bool> _running;
+  static std::atomic<unsigned long> _generation;
+  static std::map<std::string, Entry> entries;
+  /* Block path -> templates including it */
+  static std::map<std::string, std::set<std::string> > dependents;
+  /* Directory -> inotify watch */
+  static std::map<std::string, int> directories;
+  static int inotifyFd;
+  static Stats _stats;
+  static std::thread thread;
+  static std::mutex mutex;
+  /* To stop polling without waiting */
+  static std::condition_variable stopping;
+};
+
+#endif /* _SILICONRELOAD_H */
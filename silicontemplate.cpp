@@ -0,0 +1,356 @@
+/**
+*************************************************************
+* @file silicontemplate.cpp
+* @brief Compiled templates and compiled templates cache
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*   20261018 : Cache keeps a template for each minify setting
+*   20261018 : Text followed as HTML for the escape context of keywords
+*   20261018 : minify(): HTML literal text minified when compiling
+*   20261018 : Keyword and collection nodes keep their name split as a value path
+*   20261018 : Nodes keep the hash of their name
+*
+*************************************************************/
+
+#include "silicontemplate.h"
+#include "siliconhash.h"
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <strings.h>
+
+namespace
+{
+  /* Elements whose contents are not minified */
+  const char* keptElements[] = { "pre", "textarea", "script", "style", NULL };
+
+  inline bool isSpace(char c)
+  {
+    return ( (c==' ') || (c=='\t') || (c=='\n') || (c=='\r') || (c=='\f') );
+  }
+
+  /**
+   * HTML minifier for literal text. Text comes in pieces (text between
+   * tags of the template), state goes from one to the next.
+   */
+  class HtmlMinifier
+  {
+  public:
+    HtmlMinifier(): inTag(false), quote(0), keep(NULL), opening(NULL)
+    {
+    }
+
+    void text(const char* str, std::size_t len, std::string& out)
+    {
+      /* out ends with a whitespace run we wrote (merged with the next one) */
+      bool collapsed = false;
+      std::size_t i=0;
+      while (i<len)
+	{
+	  char c = str[i];
+	  if ( (collapsed) && (!isSpace(c)) && ( (quote) || (inTag) || (keep) || (!comment(str, len, i)) ) )
+	    collapsed = false;
+
+	  if ( (keep) && (!inTag) )
+	    {
+	      /* Everything until the closing tag stays */
+	      std::size_t close = findClose(str, len, i);
+	      out.append(str+i, close-i);
+	      i = close;
+	      if (i<len)
+		keep = NULL;
+	      continue;
+	    }
+
+	  if (quote)
+	    {
+	      /* Attribute values stay */
+	      if (c == quote)
+		quote = 0;
+	      out+=c;
+	      ++i;
+	    }
+	  else if (isSpace(c))
+	    {
+	      bool newLine = false;
+	      for (; (i<len) && (isSpace(str[i])); ++i)
+		newLine = newLine || (str[i] == '\n');
+	      if (!collapsed)
+		out+= (newLine)?'\n':' ';
+	      else if (newLine)
+		out.back() = '\n';
+	      collapsed = true;
+	    }
+	  else if (inTag)
+	    {
+	      if ( (c == '"') || (c == '\'') )
+		quote = c;
+	      else if (c == '>')
+		{
+		  inTag = false;
+		  keep = opening;
+		  opening = NULL;
+		}
+	      out+=c;
+	      ++i;
+	    }
+	  else if (comment(str, len, i))
+	    {
+	      /* Comments go away, unless they are conditional or
+		 something from the template is inside */
+	      static const char endComment[] = "-->";
+	      const char* end = std::search(str+i+4, str+len, endComment, endComment+3);
+	      if (end != str+len)
+		i = end+3-str;
+	      else
+		{
+		  out.append(str+i, len-i);
+		  i = len;
+		}
+	    }
+	  else if ( (c == '<') && (i+1<len) && ( (isalpha((unsigned char) str[i+1])) || (str[i+1] == '/') || (str[i+1] == '!') ) )
+	    {
+	      inTag = true;
+	      opening = keptElement(str+i+1, len-i-1);
+	      out+=c;
+	      ++i;
+	    }
+	  else
+	    {
+	      out+=c;
+	      ++i;
+	    }
+	}
+    }
+
+  private:
+    /* Comment (not conditional) starts at i */
+    static bool comment(const char* str, std::size_t len, std::size_t i)
+    {
+      return ( (i+3<len) && (memcmp(str+i, "<!--", 4) == 0) && ( (i+4==len) || (str[i+4] != '[') ) );
+    }
+
+    /* Element to keep, if name starts with one of them */
+    static const char* keptElement(const char* name, std::size_t len)
+    {
+      for (const char** e = keptElements; *e; ++e)
+	{
+	  std::size_t elen = strlen(*e);
+	  if ( (len > elen) && (strncasecmp(name, *e, elen) == 0) && (!isalnum((unsigned char) name[elen])) )
+	    return *e;
+	}
+
+      return NULL;
+    }
+
+    /* Position of </keep in str, or len */
+    std::size_t findClose(const char* str, std::size_t len, std::size_t from)
+    {
+      std::size_t elen = strlen(keep);
+      for (std::size_t i=from; i+elen+1<len; ++i)
+	{
+	  if ( (str[i] == '<') && (str[i+1] == '/') && (strncasecmp(str+i+2, keep, elen) == 0) )
+	    return i;
+	}
+
+      return len;
+    }
+
+    bool inTag;
+    char quote;
+    const char* keep;
+    const char* opening;
+  };
+}
+
+SiliconTemplate::SiliconTemplate(const char* data, std::size_t len): _source(data, len)
+{
+  /* Bundles keep minified templates, with their text */
+  _length = _source.find('\0');
+  if (_length == std::string::npos)
+    _length = _source.size();
+}
+
+void SiliconTemplate::addText(std::size_t pos, std::size_t len, std::size_t scope)
+{
+  for (std::size_t i=pos; i<pos+len; ++i)
+    _html.feed(_source[i]);
+
+  if (_nodes.size() > scope)
+    {
+      Node& last = _nodes.back();
+      if ( (last.type == Node::TEXT) && (last.pos + last.len == pos) )
+	{
+	  last.len+=len;
+	  return;
+	}
+    }
+
+  add(Node::TEXT, pos, len);
+}
+
+std::size_t SiliconTemplate::add(SiliconTemplate::Node::Type type, std::size_t pos, std::size_t len)
+{
+  Node n;
+  n.type = type;
+  n.pos = pos;
+  n.len = len;
+  n.end = _nodes.size()+1;
+  n.escape = SiliconEscape::NONE;
+  n.filtered = false;
+  n.body = false;
+  n.hash = 0;
+  _nodes.push_back(std::move(n));
+
+  return _nodes.size()-1;
+}
+
+void SiliconTemplate::close(std::size_t index)
+{
+  _nodes[index].end = _nodes.size();
+}
+
+void SiliconTemplate::hashNames()
+{
+  for (auto& n : _nodes)
+    {
+      n.hash = SiliconHash::of(n.name);
+      if ( (n.type == Node::KEYWORD) || (n.type == Node::COLLECTION) )
+	n.path = SiliconValue::parsePath(n.name);
+    }
+}
+
+void SiliconTemplate::minify()
+{
+  if (minified())
+    return;
+
+  HtmlMinifier minifier;
+  std::string literals(1, '\0');
+  std::string text;
+  for (auto& n : _nodes)
+    {
+      if (n.type != Node::TEXT)
+	continue;
+
+      text.clear();
+      minifier.text(_source.data()+n.pos, n.len, text);
+      n.pos = _length+literals.size();
+      n.len = text.size();
+      literals+=text;
+    }
+  _source+=literals;
+}
+
+std::size_t SiliconTemplate::hash(const char* data, std::size_t len)
+{
+  /* FNV-1a */
+  unsigned long long h = 14695981039346656037ULL;
+  for (std::size_t i=0; i<len; ++i)
+    {
+      h^= (unsigned char) data[i];
+      h*= 1099511628211ULL;
+    }
+
+  return (std::size_t) h;
+}
+
+SiliconTemplateCache::SiliconTemplateCache(std::size_t capacity): _capacity(capacity)
+{
+  _stats.hits = 0;
+  _stats.misses = 0;
+  _stats.evictions = 0;
+}
+
+std::size_t SiliconTemplateCache::key(const char* data, std::size_t len, bool minified)
+{
+  std::size_t h = SiliconTemplate::hash(data, len);
+  return (minified)?~h:h;
+}
+
+std::shared_ptr<const SiliconTemplate> SiliconTemplateCache::find(const char* data, std::size_t len, bool minified)
+{
+  std::size_t h = key(data, len, minified);
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  auto i = index.find(h);
+  /* Same hash isn't enough, source must be the same */
+  if ( (i == index.end()) || (i->second->second->length() != len) || (i->second->second->minified() != minified) ||
+       (i->second->second->source().compare(0, len, data, len) != 0) )
+    {
+      ++_stats.misses;
+      return std::shared_ptr<const SiliconTemplate>();
+    }
+
+  ++_stats.hits;
+  lru.splice(lru.begin(), lru, i->second);
+  return i->second->second;
+}
+
+void SiliconTemplateCache::insert(std::shared_ptr<const SiliconTemplate> tpl)
+{
+  std::size_t h = key(tpl->source().data(), tpl->length(), tpl->minified());
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  if (_capacity == 0)
+    return;
+
+  auto i = index.find(h);
+  if (i != index.end())
+    {
+      /* Another thread compiled it too, or a collision. Keep the new one */
+      i->second->second = tpl;
+      lru.splice(lru.begin(), lru, i->second);
+      return;
+    }
+
+  lru.push_front({ h, tpl });
+  index.insert({ h, lru.begin() });
+  trim();
+}
+
+void SiliconTemplateCache::capacity(std::size_t capacity)
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  _capacity = capacity;
+  trim();
+}
+
+void SiliconTemplateCache::clear()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  lru.clear();
+  index.clear();
+}
+
+SiliconTemplateCache::Stats SiliconTemplateCache::stats()
+{
+#if USEMUTEX
+  std::lock_guard<std::mutex> lock(mutex);
+#endif
+  Stats res = _stats;
+  res.size = lru.size();
+  res.capacity = _capacity;
+
+  return res;
+}
+
+void SiliconTemplateCache::trim()
+{
+  while (lru.size() > _capacity)
+    {
+      index.erase(lru.back().first);
+      lru.pop_back();
+      ++_stats.evictions;
+    }
+}
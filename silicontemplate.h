@@ -0,0 +1,259 @@
+/* @(#)silicontemplate.h
+ */
+
+#ifndef _SILICONTEMPLATE_H
+#define _SILICONTEMPLATE_H 1
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include "siliconescape.h"
+#include "siliconvalue.h"
+
+#ifndef USEMUTEX
+  #define USEMUTEX 1
+#endif
+
+#if USEMUTEX
+  #include <mutex>
+#endif
+
+/**
+ * Compiled template. Source is tokenized just once into a flat list
+ * of nodes, and renders only walk these nodes. Literal text is never
+ * copied: text nodes point to source positions.
+ * Once compiled, it's never modified, so it can be shared by many
+ * instances and threads.
+ */
+class SiliconTemplate
+{
+public:
+  struct Node
+  {
+    enum Type
+      {
+	TEXT,			/* Literal text */
+	KEYWORD,		/* {{keyword}} */
+	FUNCTION,		/* {!function}} */
+	IF,			/* {%if}} */
+	IFFUN,			/* {%iffun}} */
+	COLLECTION		/* {%collection}} */
+      };
+
+    Type type;
+    /* TEXT: where the text is in source. Others: where the tag is */
+    std::size_t pos;
+    std::size_t len;
+    /* Nodes in the body are [this+1, end). Next sibling is end */
+    std::size_t end;
+    /* Keyword (without filter) or function name. Collection variable */
+    std::string name;
+    /* Hash of name (@see hashNames()) */
+    uint32_t hash;
+    /* KEYWORD, COLLECTION: name split as a path for values */
+    SiliconValue::Path path;
+    /* KEYWORD: Escape from filter (or detected context if not filtered) */
+    SiliconEscape::Context escape;
+    /* KEYWORD: |filter present */
+    bool filtered;
+    /* FUNCTION: has body (not autoclosed) */
+    bool body;
+    /* FUNCTION: arguments. COLLECTION: loops */
+    std::map<std::string, std::string> arguments;
+    /* IF: conditions. IFFUN: function names */
+    std::vector<std::string> values;
+  };
+
+  /**
+   * Constructor. Source is copied, nodes are added later
+   *
+   * @param data Template source
+   * @param len Source length
+   */
+  SiliconTemplate(const char* data, std::size_t len);
+
+  /**
+   * Template source. Once minified, literal text follows it
+   * (@see minify())
+   */
+  const std::string& source() const
+  {
+    return _source;
+  }
+
+  /**
+   * Source length, without minified literal text
+   */
+  std::size_t length() const
+  {
+    return _length;
+  }
+
+  /**
+   * Literal text is minified
+   */
+  bool minified() const
+  {
+    return _length < _source.size();
+  }
+
+  /**
+   * Compiled nodes
+   */
+  const std::vector<Node>& nodes() const
+  {
+    return _nodes;
+  }
+
+  /**
+   * Adds literal text. Contiguous text in the same body
+   * will be just one node. Text is followed as HTML to know
+   * the escape context of keywords (@see context()).
+   *
+   * @param pos Text position in source
+   * @param len Text length
+   * @param scope First node of the current body
+   */
+  void addText(std::size_t pos, std::size_t len, std::size_t scope);
+
+  /**
+   * Escape context where the text added so far ends
+   */
+  SiliconEscape::Context context() const
+  {
+    return _html.context();
+  }
+
+  /**
+   * Adds node. Its body will be the nodes added until close()
+   *
+   * @param type Node type
+   * @param pos Tag position in source
+   * @param len Tag length
+   *
+   * @return New node index
+   */
+  std::size_t add(Node::Type type, std::size_t pos, std::size_t len);
+
+  /**
+   * Gets node to complete it while compiling
+   */
+  Node& node(std::size_t index)
+  {
+    return _nodes[index];
+  }
+
+  /**
+   * Ends the body of a node
+   *
+   * @param index Node index
+   */
+  void close(std::size_t index);
+
+  /**
+   * Calculates name hashes and splits value paths once nodes are
+   * complete, so names are not hashed or split every time they are
+   * looked up
+   */
+  void hashNames();
+
+  /**
+   * Minifies literal text (HTML) once nodes are complete: whitespace
+   * runs become one space (or newline), comments are removed, and
+   * <pre>, <textarea>, <script> and <style> contents are kept as they
+   * are. Text goes after the source and a NUL, so positions of tags
+   * (and error lines) don't change.
+   */
+  void minify();
+
+  /**
+   * Hash for template sources
+   */
+  static std::size_t hash(const char* data, std::size_t len);
+
+private:
+  std::string _source;
+  std::size_t _length;
+  std::vector<Node> _nodes;
+  /* Only used while compiling */
+  SiliconEscape::Scanner _html;
+};
+
+/**
+ * Bounded cache of compiled templates, found by source and minify
+ * setting. When it's full, the least recently used template goes away.
+ */
+class SiliconTemplateCache
+{
+public:
+  struct Stats
+  {
+    /** Templates found */
+    unsigned long hits;
+    /** Templates not found */
+    unsigned long misses;
+    /** Templates removed to make room */
+    unsigned long evictions;
+    /** Templates now */
+    std::size_t size;
+    /** Maximum templates */
+    std::size_t capacity;
+  };
+
+  SiliconTemplateCache(std::size_t capacity);
+
+  /**
+   * Finds compiled template for source
+   *
+   * @param data Template source
+   * @param len Source length
+   * @param minified Literal text minified (@see SiliconTemplate::minify())
+   *
+   * @return compiled template, or empty pointer if not cached
+   */
+  std::shared_ptr<const SiliconTemplate> find(const char* data, std::size_t len, bool minified);
+
+  /**
+   * Stores compiled template
+   */
+  void insert(std::shared_ptr<const SiliconTemplate> tpl);
+
+  /**
+   * Changes maximum templates. 0 disables the cache
+   */
+  void capacity(std::size_t capacity);
+
+  /**
+   * Removes all templates
+   */
+  void clear();
+
+  /**
+   * Gets counters
+   */
+  Stats stats();
+
+private:
+  typedef std::list<std::pair<std::size_t, std::shared_ptr<const SiliconTemplate> > > LruList;
+
+  void trim();
+
+  /* Source hash, different for each minify setting */
+  static std::size_t key(const char* data, std::size_t len, bool minified);
+
+  /* Most recently used first */
+  LruList lru;
+  std::unordered_map<std::size_t, LruList::iterator> index;
+  std::size_t _capacity;
+  Stats _stats;
+#if USEMUTEX
+  std::mutex mutex;
+#endif
+};
+
+#endif /* _SILICONTEMPLATE_H */
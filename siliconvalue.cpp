@@ -0,0 +1,128 @@
+/**
+*************************************************************
+* @file siliconvalue.cpp
+* @brief Tree-shaped data for templates
+*
+* @author Gaspar Fernández <gaspar.fernandez@totaki.com>
+* @version 0.1
+* @date 18 oct 2026
+*
+* Changelog:
+*
+*************************************************************/
+
+#include "siliconvalue.h"
+
+SiliconValue SiliconValue::object()
+{
+  SiliconValue res;
+  res._type = OBJECT;
+  return res;
+}
+
+SiliconValue SiliconValue::array()
+{
+  SiliconValue res;
+  res._type = ARRAY;
+  return res;
+}
+
+std::size_t SiliconValue::size() const
+{
+  if (_type == OBJECT)
+    return members.size();
+  else if (_type == ARRAY)
+    return elements.size();
+
+  return 0;
+}
+
+SiliconValue& SiliconValue::operator[](const std::string& key)
+{
+  if (_type == NONE)
+    _type = OBJECT;
+
+  return members[key];
+}
+
+SiliconValue& SiliconValue::push(SiliconValue value)
+{
+  if (_type == NONE)
+    _type = ARRAY;
+
+  elements.push_back(std::move(value));
+  return elements.back();
+}
+
+const SiliconValue* SiliconValue::get(const std::string& key) const
+{
+  if (_type != OBJECT)
+    return NULL;
+
+  auto m = members.find(key);
+  return (m == members.end())?NULL:&m->second;
+}
+
+const SiliconValue* SiliconValue::at(std::size_t index) const
+{
+  if ( (_type != ARRAY) || (index >= elements.size()) )
+    return NULL;
+
+  return &elements[index];
+}
+
+const SiliconValue* SiliconValue::find(const SiliconValue::Segment* first, const SiliconValue::Segment* last) const
+{
+  const SiliconValue* v = this;
+  for (; (v) && (first != last); ++first)
+    {
+      if (first->index >= 0)
+	v = v->at(first->index);
+      else if (v->_type != OBJECT)
+	return NULL;
+      else
+	{
+	  /* Hash was calculated with the path */
+	  auto m = v->members.find(first->key.data(), first->key.size(), first->hash);
+	  v = (m == v->members.end())?NULL:&m->second;
+	}
+    }
+
+  return v;
+}
+
+SiliconValue::Path SiliconValue::parsePath(const char* path, std::size_t len)
+{
+  Path res;
+  const char* end = path+len;
+  const char* start = path;
+  for (const char* c = path; c <= end; ++c)
+    {
+      if ( (c != end) && (*c != '.') && (*c != '[') )
+	continue;
+
+      if (c > start)
+	res.push_back({ std::string(start, c-start), SiliconHash::of(start, c-start), -1 });
+      start = c+1;
+
+      /* [N] */
+      if ( (c != end) && (*c == '[') )
+	{
+	  const char* close = c+1;
+	  long index = 0;
+	  while ( (close < end) && (*close >= '0') && (*close <= '9') )
+	    index = index*10 + (*close++ - '0');
+	  if ( (close == c+1) || (close >= end) || (*close != ']') )
+	    {
+	      /* Not an index, it's part of the key */
+	      res.push_back({ std::string(c, end-c), SiliconHash::of(c, end-c), -1 });
+	      return res;
+	    }
+	  res.push_back({ std::string(), 0, index });
+	  c = close;
+	  start = c+1;
+	}
+    }
+
+  return res;
+}
@@ -0,0 +1,135 @@
+/* @(#)siliconvalue.h
+ */
+
+#ifndef _SILICONVALUE_H
+#define _SILICONVALUE_H 1
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "siliconhash.h"
+
+/**
+ * Tree-shaped data for templates: objects, arrays and strings, without
+ * flattening them into dotted keywords. Templates reach them with
+ * paths like {{order.customer.name}} or {{order.items[0].sku}}, and
+ * {%collection var="order.items"}} loops over an array.
+ */
+class SiliconValue
+{
+public:
+  enum Type
+    {
+      NONE,
+      STRING,
+      OBJECT,
+      ARRAY
+    };
+
+  /**
+   * One step of a path: object member, or array element ([N])
+   */
+  struct Segment
+  {
+    std::string key;
+    uint32_t hash;
+    /* Array element, -1 for members */
+    long index;
+
+    bool operator==(const Segment& other) const
+    {
+      return ( (index == other.index) && (hash == other.hash) && (key == other.key) );
+    }
+  };
+
+  typedef std::vector<Segment> Path;
+
+  SiliconValue(): _type(NONE)
+  {
+  }
+
+  SiliconValue(std::string str): _type(STRING), _str(std::move(str))
+  {
+  }
+
+  SiliconValue(const char* str): _type(STRING), _str(str)
+  {
+  }
+
+  static SiliconValue object();
+  static SiliconValue array();
+
+  Type type() const
+  {
+    return _type;
+  }
+
+  /**
+   * String value. Empty if it's not a string
+   */
+  const std::string& str() const
+  {
+    return _str;
+  }
+
+  /**
+   * Members of an object or elements of an array
+   */
+  std::size_t size() const;
+
+  /**
+   * Object member, added if it's not there. A value without type
+   * becomes an object
+   */
+  SiliconValue& operator[](const std::string& key);
+
+  /**
+   * Adds element to array. A value without type becomes an array
+   *
+   * @return new element
+   */
+  SiliconValue& push(SiliconValue value);
+
+  /**
+   * Object member
+   *
+   * @return member or NULL if not found or this is not an object
+   */
+  const SiliconValue* get(const std::string& key) const;
+
+  /**
+   * Array element
+   *
+   * @return element or NULL if out of range or this is not an array
+   */
+  const SiliconValue* at(std::size_t index) const;
+
+  /**
+   * Follows path from this value
+   *
+   * @param first First segment
+   * @param last Past the last segment
+   *
+   * @return value or NULL if the path doesn't exist
+   */
+  const SiliconValue* find(const Segment* first, const Segment* last) const;
+
+  /**
+   * Splits path (a.b[2].c) into segments, with the hashes of the keys
+   */
+  static Path parsePath(const char* path, std::size_t len);
+
+  static Path parsePath(const std::string& path)
+  {
+    return parsePath(path.data(), path.size());
+  }
+
+private:
+  Type _type;
+  std::string _str;
+  SiliconHashMap<SiliconValue> members;
+  std::vector<SiliconValue> elements;
+};
+
+#endif /* _SILICONVALUE_H */
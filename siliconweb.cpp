@@ -11,6 +11,16 @@
 * @date 28 sep 2015
 *
 * Changelog:
+*   - 20261018 : renderCss/renderJs wait for async blocks before them
+*   - 20261018 : Assets included by async blocks, where each block was
+*   - 20261018 : CSS found again only with the same media
+*   - 20261018 : list written directly from the collection, without
+*       parsing a generated template. New olist, options and table
+*   - 20261018 : CSS/JS URLs and render mode cached until settings change.
+*       Tags built in one reserved buffer
+*   - 20261018 : CSS/JS stored in a deduplicated asset registry, instead
+*       of _CSS, _JS and _directJS collections
+*   - 20261018 : hrefs and media escaped when auto escape is enabled
 *   - 20160207 : Javascripts are not rel="stylesheet"!!
 *   - 20160205 : includeCss / includeJs / directJs as members too
 *   - 20151008 : bug fixed. When using includeCss with 
@@ -33,10 +43,10 @@
                       "renderCSS" / "renderJS" function. "0" is false,
 		      otherwise, true
 
-  Used collections:
-  _CSS              : To store all CSS files to be rendered
-  _JS               : To store all JS files to be rendered
-  _directJS         : To store all JS code to be attached
+  Included CSS, JS files and JS code are stored in each instance's asset
+  registry (SiliconWeb::assets()), in order, just once each. Assets included
+  by templates only last for one render, the ones included from C++ are
+  kept. Assets of async blocks are put where each block was.
 
   Available functions (for templates):
   includeCss ( file="cssfile" [media="media"] ) : include css file
@@ -45,11 +55,17 @@
   renderCss
   renderJs
   list : renders a list with a collection
+  olist : renders an ordered list with a collection
+  options : renders <option>s with a collection
+  table : renders a table with a collection
 
   Available methods (for C++):
   */
 #include "siliconweb.h"
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <iterator>
 
 namespace
 {
@@ -58,19 +74,190 @@ namespace
     return ( (!path.empty()) && (path.back()!='/') )?path+'/':path;
   }
 
-  bool isAbsolute(std::string url)
+  bool isAbsolute(const std::string& url)
   {
-    if (url.front()=='/')
+    if ( (!url.empty()) && (url.front()=='/') )
       return true;
 
-    std::string cut8=url.substr(0,8);
-    return ( (cut8.substr(0,7)=="http://") || (cut8=="https://") );
+    return ( (url.compare(0, 7, "http://")==0) || (url.compare(0, 8, "https://")==0) );
+  }
+
+  /* Prefix + file, unless file is absolute */
+  std::string resolveUrl(const std::string& prefix, const std::string& file)
+  {
+    if (isAbsolute(file))
+      return file;
+
+    std::string url;
+    url.reserve(prefix.size()+file.size());
+    url.append(prefix).append(file);
+    return url;
+  }
+
+  /* Attribute values must be escaped if the template escapes keywords */
+  inline void appendAttribute(Silicon* s, std::string& out, const std::string& value)
+  {
+    if (s->getAutoEscape())
+      SiliconEscape::append(SiliconEscape::ATTRIBUTE, out, value.data(), value.size());
+    else
+      out.append(value);
+  }
+
+  std::string cssTag(Silicon* s, const std::string& href, const std::string* media)
+  {
+    static const char start[] = "<link href=\"";
+    static const char end[] = "\" rel=\"stylesheet\" type=\"text/css\"";
+    std::string out;
+    /* Some room in case it's escaped */
+    out.reserve(sizeof(start)+sizeof(end)+href.size()+((media)?media->size()+9:0)+16);
+    out.append(start, sizeof(start)-1);
+    appendAttribute(s, out, href);
+    out.append(end, sizeof(end)-1);
+    if (media)
+      {
+	out.append(" media=\"", 8);
+	appendAttribute(s, out, *media);
+	out+='"';
+      }
+    out.append(" />", 3);
+    return out;
+  }
+
+  /* The same stylesheet may be included for several media */
+  inline std::string cssKey(const std::string& href, const std::string* media)
+  {
+    return (media)?href+'\n'+*media:href;
+  }
+
+  /* Text must be escaped if the template escapes keywords */
+  inline void appendText(Silicon* s, std::string& out, const std::string& value)
+  {
+    if (s->getAutoEscape())
+      SiliconEscape::append(SiliconEscape::HTML, out, value.data(), value.size());
+    else
+      out.append(value);
+  }
+
+  /* Field of a collection row, empty if it's not there */
+  inline const std::string& field(const Silicon::StringMap& row, const std::string& name)
+  {
+    static const std::string empty;
+    auto f = row.find(name);
+    return (f==row.end())?empty:f->second;
+  }
+
+  /* Appends class and id attributes if present in args */
+  void appendClassId(Silicon* s, std::string& out, const Silicon::StringMap& args)
+  {
+    auto tagclass = args.find("class");
+    if (tagclass != args.end())
+      {
+	out.append(" class=\"", 8);
+	appendAttribute(s, out, tagclass->second);
+	out+='"';
+      }
+
+    auto tagid = args.find("id");
+    if (tagid != args.end())
+      {
+	out.append(" id=\"", 5);
+	appendAttribute(s, out, tagid->second);
+	out+='"';
+      }
+  }
+
+  /* Splits comma separated values */
+  std::vector<std::string> splitList(const std::string& str)
+  {
+    std::vector<std::string> res;
+    std::size_t start = 0;
+    while (start <= str.size())
+      {
+	std::size_t end = str.find(',', start);
+	if (end == std::string::npos)
+	  end = str.size();
+	res.push_back(str.substr(start, end-start));
+	start = end+1;
+      }
+    return res;
+  }
+
+  /* Rough output size: rows*(bytes per row) */
+  std::size_t estimateRows(const std::vector<Silicon::StringMap>& rows, std::size_t perRow)
+  {
+    std::size_t len = 0;
+    for (auto& r : rows)
+      {
+	len+=perRow;
+	for (auto& f : r)
+	  len+=f.second.size();
+      }
+    return len;
+  }
+
+  std::string listTag(Silicon* s, const Silicon::StringMap& args, const char* tag)
+  {
+    auto collection = args.find("collection");
+    if (collection == args.end())
+      return "";
+
+    auto _uselink = args.find("uselink");
+    bool uselink = ( (_uselink != args.end()) && (_uselink->second!="0") );
+
+    const std::vector<Silicon::StringMap>& rows = s->getCollection(collection->second);
+    std::string out;
+    out.reserve(estimateRows(rows, (uselink)?40:12)+64);
+    out.append(1, '<').append(tag);
+    appendClassId(s, out, args);
+    out.append(">\n", 2);
+
+    for (auto& row : rows)
+      {
+	out.append("<li>", 4);
+	if (uselink)
+	  {
+	    out.append("<a href=\"", 9);
+	    appendAttribute(s, out, field(row, "link"));
+	    out+='"';
+	    const std::string& title = field(row, "title");
+	    if (!title.empty())
+	      {
+		out.append(" title=\"", 8);
+		appendAttribute(s, out, title);
+		out+='"';
+	      }
+	    out+='>';
+	  }
+	appendText(s, out, field(row, "text"));
+	if (uselink)
+	  out.append("</a>", 4);
+	out.append("</li>\n", 6);
+      }
+
+    out.append("</", 2).append(tag).append(1, '>');
+    return out;
+  }
+
+  std::string jsTag(Silicon* s, const std::string& src, const char* extra="")
+  {
+    static const char start[] = "<script type=\"text/javascript\" src=\"";
+    static const char end[] = "></script>";
+    std::size_t extraLen = strlen(extra);
+    std::string out;
+    out.reserve(sizeof(start)+sizeof(end)+extraLen+src.size()+16);
+    out.append(start, sizeof(start)-1);
+    appendAttribute(s, out, src);
+    out+='"';
+    out.append(extra, extraLen);
+    out.append(end, sizeof(end)-1);
+    return out;
   }
 }
 
 std::string SiliconWeb::_defaultUrl ="";
 std::string SiliconWeb::_cssUrl ="";
 std::string SiliconWeb::_jsUrl ="";
+std::atomic<unsigned long> SiliconWeb::_defaultsVersion(0);
 bool SiliconWeb::_renderDefault = true;
 
 void SiliconWeb::load(Silicon * s)
@@ -83,80 +270,262 @@ void SiliconWeb::load(Silicon * s)
   loadFunction("renderCss", SiliconWeb::renderCss, s);
   loadFunction("renderJs", SiliconWeb::renderJs, s);
   loadFunction("list", SiliconWeb::list, s);
+  loadFunction("olist", SiliconWeb::olist, s);
+  loadFunction("options", SiliconWeb::options, s);
+  loadFunction("table", SiliconWeb::table, s);
 }
 
 std::string SiliconWeb::list (Silicon* s, Silicon::StringMap args, std::string input)
+{
+  return listTag(s, args, "ul");
+}
+
+std::string SiliconWeb::olist (Silicon* s, Silicon::StringMap args, std::string input)
+{
+  return listTag(s, args, "ol");
+}
+
+std::string SiliconWeb::options (Silicon* s, Silicon::StringMap args, std::string input)
 {
   auto collection = args.find("collection");
   if (collection == args.end())
     return "";
-  auto tagclass = args.find("class");
-  auto tagid = args.find("id");
-  auto _uselink = args.find("uselink");
-  bool uselink = ( (_uselink != args.end()) && (_uselink->second!="0") );
-
-  std::string col = collection->second;
-
-  std::string templ = "<ul";
-  if (tagclass != args.end())
-    templ+=" class=\""+tagclass->second+"\"";
-
-  if (tagid != args.end())
-    templ+=" id=\""+tagid->second+"\"";
-
-  templ+=">\n"
-    "{%collection var="+col+"}}\n"
-    "<li>";
-  if (uselink)
-    templ+="<a href=\"{{"+col+".link}}\" {%if "+col+".title}} title=\"{{"+col+".title}}\">{/if}}>";
-  templ+="{{"+col+".text}}";
-  if (uselink)
-    templ+="</a>";
-  templ+="</li>\n"
-    "{/collection}}\n"
-    "</ul>";
-  return s->parse(templ);
+
+  auto selected = args.find("selected");
+  const std::vector<Silicon::StringMap>& rows = s->getCollection(collection->second);
+  std::string out;
+  out.reserve(estimateRows(rows, 40));
+  for (auto& row : rows)
+    {
+      const std::string& value = field(row, "value");
+      out.append("<option value=\"", 15);
+      appendAttribute(s, out, value);
+      out+='"';
+      if ( (selected != args.end()) && (selected->second == value) )
+	out.append(" selected=\"selected\"", 20);
+      out+='>';
+      appendText(s, out, field(row, "text"));
+      out.append("</option>\n", 10);
+    }
+
+  return out;
+}
+
+std::string SiliconWeb::table (Silicon* s, Silicon::StringMap args, std::string input)
+{
+  auto collection = args.find("collection");
+  auto _columns = args.find("columns");
+  if ( (collection == args.end()) || (_columns == args.end()) )
+    return "";
+
+  std::vector<std::string> columns = splitList(_columns->second);
+  const std::vector<Silicon::StringMap>& rows = s->getCollection(collection->second);
+  std::string out;
+  out.reserve(estimateRows(rows, 10+columns.size()*9)+64);
+  out.append("<table", 6);
+  appendClassId(s, out, args);
+  out.append(">\n", 2);
+
+  auto headers = args.find("headers");
+  if (headers != args.end())
+    {
+      out.append("<tr>", 4);
+      for (auto& h : splitList(headers->second))
+	{
+	  out.append("<th>", 4);
+	  appendText(s, out, h);
+	  out.append("</th>", 5);
+	}
+      out.append("</tr>\n", 6);
+    }
+
+  for (auto& row : rows)
+    {
+      out.append("<tr>", 4);
+      for (auto& c : columns)
+	{
+	  out.append("<td>", 4);
+	  appendText(s, out, field(row, c));
+	  out.append("</td>", 5);
+	}
+      out.append("</tr>\n", 6);
+    }
+
+  out.append("</table>", 8);
+  return out;
+}
+
+bool SiliconWeb::AssetList::add(const std::string& key, std::string tag, bool persistent)
+{
+  auto res = index.insert({ key, _assets.size() });
+  if (!res.second)
+    {
+      /* Already there. If C++ includes it now, keep it */
+      _assets[res.first->second].persistent|= persistent;
+      return false;
+    }
+
+  _assets.push_back({ key, std::move(tag), persistent });
+  return true;
+}
+
+void SiliconWeb::AssetList::dropRendered()
+{
+  std::size_t kept = 0;
+  for (std::size_t i=0; i<_assets.size(); ++i)
+    {
+      if (!_assets[i].persistent)
+	continue;
+
+      if (kept != i)
+	_assets[kept] = std::move(_assets[i]);
+      ++kept;
+    }
+  if (kept == _assets.size())
+    return;
+
+  _assets.resize(kept);
+  blocks.clear();
+  index.clear();
+  for (std::size_t i=0; i<_assets.size(); ++i)
+    index.insert({ _assets[i].key, i });
+}
+
+void SiliconWeb::AssetList::blockStarted(std::size_t id)
+{
+  blocks.push_back({ id, _assets.size() });
+}
+
+void SiliconWeb::AssetList::blockRendered(std::size_t id, SiliconWeb::AssetList&& block)
+{
+  /* Not started here: the list didn't exist yet, everything came after it */
+  std::size_t pos = 0;
+  for (auto b = blocks.begin(); b != blocks.end(); ++b)
+    {
+      if (b->first == id)
+	{
+	  pos = b->second;
+	  blocks.erase(b);
+	  break;
+	}
+    }
+  if (block.empty())
+    return;
+
+  std::vector<Asset> merged;
+  merged.reserve(_assets.size()+block._assets.size());
+  std::move(_assets.begin(), _assets.begin()+pos, std::back_inserter(merged));
+  for (auto& a : block._assets)
+    {
+      auto found = index.find(a.key);
+      if ( (found == index.end()) || (found->second >= pos) )
+	merged.push_back(std::move(a));
+    }
+  /* New position of each asset after the block, for the blocks started there */
+  std::vector<std::size_t> moved;
+  moved.reserve(_assets.size()-pos+1);
+  for (std::size_t i=pos; i<_assets.size(); ++i)
+    {
+      moved.push_back(merged.size());
+      if (block.index.find(_assets[i].key) == block.index.end())
+	merged.push_back(std::move(_assets[i]));
+    }
+  moved.push_back(merged.size());
+
+  for (auto& b : blocks)
+    {
+      /* Blocks started before this one stay before its assets */
+      if ( (b.second > pos) || ( (b.second == pos) && (b.first > id) ) )
+	b.second = moved[b.second-pos];
+    }
+  _assets = std::move(merged);
+  index.clear();
+  for (std::size_t i=0; i<_assets.size(); ++i)
+    index.insert({ _assets[i].key, i });
+}
+
+void SiliconWeb::Assets::blockStarted(Silicon* s, std::size_t id)
+{
+  /* Forget previous renders before marking the block */
+  SiliconWeb::assets(s);
+  css.blockStarted(id);
+  js.blockStarted(id);
+  directJs.blockStarted(id);
+}
+
+void SiliconWeb::Assets::blockRendered(std::size_t id, Silicon::RenderData& block)
+{
+  Assets& other = static_cast<Assets&>(block);
+  css.blockRendered(id, std::move(other.css));
+  js.blockRendered(id, std::move(other.js));
+  directJs.blockRendered(id, std::move(other.directJs));
+}
+
+SiliconWeb::Assets& SiliconWeb::assets(Silicon* s)
+{
+  Assets& assets = s->getExtensionData<Assets>("_siliconWeb.assets");
+
+  /* New render, forget what the templates included last time */
+  if ( (s->isRendering()) && (assets.renderNumber != s->getRenderNumber()) )
+    {
+      assets.css.dropRendered();
+      assets.js.dropRendered();
+      assets.directJs.dropRendered();
+      assets.renderNumber = s->getRenderNumber();
+    }
+
+  return assets;
+}
+
+const SiliconWeb::Settings& SiliconWeb::settings(Silicon* s)
+{
+  Settings& st = s->getExtensionData<Settings>("_siliconWeb.settings");
+  unsigned long version = s->getSettingsVersion();
+  unsigned long defaults = _defaultsVersion.load(std::memory_order_relaxed);
+  if ( (st.valid) && (st.version == version) && (st.defaultsVersion == defaults) )
+    return st;
+
+  st.cssUrl = getCssUrl(s);
+  st.jsUrl = getJsUrl(s);
+  st.doRender = getDoRender(s);
+  st.version = version;
+  st.defaultsVersion = defaults;
+  st.valid = true;
+
+  return st;
 }
 
-/* Include CSS by code, just add it to the collection */
+/* Include CSS by code, just add it to the registry */
 void SiliconWeb::includeCss(Silicon* s, std::string file, std::string media)
 {
-  std::string fileabs = (isAbsolute(file))?file:getCssUrl(s)+file;
-  std::string out = "<link href=\""+fileabs+"\" rel=\"stylesheet\" type=\"text/css\"";
-  if (!media.empty())
-    out+=" media=\""+media+"\"";
-  out+=" />";
-  s->addToCollection("_CSS", {
-	  { "file", file },
-	  { "href", fileabs },
-	  { "media", media },
-	  { "code", out }
-    });
+  std::string fileabs = resolveUrl(settings(s).cssUrl, file);
+  const std::string* _media = (media.empty())?NULL:&media;
+  std::string out = cssTag(s, fileabs, _media);
+  assets(s).css.add(cssKey(fileabs, _media), std::move(out), !s->isRendering());
 }
 
-/* Include JS by code, adding it to the collection */
+/* Include JS by code, adding it to the registry */
 void SiliconWeb::includeJs(Silicon* s, std::string file)
 {
-  std::string fileabs = (isAbsolute(file))?file:getJsUrl(s)+file;
-  std::string out = "<script type=\"text/javascript\" src=\""+fileabs+"\" rel=\"stylesheet\"></script>";
-  s->addToCollection("_JS", {
-	  { "file", file },
-	  { "src", fileabs },
-	  { "code", out }
-    });}
-
-/* Add direct Js to the collection  */
+  std::string fileabs = resolveUrl(settings(s).jsUrl, file);
+  std::string out = jsTag(s, fileabs, " rel=\"stylesheet\"");
+  assets(s).js.add(fileabs, std::move(out), !s->isRendering());
+}
+
+/* Add direct Js to the registry  */
 void SiliconWeb::directJs(Silicon* s, std::string code)
 {
   if (code.empty())
     return;
 
-  s->addToCollection("_directJS", { { "code", code } });
+  assets(s).directJs.add(code, code, !s->isRendering());
 }
 
 std::string SiliconWeb::renderCss (Silicon* s, Silicon::StringMap args, std::string input)
 {
-  auto list = s->getCollection("_CSS");
+  /* Async blocks before this may include stylesheets */
+  s->joinAsync();
+  const AssetList& list = assets(s).css;
   if (list.empty())
     return "";
 
@@ -164,14 +533,16 @@ std::string SiliconWeb::renderCss (Silicon* s, Silicon::StringMap args, std::str
   bool printComment = ( (comments != args.end()) && (comments->second != "0") );
 
   std::string out;
+  std::size_t len = 0;
+  for (auto& a : list.assets())
+    len+=a.tag.size()+1;
+  out.reserve(len+48);
+
   if (printComment)
     out+="<!-- Start styles -->\n";
 
-  for (auto s : list)
-    {
-      auto code = s.find("code");
-      out+=code->second+"\n";
-    }
+  for (auto& a : list.assets())
+    out.append(a.tag).append(1, '\n');
 
   if (printComment)
     out+="<!-- End styles -->\n";
@@ -181,27 +552,20 @@ std::string SiliconWeb::renderCss (Silicon* s, Silicon::StringMap args, std::str
 
 std::string SiliconWeb::_includeCss (Silicon* s, Silicon::StringMap args, std::string input)
 {
-  std::string out;
   auto _file=args.find("file");
   if (_file==args.end())
     return "";
 
+  const Settings& st = settings(s);
   auto media=args.find("media");
-  std::string file = (isAbsolute(_file->second))?_file->second:getCssUrl(s)+_file->second;
-  out= "<link href=\""+file+"\" rel=\"stylesheet\" type=\"text/css\"";
-  if (media!=args.end())
-    out+=" media=\""+media->second+"\"";
-  out+=" />";
+  const std::string* _media = (media!=args.end())?&media->second:NULL;
+  std::string file = resolveUrl(st.cssUrl, _file->second);
+  std::string out = cssTag(s, file, _media);
 
-  if (getDoRender(s))
+  if (st.doRender)
     return out;
   else
-      s->addToCollection("_CSS", {
-	  { "file", _file->second },
-	  { "href", file },
-	  { "media", (media!=args.end())?media->second:"" },
-	  { "code", out }
-	});
+    assets(s).css.add(cssKey(file, _media), std::move(out), !s->isRendering());
 
   return "";
 }
@@ -224,7 +588,7 @@ std::string SiliconWeb::getCssUrl(Silicon * s)
   if ( (basePath.empty()) && (cssURL.empty()) )
     return "";
 
-  if (cssURL.front()=='/')
+  if ( (!cssURL.empty()) && (cssURL.front()=='/') )
     cssURL.substr(1);
 
   return addSlash(basePath+cssURL);
@@ -238,18 +602,18 @@ bool SiliconWeb::getDoRender(Silicon * s)
 
 std::string SiliconWeb::_includeJs(Silicon * s, Silicon :: StringMap args, std :: string input)
 {
-  std::string out;
   auto _file=args.find("file");
   if (_file==args.end())
     return "";
 
-  std::string file = (isAbsolute(_file->second))?_file->second:getJsUrl(s)+_file->second;
-  out= "<script type=\"text/javascript\" src=\""+file+"\"></script>";
+  const Settings& st = settings(s);
+  std::string file = resolveUrl(st.jsUrl, _file->second);
+  std::string out = jsTag(s, file);
 
-  if (getDoRender(s))
+  if (st.doRender)
     return out;
   else
-    s->addToCollection("_JS", { { "file", _file->second }, { "src", file }, { "code", out } });
+    assets(s).js.add(file, std::move(out), !s->isRendering());
 
   return "";
 }
@@ -259,13 +623,14 @@ std::string SiliconWeb::_directJs(Silicon * s, Silicon :: StringMap args, std ::
   if (input.empty())
     return "";
 
-  s->addToCollection ("_directJS", { { "code", input } });
+  assets(s).directJs.add(input, input, !s->isRendering());
 
  return "";
 }
 
 std::string SiliconWeb::renderJs(Silicon * s, Silicon :: StringMap args, std :: string input)
 {
+  s->joinAsync();
   std::string out;
 
   auto comments = args.find("comments");
@@ -278,31 +643,18 @@ std::string SiliconWeb::renderJs(Silicon * s, Silicon :: StringMap args, std ::
   test = args.find("direct");
   bool renderDirect = ( (test == args.end()) || (test->second!="0") );
 
+  Assets& registry = assets(s);
   if (renderFiles)
     {
-      auto list = s->getCollection("_JS");
-      if (!list.empty())
-	{
-	  for (auto s : list)
-	    {
-	      auto code = s.find("code");
-	      out+=code->second+"\n";
-	    }
-	}
+      for (auto& a : registry.js.assets())
+	out.append(a.tag).append(1, '\n');
     }
-  if (renderDirect)
+  if ( (renderDirect) && (!registry.directJs.empty()) )
     {
-      auto list = s->getCollection("_directJS");
-      if (!list.empty())
-	{
-	  out+="<script type=\"text/javascript\">";
-	  for (auto s : list)
-	    {
-	      auto code = s.find("code");
-	      out+=code->second+"\n";
-	    }
-	  out+="</script>\n";
-	}
+      out+="<script type=\"text/javascript\">";
+      for (auto& a : registry.directJs.assets())
+	out.append(a.tag).append(1, '\n');
+      out+="</script>\n";
     }
   if (printComment)
     out+="<!-- End scripts -->\n";
@@ -321,7 +673,7 @@ std::string SiliconWeb::getJsUrl(Silicon * s)
   if ( (basePath.empty()) && (jsURL.empty()) )
     return "";
 
-  if (jsURL.front()=='/')
+  if ( (!jsURL.empty()) && (jsURL.front()=='/') )
     jsURL.substr(1);
 
   return addSlash(basePath+jsURL);
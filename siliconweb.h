@@ -5,20 +5,143 @@
 #define _SILICONWEB_H 1
 
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
 #include "silicon.h"
 #include "siliconloader.h"
 
 class SiliconWeb : public SiliconLoader
 {
  public:
+  /**
+   * Tags included in a page (CSS, JS...), in inclusion order. Each
+   * URL (CSS: URL and media, or code) is stored once, with its tag
+   * already built.
+   */
+  class AssetList
+  {
+  public:
+    struct Asset
+    {
+      /* Resolved URL (and media) or code, used to find duplicates */
+      std::string key;
+      /* Tag to render */
+      std::string tag;
+      /* Added from C++, not by a template. It's kept between renders */
+      bool persistent;
+    };
+
+    /**
+     * Adds asset if its key wasn't there
+     *
+     * @param key Resolved URL (and media) or code
+     * @param tag Tag to render
+     * @param persistent Keep it for next renders
+     *
+     * @return false if it was already there
+     */
+    bool add(const std::string& key, std::string tag, bool persistent);
+
+    /**
+     * Removes assets added by templates in previous renders
+     */
+    void dropRendered();
+
+    /**
+     * An async block starts here, its assets will go here
+     *
+     * @param id Block id
+     */
+    void blockStarted(std::size_t id);
+
+    /**
+     * Puts assets of an async block where it started. The ones
+     * already included before it are skipped, and the ones
+     * included again after it are moved here.
+     *
+     * @param id Block id
+     * @param block Assets included by the block
+     */
+    void blockRendered(std::size_t id, AssetList&& block);
+
+    inline const std::vector<Asset>& assets() const
+    {
+      return _assets;
+    }
+
+    inline bool empty() const
+    {
+      return _assets.empty();
+    }
+
+  private:
+    std::vector<Asset> _assets;
+    /* key -> position in _assets */
+    std::unordered_map<std::string, std::size_t> index;
+    /* Async blocks not rendered yet: id, position in _assets */
+    std::vector<std::pair<std::size_t, std::size_t> > blocks;
+  };
+
+  /**
+   * Everything included in a render
+   */
+  struct Assets : public Silicon::RenderData
+  {
+    AssetList css;
+    AssetList js;
+    AssetList directJs;
+    /* Render these assets belong to */
+    unsigned long renderNumber = 0;
+
+    void blockStarted(Silicon* s, std::size_t id);
+    void blockRendered(std::size_t id, Silicon::RenderData& block);
+  };
+
+  /**
+   * URLs and render mode resolved from _baseURL, _cssURL, _jsURL,
+   * _renderResources and defaults. They are computed again only
+   * when any of them changes.
+   */
+  struct Settings
+  {
+    std::string cssUrl;
+    std::string jsUrl;
+    bool doRender = false;
+    /* Silicon::getSettingsVersion() when computed */
+    unsigned long version = 0;
+    /* SiliconWeb defaults version when computed */
+    unsigned long defaultsVersion = 0;
+    bool valid = false;
+  };
+
   static void load(Silicon* s=NULL);
 
+  /**
+   * Gets resolved settings for s
+   *
+   * @param s Silicon instance
+   *
+   * @return settings
+   */
+  static const Settings& settings(Silicon* s);
+
+  /**
+   * Gets assets included in current render of s
+   *
+   * @param s Silicon instance
+   *
+   * @return assets
+   */
+  static Assets& assets(Silicon* s);
+
   /* Getters and setters */
 
   /* for default URL */
   static inline std::string defaultUrl(std::string url)
   {
     _defaultUrl = url;
+    ++_defaultsVersion;
     return _defaultUrl;
   }
 
@@ -31,6 +154,7 @@ class SiliconWeb : public SiliconLoader
   static inline std::string cssUrl(std::string url)
   {
     _cssUrl = url;
+    ++_defaultsVersion;
     return _cssUrl;
   }
 
@@ -43,6 +167,7 @@ class SiliconWeb : public SiliconLoader
   static inline std::string jsUrl(std::string url)
   {
     _jsUrl = url;
+    ++_defaultsVersion;
     return _jsUrl;
   }
 
@@ -55,6 +180,7 @@ class SiliconWeb : public SiliconLoader
   static inline bool renderDefault(bool val)
   {
     _renderDefault = val;
+    ++_defaultsVersion;
     return _renderDefault;
   }
 
@@ -88,9 +214,33 @@ class SiliconWeb : public SiliconLoader
 
   /*
     renders a list with a collection
+    options collection=name (each row: text, link, title)
+	    class=, id=     (optional) ul attributes
+	    uselink=1       (optional) text inside <a href=link>
    */
   static std::string list (Silicon* s, Silicon::StringMap args, std::string input);
 
+  /*
+    same as list, but renders an <ol>
+   */
+  static std::string olist (Silicon* s, Silicon::StringMap args, std::string input);
+
+  /*
+    renders <option>s for a <select> with a collection
+    options collection=name (each row: value, text)
+	    selected=value  (optional) selected option
+   */
+  static std::string options (Silicon* s, Silicon::StringMap args, std::string input);
+
+  /*
+    renders a table with a collection
+    options collection=name
+	    columns=a,b,c   fields to show, in order
+	    headers=A,B,C   (optional) header row
+	    class=, id=     (optional) table attributes
+   */
+  static std::string table (Silicon* s, Silicon::StringMap args, std::string input);
+
   static std::string getBaseUrl (Silicon* s);
   static std::string getCssUrl (Silicon* s);
   static std::string getJsUrl (Silicon* s);
@@ -107,6 +257,9 @@ class SiliconWeb : public SiliconLoader
 
   /* Renders css/js by default */
   static bool _renderDefault;
+
+  /* Changes of the defaults above */
+  static std::atomic<unsigned long> _defaultsVersion;
 };
 
 #endif /* _SILICONWEB_H */